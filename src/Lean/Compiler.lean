@@ -14,6 +14,7 @@ import Lean.Compiler.IR
 import Lean.Compiler.CSimpAttr
 import Lean.Compiler.FFI
 import Lean.Compiler.NoncomputableAttr
+import Lean.Compiler.CompilerCache
 import Lean.Compiler.Main
 import Lean.Compiler.AtMostOnce -- TODO: delete after we port code generator to Lean
 import Lean.Compiler.Old -- TODO: delete after we port code generator to Lean
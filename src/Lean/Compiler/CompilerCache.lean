@@ -0,0 +1,55 @@
+/-
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+-/
+import Lean.Compiler.InlineAttrs
+import Lean.Compiler.Specialize
+import Lean.Compiler.CSimpAttr
+import Lean.Compiler.ImplementedByAttr
+import Lean.Compiler.ExternAttr
+import Lean.Compiler.ExportAttr
+import Lean.Compiler.InitAttr
+import Lean.Compiler.NeverExtractAttr
+import Lean.Meta.Match.MatcherInfo
+
+/-!
+Helper functions for the persistent cache of the (old) compiler stages, see `compiler.cache_dir` and
+`compiler_cache.cpp`.
+-/
+
+namespace Lean.Compiler
+
+/-- Environment extensions whose entries may affect the result of the cached compiler stages. -/
+def cacheRelevantExtensions : Array Name := #[
+  inlineAttrs.ext.name, specializeAttr.ext.name, nospecializeAttr.ext.name, specExtension.name,
+  CSimp.ext.ext.name, implementedByAttr.ext.name, externAttr.ext.name, exportAttr.ext.name,
+  regularInitAttr.ext.name, builtinInitAttr.ext.name, neverExtractAttr.ext.name,
+  Meta.Match.Extension.extension.name]
+
+/--
+Return the entries of the extensions in `cacheRelevantExtensions` of all imported modules. The compiler cache hashes
+their contents, see `imports_fingerprint_cache`.
+-/
+@[export lean_compiler_cache_imported_entries]
+def getCacheRelevantImportedEntries (env : Environment) : Array (Name × Array EnvExtensionEntry) := Id.run do
+  let mut result := #[]
+  for mod in env.header.moduleData do
+    for (extName, entries) in mod.entries do
+      if cacheRelevantExtensions.contains extName then
+        result := result.push (extName, entries)
+  return result
+
+/--
+Return a hash of the `[csimp]` replacements added after the imports, i.e., by the current module or by activating
+scoped entries. It does not depend on the order of the replacements.
+-/
+@[export lean_compiler_cache_local_csimp_hash]
+def getLocalCSimpHash (env : Environment) : UInt64 := Id.run do
+  -- collect the replacements first, as the old code generator does not unbox the result of a fold in `Id`
+  let replacements := (CSimp.ext.getState env).map.foldStage2 (fun rs fromDeclName toDeclName => rs.push (fromDeclName, toDeclName)) #[]
+  let mut h : UInt64 := 7
+  for (fromDeclName, toDeclName) in replacements do
+    h := h + mixHash (hash fromDeclName) (hash toDeclName)
+  return h
+
+end Lean.Compiler
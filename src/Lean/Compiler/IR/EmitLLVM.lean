@@ -59,6 +59,11 @@ structure Context (llvmctx : LLVM.Context) where
   mainFn     : FunId := default
   mainParams : Array Param := #[]
   llvmmodule : LLVM.Module llvmctx
+  /-- Declarations to emit. If `none`, all declarations of the current module are emitted. -/
+  decls?     : Option (List Decl) := none
+  /-- If `false`, nullary declarations ("constants") are only declared, as they are defined by a separate module
+  that is linked with this one, see `emitLLVMChunks`. -/
+  defineConsts : Bool := true
 
 structure State (llvmctx : LLVM.Context) where
   var2val : HashMap VarId (LLVM.LLVMType llvmctx × LLVM.Value llvmctx)
@@ -90,6 +95,12 @@ def getEnv : M llvmctx Environment := Context.env <$> read
 
 def getModName : M llvmctx  Name := Context.modName <$> read
 
+/-- Return the declarations to be emitted, see `Context.decls?`. -/
+def getEmittedDecls : M llvmctx (List Decl) := do
+  match (← read).decls? with
+  | some decls => return decls
+  | none => return getDecls (← getEnv)
+
 def getDecl (n : Name) : M llvmctx Decl := do
   let env ← getEnv
   match findEnvDecl env n with
@@ -480,7 +491,7 @@ def emitExternDeclAux (decl : Decl) (cNameStr : String) : M llvmctx Unit := do
 
 def emitFnDecls : M llvmctx Unit := do
   let env ← getEnv
-  let decls := getDecls env
+  let decls ← getEmittedDecls
   let modDecls  : NameSet := decls.foldl (fun s d => s.insert d.name) {}
   let usedDecls : NameSet := decls.foldl (fun s d => collectUsedDecls env d (s.insert d.name)) {}
   let usedDecls := usedDecls.toList
@@ -488,7 +499,7 @@ def emitFnDecls : M llvmctx Unit := do
     let decl ← getDecl n
     match getExternNameFor env `c decl.name with
     | some cName => emitExternDeclAux decl cName
-    | none       => emitFnDecl decl (!modDecls.contains n)
+    | none       => emitFnDecl decl (!modDecls.contains n || (decl.params.isEmpty && !(← read).defineConsts))
   return ()
 
 def emitLhsSlot_ (x : VarId) : M llvmctx (LLVM.LLVMType llvmctx × LLVM.Value llvmctx) := do
@@ -1198,8 +1209,7 @@ def emitDecl (mod : LLVM.Module llvmctx) (builder : LLVM.Builder llvmctx) (d : D
     throw (s!"emitDecl:\ncompiling:\n{d}\nerr:\n{err}\n")
 
 def emitFns (mod : LLVM.Module llvmctx) (builder : LLVM.Builder llvmctx) : M llvmctx Unit := do
-  let env ← getEnv
-  let decls := getDecls env
+  let decls ← getEmittedDecls
   decls.reverse.forM (emitDecl mod builder)
 
 def callIODeclInitFn (builder : LLVM.Builder llvmctx)
@@ -1550,6 +1560,17 @@ def optimizeLLVMModule (mod : LLVM.Module ctx) : IO Unit := do
   LLVM.disposePassManager pm
   LLVM.disposePassManagerBuilder pmb
 
+/--
+Inline calls across the chunks linked by `emitLLVM`, and remove the runtime functions and declarations that are not
+used anymore. The chunks have already been optimized separately, so we do not run the full pipeline again.
+-/
+def optimizeLinkedChunks (mod : LLVM.Module ctx) : IO Unit := do
+  let pm ← LLVM.createPassManager
+  pm.addFunctionInliningPass
+  pm.addGlobalDCEPass
+  LLVM.runPassManager pm mod
+  LLVM.disposePassManager pm
+
 /-- Get the names of all global symbols in the module -/
 partial def getModuleGlobals (mod : LLVM.Module llvmctx) : IO (Array (LLVM.Value llvmctx)) := do
   let rec go (v : LLVM.Value llvmctx) (acc : Array (LLVM.Value llvmctx)) : IO (Array (LLVM.Value llvmctx)) := do
@@ -1565,53 +1586,179 @@ partial def getModuleFunctions (mod : LLVM.Module llvmctx) : IO (Array (LLVM.Val
   go (← LLVM.getFirstFunction mod) #[]
 
 /--
-`emitLLVM` is the entrypoint for the lean shell to code generate LLVM.
+Get the names of the globals and of the defined functions of the runtime module `modruntime`.
+Declarations such as `lean_inc_ref_cold`, which are defined externally, and intrinsics such as
+`@llvm.umul.with.overflow.i64`, which clang generates, are skipped.
 -/
-@[export lean_ir_emit_llvm]
-def emitLLVM (env : Environment) (modName : Name) (filepath : String) (tripleStr? : Option String) : IO Unit := do
-  LLVM.llvmInitializeTargetInfo
+def getRuntimeSymbols (modruntime : LLVM.Module llvmctx) : IO (Array String × Array String) := do
+  let runtimeGlobals ← (← getModuleGlobals modruntime).mapM (·.getName)
+  let filter func := do
+    if (← LLVM.isDeclaration func) then
+      return none
+    else
+      return some (← func.getName)
+  let runtimeFunctions ← (← getModuleFunctions modruntime).filterMapM filter
+  return (runtimeGlobals, runtimeFunctions)
+
+/--
+Link the runtime functions of `lean.h` into `mod` with the given linkage, and optimize the result.
+-/
+def linkRuntimeAndOptimize (llvmctx : LLVM.Context) (mod : LLVM.Module llvmctx)
+    (linkage := LLVM.Linkage.internal) : IO Unit := do
+  let membuf ← LLVM.createMemoryBufferWithContentsOfFile (← getLeanHBcPath).toString
+  let modruntime ← LLVM.parseBitcode llvmctx membuf
+  /- It is important that we extract the names here because
+     pointers into modruntime get invalidated by linkModules -/
+  let (runtimeGlobals, runtimeFunctions) ← getRuntimeSymbols modruntime
+  LLVM.linkModules (dest := mod) (src := modruntime)
+  for name in runtimeGlobals do
+    let some global ← LLVM.getNamedGlobal mod name
+       | throw <| IO.Error.userError s!"ERROR: linked module must have global from runtime module: '{name}'"
+    LLVM.setLinkage global linkage
+  for name in runtimeFunctions do
+    let some fn ← LLVM.getNamedFunction mod name
+       | throw <| IO.Error.userError s!"ERROR: linked module must have function from runtime module: '{name}'"
+    LLVM.setLinkage fn linkage
+  optimizeLLVMModule mod
+
+/--
+Give the runtime functions of `lean.h` that are still present in `mod` internal linkage. This is used after linking
+chunks emitted with `linkOnceODR` runtime functions, see `emitLLVMChunks`.
+-/
+def internalizeRuntime (llvmctx : LLVM.Context) (mod : LLVM.Module llvmctx) : IO Unit := do
+  let membuf ← LLVM.createMemoryBufferWithContentsOfFile (← getLeanHBcPath).toString
+  let modruntime ← LLVM.parseBitcode llvmctx membuf
+  let (runtimeGlobals, runtimeFunctions) ← getRuntimeSymbols modruntime
+  LLVM.disposeModule modruntime
+  -- functions that were inlined everywhere have been removed from the chunks
+  for name in runtimeGlobals do
+    if let some global ← LLVM.getNamedGlobal mod name then
+      LLVM.setLinkage global LLVM.Linkage.internal
+  for name in runtimeFunctions do
+    if let some fn ← LLVM.getNamedFunction mod name then
+      LLVM.setLinkage fn LLVM.Linkage.internal
+
+/--
+Run `emit` on a fresh LLVM context and module, link the runtime into the result with the given linkage, optimize it,
+and write it to `filepath`.
+-/
+def emitLLVMToFile (env : Environment) (modName : Name) (filepath : String) (decls? : Option (List Decl))
+    (defineConsts : Bool) (emit : (llvmctx : LLVM.Context) → EmitLLVM.M llvmctx Unit)
+    (runtimeLinkage := LLVM.Linkage.internal) : IO Unit := do
   let llvmctx ← LLVM.createContext
   let module ← LLVM.createModule llvmctx modName.toString
-  let emitLLVMCtx : EmitLLVM.Context llvmctx := {env := env, modName := modName, llvmmodule := module}
+  let emitLLVMCtx : EmitLLVM.Context llvmctx :=
+    {env := env, modName := modName, llvmmodule := module, decls? := decls?, defineConsts := defineConsts}
   let initState := { var2val := default, jp2bb := default : EmitLLVM.State llvmctx}
-  let out? ← ((EmitLLVM.main (llvmctx := llvmctx)).run initState).run emitLLVMCtx
-  match out? with
+  match ← ((emit llvmctx).run initState).run emitLLVMCtx with
   | .ok _ => do
-         let membuf ← LLVM.createMemoryBufferWithContentsOfFile (← getLeanHBcPath).toString
-         let modruntime ← LLVM.parseBitcode llvmctx membuf
-         /- It is important that we extract the names here because
-            pointers into modruntime get invalidated by linkModules -/
-         let runtimeGlobals ← (← getModuleGlobals modruntime).mapM (·.getName)
-         let filter func := do
-           -- | Do not insert internal linkage for
-           -- intrinsics such as `@llvm.umul.with.overflow.i64` which clang generates, and also
-           -- for declarations such as `lean_inc_ref_cold` which are externally defined.
-           if (← LLVM.isDeclaration func) then
-             return none
-           else
-             return some (← func.getName)
-         let runtimeFunctions ← (← getModuleFunctions modruntime).filterMapM filter
-         LLVM.linkModules (dest := emitLLVMCtx.llvmmodule) (src := modruntime)
-         -- Mark every global and function as having internal linkage.
-         for name in runtimeGlobals do
-           let some global ← LLVM.getNamedGlobal emitLLVMCtx.llvmmodule name
-              | throw <| IO.Error.userError s!"ERROR: linked module must have global from runtime module: '{name}'"
-           LLVM.setLinkage global LLVM.Linkage.internal
-         for name in runtimeFunctions do
-           let some fn ← LLVM.getNamedFunction emitLLVMCtx.llvmmodule name
-              | throw <| IO.Error.userError s!"ERROR: linked module must have function from runtime module: '{name}'"
-           LLVM.setLinkage fn LLVM.Linkage.internal
-
-         optimizeLLVMModule emitLLVMCtx.llvmmodule
-         LLVM.writeBitcodeToFile emitLLVMCtx.llvmmodule filepath
-         let tripleStr := tripleStr?.getD (← LLVM.getDefaultTargetTriple)
-         let target ← LLVM.getTargetFromTriple tripleStr
-         let cpu := "generic"
-         let features := ""
-         let targetMachine ← LLVM.createTargetMachine target tripleStr cpu features
-         let codegenType := LLVM.CodegenFileType.ObjectFile
-         LLVM.targetMachineEmitToFile targetMachine emitLLVMCtx.llvmmodule (filepath ++ ".o") codegenType
-         LLVM.disposeModule emitLLVMCtx.llvmmodule
-         LLVM.disposeTargetMachine targetMachine
+    linkRuntimeAndOptimize llvmctx module runtimeLinkage
+    LLVM.writeBitcodeToFile module filepath
+    LLVM.disposeModule module
   | .error err => throw (IO.Error.userError err)
+
+/-- Remove the given chunk files, ignoring files that do not exist. -/
+def removeChunkFiles (paths : Array String) : IO Unit := do
+  for path in paths do
+    try IO.FS.removeFile path catch _ => pure ()
+
+/--
+Emit the declarations of the current module as `numChunks` chunks of consecutive declarations, plus a chunk defining
+the constants, the module initializer, and `main`. Each chunk is emitted and optimized in its own LLVM context on a
+dedicated thread. Return the paths of the resulting bitcode files, which must be linked by the caller.
+The runtime functions are linked into each chunk with `linkOnceODR` linkage, so that linking the chunks keeps a single
+copy of them; the caller must make them internal with `internalizeRuntime` afterwards.
+If emitting any chunk fails, the files of the other chunks are removed.
+-/
+def emitLLVMChunks (env : Environment) (modName : Name) (filepath : String) (numChunks : Nat) :
+    IO (Array String) := do
+  let decls := (getDecls env).reverse.toArray
+  let consts := decls.toList.filter (·.params.isEmpty) |>.reverse
+  let initPath := filepath ++ ".init"
+  let initTask ← IO.asTask (prio := .dedicated) do
+    emitLLVMToFile env modName initPath (some consts) true (runtimeLinkage := .linkOnceODR) fun llvmctx => do
+      EmitLLVM.emitFnDecls
+      let builder ← LLVM.createBuilderInContext llvmctx
+      EmitLLVM.emitInitFn (← EmitLLVM.getLLVMModule) builder
+      EmitLLVM.emitMainFnIfNeeded (← EmitLLVM.getLLVMModule) builder
+  let mut tasks := #[(initPath, initTask)]
+  let chunkSize := max 1 ((decls.size + numChunks - 1) / numChunks)
+  let mut i := 0
+  while i < decls.size do
+    let chunkPath := filepath ++ s!".{tasks.size}"
+    -- `emitFns` expects the declarations in the order of `getDecls`
+    let chunk := (decls.extract i (i + chunkSize)).toList.reverse
+    let chunkTask ← IO.asTask (prio := .dedicated) do
+      emitLLVMToFile env modName chunkPath (some chunk) false (runtimeLinkage := .linkOnceODR) fun llvmctx => do
+        EmitLLVM.emitFnDecls
+        let builder ← LLVM.createBuilderInContext llvmctx
+        EmitLLVM.emitFns (← EmitLLVM.getLLVMModule) builder
+    tasks := tasks.push (chunkPath, chunkTask)
+    i := i + chunkSize
+  -- wait for all chunks before reporting an error, so that no chunk file is written after the cleanup
+  let results : Array (Except IO.Error Unit) ← tasks.mapM fun (_, task) => IO.wait task
+  if let some (.error err) := results.find? (· matches .error _) then
+    removeChunkFiles (tasks.map (·.1))
+    throw err
+  return tasks.map (·.1)
+
+/--
+`emitLLVM` is the entrypoint for the lean shell to code generate LLVM.
+If `numThreads > 1`, the module is emitted in parallel using `emitLLVMChunks`, and the chunks are linked afterwards,
+inlining calls between chunks with `optimizeLinkedChunks`.
+-/
+@[export lean_ir_emit_llvm]
+def emitLLVM (env : Environment) (modName : Name) (filepath : String) (tripleStr? : Option String)
+    (numThreads : UInt32) : IO Unit := do
+  LLVM.llvmInitializeTargetInfo
+  let llvmctx ← LLVM.createContext
+  let module ← LLVM.createModule llvmctx modName.toString
+  if numThreads ≤ 1 then
+    let emitLLVMCtx : EmitLLVM.Context llvmctx := {env := env, modName := modName, llvmmodule := module}
+    let initState := { var2val := default, jp2bb := default : EmitLLVM.State llvmctx}
+    match ← ((EmitLLVM.main (llvmctx := llvmctx)).run initState).run emitLLVMCtx with
+    | .ok _ => linkRuntimeAndOptimize llvmctx module
+    | .error err => throw (IO.Error.userError err)
+  else
+    let chunkPaths ← emitLLVMChunks env modName filepath numThreads.toNat
+    try
+      for chunkPath in chunkPaths do
+        let membuf ← LLVM.createMemoryBufferWithContentsOfFile chunkPath
+        let chunk ← LLVM.parseBitcode llvmctx membuf
+        LLVM.linkModules (dest := module) (src := chunk)
+    finally
+      removeChunkFiles chunkPaths
+    internalizeRuntime llvmctx module
+    optimizeLinkedChunks module
+  LLVM.writeBitcodeToFile module filepath
+  let tripleStr := tripleStr?.getD (← LLVM.getDefaultTargetTriple)
+  let target ← LLVM.getTargetFromTriple tripleStr
+  let cpu := "generic"
+  let features := ""
+  let targetMachine ← LLVM.createTargetMachine target tripleStr cpu features
+  let codegenType := LLVM.CodegenFileType.ObjectFile
+  LLVM.targetMachineEmitToFile targetMachine module (filepath ++ ".o") codegenType
+  LLVM.disposeModule module
+  LLVM.disposeTargetMachine targetMachine
+
+/--
+`emitLLVMDecls` writes LLVM bitcode for the given function declarations of the current module to `filepath`. Unlike
+`emitLLVM`, no module initializer is emitted. Instead, the global variables of the nullary declarations ("constants")
+`constNames` of the current module are defined without a value, and must be set by the caller before the code is run.
+It is used by the interpreter to compile hot declarations at runtime.
+-/
+@[export lean_ir_emit_llvm_decls]
+def emitLLVMDecls (env : Environment) (modName : Name) (declNames : Array Name) (constNames : Array Name)
+    (filepath : String) : IO Unit := do
+  LLVM.llvmInitializeTargetInfo
+  let decls := declNames.toList.filterMap (findEnvDecl env)
+  emitLLVMToFile env modName filepath (some decls) true fun llvmctx => do
+    EmitLLVM.emitFnDecls
+    for n in constNames do
+      if let some d := findEnvDecl env n then
+        let global ← EmitLLVM.emitFnDeclAux (← EmitLLVM.getLLVMModule) d (← EmitLLVM.toCName n) (isExternal := false)
+        -- closed terms are hidden otherwise, but the interpreter must be able to look them up
+        LLVM.setVisibility global LLVM.Visibility.default
+    let builder ← LLVM.createBuilderInContext llvmctx
+    EmitLLVM.emitFns (← EmitLLVM.getLLVMModule) builder
 end Lean.IR
@@ -320,6 +320,12 @@ opaque PassManagerBuilder.setOptLevel (pmb : PassManagerBuilder ctx) (optLevel :
 @[extern "lean_llvm_pass_manager_builder_populate_module_pass_manager"]
 opaque PassManagerBuilder.populateModulePassManager (pmb : PassManagerBuilder ctx) (pm : PassManager ctx): BaseIO Unit
 
+@[extern "lean_llvm_add_function_inlining_pass"]
+opaque PassManager.addFunctionInliningPass (pm : PassManager ctx) : BaseIO Unit
+
+@[extern "lean_llvm_add_global_dce_pass"]
+opaque PassManager.addGlobalDCEPass (pm : PassManager ctx) : BaseIO Unit
+
 @[extern "lean_llvm_dispose_target_machine"]
 opaque disposeTargetMachine (tm : TargetMachine ctx) : BaseIO Unit
 
@@ -91,6 +91,27 @@ builtin_initialize
 def getPrintMessageEndPos (opts : Options) : Bool :=
   opts.getBool `printMessageEndPos false
 
+register_builtin_option kernel.asyncProofs : Bool := {
+  defValue := false
+  descr    := "type check theorem proofs in separate tasks, in parallel with the elaboration of the following commands"
+}
+
+/--
+  Wait for the proofs being type checked asynchronously (see `kernel.asyncProofs`), report the kernel time
+  of each theorem when `profiler` is set, and add an error message for each proof that does not type check. -/
+def waitKernelProofChecks (env : Environment) (opts : Options) (fileName : String) (messages : MessageLog) : IO MessageLog := do
+  let mut messages := messages
+  for (declName, time, result) in (← Kernel.waitPendingChecks) do
+    let ms := time * 1000
+    if profiler.get opts && ms >= (profiler.threshold.get opts).toFloat then
+      IO.println s!"kernel type checking of {declName} took {ms.toUInt64}ms"
+    if let .error ex := result then
+      let pos := match declRangeExt.find? env declName with
+        | some ranges => ranges.selectionRange.pos
+        | none        => ⟨1, 0⟩
+      messages := messages.add { fileName, pos, data := ex.toMessageData opts }
+  return messages
+
 @[export lean_run_frontend]
 def runFrontend
     (input : String)
@@ -110,7 +131,14 @@ def runFrontend
     -- Collect InfoTrees so we can later extract and export their info to the ilean file
     commandState := { commandState with infoState.enabled := true }
 
-  let s ← IO.processCommands inputCtx parserState commandState
+  let asyncProofs := kernel.asyncProofs.get opts
+  Kernel.setAsyncProofs asyncProofs
+  -- restore the setting even if a command throws, as it is global to the process
+  let mut s ← tryFinally (IO.processCommands inputCtx parserState commandState) do
+    if asyncProofs then Kernel.setAsyncProofs false
+  if asyncProofs then
+    let messages ← waitKernelProofChecks s.commandState.env opts fileName s.commandState.messages
+    s := { s with commandState.messages := messages }
   for msg in s.commandState.messages.toList do
     IO.print (← msg.toString (includeEndPos := getPrintMessageEndPos opts))
 
@@ -174,12 +174,35 @@ def find? (env : Environment) (n : Name) : Option ConstantInfo :=
 def contains (env : Environment) (n : Name) : Bool :=
   env.constants.contains n
 
+@[export lean_environment_is_imported]
+private def isImported (env : Environment) (n : Name) : Bool :=
+  env.const2ModIdx.contains n
+
 def imports (env : Environment) : Array Import :=
   env.header.imports
 
 def allImportedModuleNames (env : Environment) : Array Name :=
   env.header.moduleNames
 
+/--
+Return a fingerprint of the imported modules computed from their constants and the number of environment extension
+entries they contain. It is stable across processes and is used by the persistent compiler cache
+(see `compiler.cache_dir`).
+-/
+@[export lean_environment_imports_fingerprint]
+def importsFingerprint (env : Environment) : UInt64 := Id.run do
+  let mut h : UInt64 := 7
+  for i in [:env.header.moduleData.size] do
+    let mod := env.header.moduleData[i]!
+    h := mixHash h (hash env.header.moduleNames[i]!)
+    for c in mod.constants do
+      h := mixHash h (mixHash (hash c.name) (hash c.type))
+      if let some v := c.value? then
+        h := mixHash h (hash v)
+    for (extName, entries) in mod.entries do
+      h := mixHash h (mixHash (hash extName) (hash entries.size))
+  return h
+
 @[export lean_environment_set_main_module]
 def setMainModule (env : Environment) (m : Name) : Environment :=
   { env with header := { env.header with mainModule := m } }
@@ -240,6 +263,24 @@ opaque addDecl (env : Environment) (decl : @& Declaration) : Except KernelExcept
 
 end Environment
 
+namespace Kernel
+
+/--
+  When set, `Environment.addDecl` only checks the statement of a theorem before adding it,
+  and type checks the proof in a separate task. The results must be retrieved using `waitPendingChecks`.
+-/
+@[extern "lean_kernel_set_async_proofs"]
+opaque setAsyncProofs (b : Bool) : IO Unit
+
+/--
+  Wait for all proofs being type checked asynchronously (see `setAsyncProofs`), and return
+  the name of each theorem, the kernel time spent on it in seconds, and the result of the check.
+-/
+@[extern "lean_kernel_wait_pending_checks"]
+opaque waitPendingChecks : IO (Array (Name × Float × Except KernelException Unit))
+
+end Kernel
+
 namespace ConstantInfo
 
 def instantiateTypeLevelParams (c : ConstantInfo) (ls : List Level) : Expr :=
@@ -626,6 +667,9 @@ end MapDeclarationExtension
 opaque saveModuleData (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) : IO Unit
 @[extern "lean_read_module_data"]
 opaque readModuleData (fname : @& System.FilePath) : IO (ModuleData × CompactedRegion)
+/-- Like `readModuleData`, but reads (and, if necessary, relocates) all given files in parallel. -/
+@[extern "lean_read_module_data_par"]
+opaque readModuleDataPar (fnames : @& Array System.FilePath) : IO (Array (ModuleData × CompactedRegion))
 
 /--
   Free compacted regions of imports. No live references to imported objects may exist at the time of invocation; in
@@ -738,6 +782,8 @@ structure ImportState where
   moduleNames   : Array Name := #[]
   moduleData    : Array ModuleData := #[]
   regions       : Array CompactedRegion := #[]
+  /-- Modules read ahead of time by `readImportsPar`, not yet added to the fields above. -/
+  readModules   : NameMap (ModuleData × CompactedRegion) := {}
 
 def throwAlreadyImported (s : ImportState) (const2ModIdx : HashMap Name ModuleIdx) (modIdx : Nat) (cname : Name) : IO α := do
   let modName := s.moduleNames[modIdx]!
@@ -749,15 +795,38 @@ abbrev ImportStateM := StateRefT ImportState IO
 @[inline] nonrec def ImportStateM.run (x : ImportStateM α) (s : ImportState := {}) : IO (α × ImportState) :=
   x.run s
 
+private def findImportOLean (i : Import) : IO System.FilePath := do
+  let mFile ← findOLean i.module
+  unless (← mFile.pathExists) do
+    throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
+  return mFile
+
+/--
+  Read the `.olean` files of the transitive closure of `imports` into `readModules`, one layer of the import graph at
+  a time, reading all files of a layer in parallel. -/
+def readImportsPar (imports : Array Import) : ImportStateM Unit := do
+  let mut seen : NameHashSet := {}
+  let mut todo := imports
+  while !todo.isEmpty do
+    let mut layer : Array Import := #[]
+    for i in todo do
+      if !i.runtimeOnly && !seen.contains i.module && !(← get).moduleNameSet.contains i.module then
+        seen := seen.insert i.module
+        layer := layer.push i
+    let modRegions ← readModuleDataPar (← layer.mapM (findImportOLean ·))
+    todo := #[]
+    for i in layer, modRegion in modRegions do
+      modify fun s => { s with readModules := s.readModules.insert i.module modRegion }
+      todo := todo ++ modRegion.1.imports
+
 partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
   for i in imports do
     if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
       continue
     modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
-    let mFile ← findOLean i.module
-    unless (← mFile.pathExists) do
-      throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
-    let (mod, region) ← readModuleData mFile
+    let (mod, region) ← match (← get).readModules.find? i.module with
+      | some modRegion => pure modRegion
+      | none           => do readModuleData (← findImportOLean i)
     importModulesCore mod.imports
     modify fun s => { s with
       moduleData  := s.moduleData.push mod
@@ -765,6 +834,11 @@ partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
       moduleNames := s.moduleNames.push i.module
     }
 
+/-- Like `importModulesCore`, but reads the `.olean` files in parallel using `readImportsPar` first. -/
+def importModulesPar (imports : Array Import) : ImportStateM Unit := do
+  readImportsPar imports
+  importModulesCore imports
+
 def finalizeImport (s : ImportState) (imports : Array Import) (opts : Options) (trustLevel : UInt32 := 0) : IO Environment := do
   let numConsts := s.moduleData.foldl (init := 0) fun numConsts mod =>
     numConsts + mod.constants.size + mod.extraConstNames.size
@@ -807,8 +881,8 @@ def importModules (imports : Array Import) (opts : Options) (trustLevel : UInt32
     if imp.module matches .anonymous then
       throw <| IO.userError "import failed, trying to import module with anonymous name"
   withImporting do
-    let (_, s) ← importModulesCore imports |>.run
-    finalizeImport s imports opts trustLevel
+    let (_, s) ← importModulesPar imports |>.run
+    finalizeImport { s with readModules := {} } imports opts trustLevel
 
 /--
   Create environment object from imports and free compacted regions after calling `act`. No live references to the
@@ -852,6 +852,8 @@ def reduceNat? (e : Expr) : MetaM (Option Expr) :=
     | .app (.const fn _) a                =>
       if fn == ``Nat.succ then
         reduceUnaryNatOp Nat.succ a
+      else if fn == ``Nat.log2 then
+        reduceUnaryNatOp Nat.log2 a
       else
         return none
     | .app (.app (.const fn _) a1) a2 =>
@@ -864,6 +866,11 @@ def reduceNat? (e : Expr) : MetaM (Option Expr) :=
       else if fn == ``Nat.gcd then reduceBinNatOp Nat.gcd a1 a2
       else if fn == ``Nat.beq then reduceBinNatPred Nat.beq a1 a2
       else if fn == ``Nat.ble then reduceBinNatPred Nat.ble a1 a2
+      else if fn == ``Nat.land then reduceBinNatOp Nat.land a1 a2
+      else if fn == ``Nat.lor then reduceBinNatOp Nat.lor a1 a2
+      else if fn == ``Nat.xor then reduceBinNatOp Nat.xor a1 a2
+      else if fn == ``Nat.shiftLeft then reduceBinNatOp Nat.shiftLeft a1 a2
+      else if fn == ``Nat.shiftRight then reduceBinNatOp Nat.shiftRight a1 a2
       else return none
     | _ =>
       return none
@@ -197,12 +197,12 @@ typedef struct {
 } lean_thunk_object;
 
 struct lean_task;
+struct lean_task_waiter;
 
 /* Data required for executing a Lean task. It is released as soon as
    the task terminates even if the task object itself is still referenced. */
 typedef struct {
     lean_object *        m_closure;
-    struct lean_task *   m_head_dep;
     struct lean_task *   m_next_dep;
     unsigned             m_prio;
     uint8_t              m_canceled;
@@ -224,32 +224,32 @@ typedef struct {
 
    states:
    * Queued
-     * condition: in task_manager::m_queues && m_imp != nullptr && !m_imp->m_deleted
+     * condition: in a task_manager worker deque or injection queue && m_imp != nullptr && !m_imp->m_deleted
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: dequeued by worker thread            ==> Running     (`spawn_worker` lock)
+     * transition: dequeued or stolen by worker thread  ==> Running     (`run_task` lock)
    * Waiting
-     * condition: reachable from task via `m_head_dep->m_next_dep->...` && !m_imp->m_deleted
+     * condition: reachable from task via `m_head_dep->m_imp->m_next_dep->...` && !m_imp->m_deleted
      * invariant: m_imp != nullptr && m_value == nullptr
      * invariant: task dependency is Queued/Waiting/Running
        * It cannot become Deactivated because this task should be holding an owned reference to it
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: task dependency Finished ==> Queued (`handle_finished` under `spawn_worker` lock)
+     * transition: task dependency Finished ==> Queued (`handle_finished` under `run_task` lock)
    * Promised
      * condition: obtained as result from promise
      * invariant: m_imp != nullptr && m_value == nullptr
-     * transition: promise resolved ==> Finished (`resolve_core` under `spawn_worker` lock)
+     * transition: promise resolved ==> Finished (`resolve_core` under `resolve` lock)
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
    * Running
      * condition: m_imp != nullptr && m_imp->m_closure == nullptr
        * The worker takes ownership of the closure when running it
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: finished execution                   ==> Finished    (`spawn_worker` lock)
+     * transition: finished execution                   ==> Finished    (`run_task` lock)
    * Deactivated
      * condition: m_imp != nullptr && m_imp->m_deleted
      * invariant: RC == 0
-     * invariant: m_imp->m_closure == nullptr && m_imp->m_head_dep == nullptr (both freed by `deactivate_task_core`)
+     * invariant: m_imp->m_closure == nullptr && m_head_dep == nullptr (both freed by `deactivate_task_core`)
        * Note that all dependent tasks must have already been Deactivated by the converse of the second Waiting invariant
      * invariant: m_value == nullptr
      * transition: dequeued by worker thread   ==> freed
@@ -261,11 +261,18 @@ typedef struct {
    * Finished
      * condition: m_value != nullptr
      * invariant: m_imp == nullptr
-     * transition: RC becomes 0 ==> freed (`deactivate_task` lock) */
+     * invariant: m_head_dep and m_waiters are closed, i.e., no new dependencies or waiters can be added
+     * transition: RC becomes 0 ==> freed (`deactivate_task` lock)
+
+   Dependent tasks (`m_head_dep`) and threads blocked on the task (`m_waiters`) are registered without taking
+   the task manager lock by pushing onto these lists; finishing the task closes both lists atomically and then
+   enqueues the dependents and wakes up exactly the waiters of this task. */
 typedef struct lean_task {
-    lean_object            m_header;
-    _Atomic(lean_object *) m_value;
-    lean_task_imp *        m_imp;
+    lean_object                        m_header;
+    _Atomic(lean_object *)             m_value;
+    lean_task_imp *                    m_imp;
+    _Atomic(struct lean_task *)        m_head_dep;
+    _Atomic(struct lean_task_waiter *) m_waiters;
 } lean_task_object;
 
 typedef void (*lean_external_finalize_proc)(void *);
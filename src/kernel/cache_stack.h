@@ -38,4 +38,5 @@ public:                                                                 \
         m_cache->clear();                                               \
     }                                                                   \
     Cache * operator->() const { return m_cache; }                      \
+    Cache & operator*() const { return *m_cache; }                      \
 };
@@ -7,10 +7,13 @@ Author: Leonardo de Moura
 #include <utility>
 #include <vector>
 #include <limits>
+#include <atomic>
+#include <chrono>
 #include "runtime/sstream.h"
 #include "runtime/thread.h"
 #include "util/map_foreach.h"
 #include "util/io.h"
+#include "util/timeit.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
 #include "kernel/type_checker.h"
@@ -20,6 +23,7 @@ namespace lean {
 extern "C" object* lean_environment_add(object*, object*);
 extern "C" object* lean_mk_empty_environment(uint32, object*);
 extern "C" object* lean_environment_find(object*, object*);
+extern "C" uint8 lean_environment_is_imported(object*, object*);
 extern "C" uint32 lean_environment_trust_level(object*);
 extern "C" object* lean_environment_mark_quot_init(object*);
 extern "C" uint8 lean_environment_quot_init(object*);
@@ -61,6 +65,10 @@ optional<constant_info> environment::find(name const & n) const {
     return to_optional<constant_info>(lean_environment_find(to_obj_arg(), n.to_obj_arg()));
 }
 
+bool environment::is_imported(name const & n) const {
+    return lean_environment_is_imported(to_obj_arg(), n.to_obj_arg()) != 0;
+}
+
 constant_info environment::get(name const & n) const {
     object * o = lean_environment_find(to_obj_arg(), n.to_obj_arg());
     if (is_scalar(o))
@@ -173,20 +181,93 @@ environment environment::add_definition(declaration const & d, bool check) const
     }
 }
 
+/* When `g_async_proofs` is set, `add_theorem` only checks the statement of a theorem eagerly, and
+   type checks its value in a task. The statement is all later declarations can depend on, so the
+   proof can be checked while the next commands are elaborated. The tasks are collected in
+   `g_pending_checks`, and `lean_kernel_wait_pending_checks` must be used to retrieve the results
+   before the environment is considered valid (e.g., before writing the .olean file). */
+static std::atomic<bool> g_async_proofs(false);
+static mutex * g_pending_checks_mutex = nullptr;
+static std::vector<object *> * g_pending_checks = nullptr;
+
+static void check_theorem_value(environment const & env, declaration const & d, type_checker & checker) {
+    theorem_val const & v = d.to_theorem_val();
+    check_no_metavar_no_fvar(env, v.get_name(), v.get_value());
+    expr val_type = checker.check(v.get_value(), v.get_lparams());
+    if (!checker.is_def_eq(val_type, v.get_type()))
+        throw definition_type_mismatch_exception(env, d, val_type);
+}
+
+/* Task body for checking the value of theorem `decl`, produces `Name × Float × Except KernelException Unit`
+   where the `Float` is the kernel time in seconds. */
+static obj_res check_theorem_value_fn(obj_arg env, obj_arg decl, obj_arg) {
+    environment e(env);
+    declaration d(decl);
+    auto start = std::chrono::steady_clock::now();
+    object * ex = catch_kernel_exceptions<object_ref>([&]() {
+            kernel_decl_scope scope(d.to_theorem_val().get_name());
+            type_checker checker(e);
+            check_theorem_value(e, d, checker);
+            return object_ref(box(0));
+        });
+    second_duration elapsed = std::chrono::steady_clock::now() - start;
+    object * time_ex = alloc_cnstr(0, 2, 0);
+    cnstr_set(time_ex, 0, box_float(elapsed.count()));
+    cnstr_set(time_ex, 1, ex);
+    object * r = alloc_cnstr(0, 2, 0);
+    cnstr_set(r, 0, d.to_theorem_val().get_name().to_obj_arg());
+    cnstr_set(r, 1, time_ex);
+    return r;
+}
+
+static void add_pending_check(environment const & env, declaration const & d) {
+    object * c = alloc_closure(reinterpret_cast<void *>(check_theorem_value_fn), 3, 2);
+    closure_set(c, 0, env.to_obj_arg());
+    closure_set(c, 1, d.to_obj_arg());
+    object * t = task_spawn(c);
+    lock_guard<mutex> _(*g_pending_checks_mutex);
+    g_pending_checks->push_back(t);
+}
+
 environment environment::add_theorem(declaration const & d, bool check) const {
     theorem_val const & v = d.to_theorem_val();
     if (check) {
-        // TODO(Leo): we must add support for handling tasks here
         type_checker checker(*this);
         check_constant_val(*this, v.to_constant_val(), checker);
-        check_no_metavar_no_fvar(*this, v.get_name(), v.get_value());
-        expr val_type = checker.check(v.get_value(), v.get_lparams());
-        if (!checker.is_def_eq(val_type, v.get_type()))
-            throw definition_type_mismatch_exception(*this, d, val_type);
+        if (g_async_proofs.load(std::memory_order_relaxed))
+            add_pending_check(*this, d);
+        else
+            check_theorem_value(*this, d, checker);
     }
     return add(constant_info(d));
 }
 
+/* setAsyncProofs (b : Bool) : IO Unit */
+extern "C" LEAN_EXPORT obj_res lean_kernel_set_async_proofs(uint8 b, obj_arg) {
+    g_async_proofs.store(b, std::memory_order_relaxed);
+    return lean_io_result_mk_ok(box(0));
+}
+
+/* waitPendingChecks : IO (Array (Name × Float × Except KernelException Unit))
+
+   Wait for all theorem values being checked asynchronously, and return the results in the order
+   the theorems were added. */
+extern "C" LEAN_EXPORT obj_res lean_kernel_wait_pending_checks(obj_arg) {
+    std::vector<object *> tasks;
+    {
+        lock_guard<mutex> _(*g_pending_checks_mutex);
+        tasks.swap(*g_pending_checks);
+    }
+    object * rs = alloc_array(0, tasks.size());
+    for (object * t : tasks) {
+        object * r = task_get(t);
+        inc(r);
+        rs = array_push(rs, r);
+        dec(t);
+    }
+    return lean_io_result_mk_ok(rs);
+}
+
 environment environment::add_opaque(declaration const & d, bool check) const {
     opaque_val const & v = d.to_opaque_val();
     if (check) {
@@ -233,7 +314,26 @@ environment environment::add_mutual(declaration const & d, bool check) const {
     return new_env;
 }
 
+/* Name of the declaration `d` in the kernel profile. */
+static name get_profile_name(declaration const & d) {
+    switch (d.kind()) {
+    case declaration_kind::Axiom:            return d.to_axiom_val().get_name();
+    case declaration_kind::Definition:       return d.to_definition_val().get_name();
+    case declaration_kind::Theorem:          return d.to_theorem_val().get_name();
+    case declaration_kind::Opaque:           return d.to_opaque_val().get_name();
+    case declaration_kind::MutualDefinition:
+        return is_nil(d.to_definition_vals()) ? name() : head(d.to_definition_vals()).get_name();
+    case declaration_kind::Quot:             return name("Quot");
+    case declaration_kind::Inductive: {
+        inductive_types const & types = inductive_decl(d).get_types();
+        return is_nil(types) ? name() : head(types).get_name();
+    }
+    }
+    lean_unreachable();
+}
+
 environment environment::add(declaration const & d, bool check) const {
+    kernel_decl_scope scope(get_profile_name(d));
     switch (d.kind()) {
     case declaration_kind::Axiom:            return add_axiom(d, check);
     case declaration_kind::Definition:       return add_definition(d, check);
@@ -266,8 +366,14 @@ void environment::display_stats() const {
 }
 
 void initialize_environment() {
+    g_pending_checks_mutex = new mutex();
+    g_pending_checks = new std::vector<object *>();
 }
 
 void finalize_environment() {
+    for (object * t : *g_pending_checks)
+        dec(t);
+    delete g_pending_checks;
+    delete g_pending_checks_mutex;
 }
 }
@@ -71,6 +71,13 @@ public:
     /** \brief Return information for the constant with name \c n. Throws and exception if constant declaration does not exist in this environment. */
     constant_info get(name const & n) const;
 
+    /** \brief Return true iff \c n is the name of a constant declared in an imported module. */
+    bool is_imported(name const & n) const;
+
+    /** \brief Return the (immutable) mapping from imported constants to module indices. It is shared by all
+        environments created from the same `import_modules` call, and can be used to identify them. */
+    object * get_imports_key() const { return cnstr_get(raw(), 0); }
+
     /** \brief Extends the current environment with the given declaration */
     environment add(declaration const & d, bool check = true) const;
 
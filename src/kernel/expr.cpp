@@ -10,9 +10,12 @@ Author: Leonardo de Moura
 #include <string>
 #include <algorithm>
 #include <limits>
+#include <atomic>
+#include <iomanip>
 #include "runtime/hash.h"
 #include "runtime/buffer.h"
 #include "util/list_fn.h"
+#include "util/flat_hash_map.h"
 #include "kernel/expr.h"
 #include "kernel/expr_eq_fn.h"
 #include "kernel/expr_sets.h"
@@ -137,22 +140,123 @@ expr mk_mvar(name const & n) { return expr(lean_expr_mk_mvar(n.to_obj_arg())); }
 extern "C" object * lean_expr_mk_const(obj_arg n, obj_arg ls);
 expr mk_const(name const & n, levels const & ls) { return expr(lean_expr_mk_const(n.to_obj_arg(), ls.to_obj_arg())); }
 
+#ifndef LEAN_EXPR_HCONS_CAPACITY
+#define LEAN_EXPR_HCONS_CAPACITY 1024*1024
+#endif
+
+/* Hash-consing table for `scoped_expr_hcons`. The key contains the kind and the children of the new cell.
+   The children are compared by pointer, they are kept alive by the cell stored as the value. */
+class expr_hcons_table {
+    struct key {
+        object *  m_fn_or_domain;
+        object *  m_arg_or_body;
+        object *  m_binder_name;
+        expr_kind m_kind;
+        uint8     m_bi;
+    };
+    struct key_hash {
+        unsigned operator()(key const & k) const {
+            unsigned h = hash(static_cast<unsigned>(reinterpret_cast<size_t>(k.m_fn_or_domain) >> 3),
+                              static_cast<unsigned>(reinterpret_cast<size_t>(k.m_arg_or_body) >> 3));
+            if (k.m_kind != expr_kind::App)
+                h = hash(hash(h, static_cast<unsigned>(reinterpret_cast<size_t>(k.m_binder_name) >> 3)),
+                         static_cast<unsigned>(k.m_kind) * 8 + k.m_bi);
+            return h;
+        }
+    };
+    struct key_eq {
+        bool operator()(key const & k1, key const & k2) const {
+            return
+                k1.m_fn_or_domain == k2.m_fn_or_domain && k1.m_arg_or_body == k2.m_arg_or_body &&
+                k1.m_binder_name == k2.m_binder_name && k1.m_kind == k2.m_kind && k1.m_bi == k2.m_bi;
+        }
+    };
+    flat_hash_map<key, expr, key_hash, key_eq> m_table;
+
+    template<typename F> expr mk(key const & k, F && alloc) {
+        m_constructions++;
+        auto it = m_table.find(k);
+        if (it != m_table.end())
+            return it->second;
+        if (m_table.size() >= LEAN_EXPR_HCONS_CAPACITY)
+            m_table.clear();
+        m_allocations++;
+        expr r = alloc();
+        m_table.insert(mk_pair(k, r));
+        return r;
+    }
+public:
+    uint64 m_constructions = 0;
+    uint64 m_allocations   = 0;
+
+    expr mk_app(expr const & f, expr const & a);
+    expr mk_binding(expr_kind k, name const & n, expr const & t, expr const & e, binder_info bi);
+};
+
+LEAN_THREAD_PTR(expr_hcons_table, g_expr_hcons);
+static std::atomic<uint64> g_expr_hcons_constructions(0);
+static std::atomic<uint64> g_expr_hcons_allocations(0);
+
+scoped_expr_hcons::scoped_expr_hcons(bool enabled):m_table(nullptr) {
+    if (enabled && !g_expr_hcons) {
+        m_table     = new expr_hcons_table();
+        g_expr_hcons = m_table;
+    }
+}
+
+scoped_expr_hcons::~scoped_expr_hcons() {
+    if (!m_table)
+        return;
+    g_expr_hcons_constructions += m_table->m_constructions;
+    g_expr_hcons_allocations   += m_table->m_allocations;
+    g_expr_hcons = nullptr;
+    delete m_table;
+}
+
+void display_expr_hcons_stats(std::ostream & out) {
+    out << std::left << std::setw(39) << "kernel hash-consing:" << g_expr_hcons_constructions.load()
+        << " constructions, " << g_expr_hcons_allocations.load() << " allocations\n";
+}
+
 extern "C" object * lean_expr_mk_app(obj_arg f, obj_arg a);
-expr mk_app(expr const & f, expr const & a) { return expr(lean_expr_mk_app(f.to_obj_arg(), a.to_obj_arg())); }
+expr mk_app(expr const & f, expr const & a) {
+    if (g_expr_hcons)
+        return g_expr_hcons->mk_app(f, a);
+    return expr(lean_expr_mk_app(f.to_obj_arg(), a.to_obj_arg()));
+}
 
 extern "C" object * lean_expr_mk_sort(obj_arg l);
 expr mk_sort(level const & l) { return expr(lean_expr_mk_sort(l.to_obj_arg())); }
 
 extern "C" object * lean_expr_mk_lambda(obj_arg n, obj_arg t, obj_arg e, uint8 bi);
 expr mk_lambda(name const & n, expr const & t, expr const & e, binder_info bi) {
+    if (g_expr_hcons)
+        return g_expr_hcons->mk_binding(expr_kind::Lambda, n, t, e, bi);
     return expr(lean_expr_mk_lambda(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi)));
 }
 
 extern "C" object * lean_expr_mk_forall(obj_arg n, obj_arg t, obj_arg e, uint8 bi);
 expr mk_pi(name const & n, expr const & t, expr const & e, binder_info bi) {
+    if (g_expr_hcons)
+        return g_expr_hcons->mk_binding(expr_kind::Pi, n, t, e, bi);
     return expr(lean_expr_mk_forall(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi)));
 }
 
+expr expr_hcons_table::mk_app(expr const & f, expr const & a) {
+    key k{f.raw(), a.raw(), nullptr, expr_kind::App, 0};
+    return mk(k, [&]() { return expr(lean_expr_mk_app(f.to_obj_arg(), a.to_obj_arg())); });
+}
+
+expr expr_hcons_table::mk_binding(expr_kind kind, name const & n, expr const & t, expr const & e, binder_info bi) {
+    key k{t.raw(), e.raw(), n.raw(), kind, static_cast<uint8>(bi)};
+    return mk(k, [&]() {
+            if (kind == expr_kind::Pi)
+                return expr(lean_expr_mk_forall(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi)));
+            else
+                return expr(lean_expr_mk_lambda(n.to_obj_arg(), t.to_obj_arg(), e.to_obj_arg(), static_cast<uint8>(bi)));
+        });
+}
+
 static name * g_default_name = nullptr;
 expr mk_arrow(expr const & t, expr const & e) {
     return mk_pi(*g_default_name, t, e, mk_binder_info());
@@ -314,6 +314,26 @@ expr infer_implicit(expr const & t, bool strict);
 std::ostream & operator<<(std::ostream & out, expr const & e);
 // =======================================
 
+// =======================================
+// Hash-consing
+class expr_hcons_table;
+/** \brief If `enabled` is true, then while an object of this class is alive, `mk_app`, `mk_lambda` and `mk_pi`
+    on the current thread return the same object when invoked twice with pointer-equal arguments (children, and,
+    for binders, binder name and the same binder info) instead of allocating a new cell. Other terms (variables,
+    constants, sorts, literals, ...) and names are not hash-consed, so structurally equal terms built in the scope
+    are only pointer equal if their leaves and binder names are shared already. The table may also be cleared when
+    it becomes too large. Nested scopes share the table of the outermost one. */
+class scoped_expr_hcons {
+    expr_hcons_table * m_table;
+public:
+    scoped_expr_hcons(bool enabled = true);
+    ~scoped_expr_hcons();
+};
+/** \brief Display the number of `mk_app`/`mk_lambda`/`mk_pi` calls performed in hash-consing scopes, and the
+    number of cells that were actually allocated by them. */
+void display_expr_hcons_stats(std::ostream & out);
+// =======================================
+
 void initialize_expr();
 void finalize_expr();
 
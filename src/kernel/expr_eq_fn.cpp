@@ -6,6 +6,9 @@ Author: Leonardo de Moura
 */
 #include <vector>
 #include <memory>
+#include <iostream>
+#include <iomanip>
+#include <utility>
 #include "runtime/interrupt.h"
 #include "runtime/thread.h"
 #include "kernel/expr.h"
@@ -15,7 +18,15 @@ Author: Leonardo de Moura
 #define LEAN_EQ_CACHE_CAPACITY 1024*8
 #endif
 
+#ifndef LEAN_EQ_MEMO_CAPACITY
+#define LEAN_EQ_MEMO_CAPACITY 1024*4
+#endif
+
 namespace lean {
+static atomic<uint64> g_num_eq_memo_lookups(0);
+static atomic<uint64> g_num_eq_memo_hits(0);
+static atomic<uint64> g_num_eq_memo_inserts(0);
+
 struct eq_cache {
     struct entry {
         object * m_a;
@@ -52,6 +63,150 @@ struct eq_cache {
 /* CACHE_RESET: No */
 MK_THREAD_LOCAL_GET_DEF(eq_cache, get_eq_cache);
 
+/** \brief Pairs of expressions that have been proved equal, kept across `expr_eq_fn` invocations while a
+    `scoped_expr_eq_memo` object is alive on the current thread.
+
+    Unlike `eq_cache`, which records the pairs being compared and must be cleared when the comparison is over,
+    an entry here is a fact, and stays valid as long as the pointers denote the same objects. So, each entry
+    holds a reference to both objects. Exclusive objects are not stored, but the references keep the stored
+    objects shared until the memo is released, so they cannot be updated destructively in the meantime.
+    This is why the memo is only enabled while the kernel type checker is running, and released afterwards.
+
+    The entries are organized in two direct-mapped generations, allocated on the first insertion. New entries
+    are added to the young generation. When it has `LEAN_EQ_MEMO_CAPACITY/2` entries, the old generation is
+    released and the young one takes its place. An entry found in the old generation is promoted to the young one. */
+struct eq_memo {
+    struct entry {
+        object * m_a  = nullptr;
+        object * m_b  = nullptr;
+        /* True if the binder information was also compared. */
+        bool     m_bi = false;
+    };
+    std::vector<entry> m_young;
+    std::vector<entry> m_old;
+    unsigned           m_num_young = 0;
+    unsigned           m_num_old   = 0;
+    /* Number of live `scoped_expr_eq_memo` objects in this thread. */
+    unsigned           m_scopes    = 0;
+    uint64             m_lookups   = 0;
+    uint64             m_hits      = 0;
+    uint64             m_inserts   = 0;
+
+    ~eq_memo() { clear(); }
+
+    static void release(std::vector<entry> & es) {
+        for (entry & e : es) {
+            if (e.m_a) {
+                lean_dec(e.m_a);
+                lean_dec(e.m_b);
+                e.m_a = e.m_b = nullptr;
+            }
+        }
+    }
+
+    void clear() {
+        if (m_num_young > 0) release(m_young);
+        if (m_num_old > 0) release(m_old);
+        m_num_young = m_num_old = 0;
+        g_num_eq_memo_lookups += m_lookups;
+        g_num_eq_memo_hits    += m_hits;
+        g_num_eq_memo_inserts += m_inserts;
+        m_lookups = m_hits = m_inserts = 0;
+    }
+
+    static bool can_store(expr const & a, expr const & b) {
+        switch (a.kind()) {
+        case expr_kind::App: case expr_kind::Lambda: case expr_kind::Pi:
+        case expr_kind::Let: case expr_kind::MData: case expr_kind::Proj:
+            return !lean_is_exclusive(a.raw()) && !lean_is_exclusive(b.raw());
+        default:
+            return false;
+        }
+    }
+
+    static unsigned index(object * a, object * b) {
+        return hash(static_cast<unsigned>(reinterpret_cast<size_t>(a) >> 3),
+                    static_cast<unsigned>(reinterpret_cast<size_t>(b) >> 3)) % LEAN_EQ_MEMO_CAPACITY;
+    }
+
+    void insert(object * a, object * b, bool bi) {
+        if (m_young.empty()) {
+            m_young.resize(LEAN_EQ_MEMO_CAPACITY);
+            m_old.resize(LEAN_EQ_MEMO_CAPACITY);
+        }
+        if (a > b) std::swap(a, b);
+        unsigned i = index(a, b);
+        entry & e = m_young[i];
+        if (e.m_a == a && e.m_b == b) {
+            e.m_bi = e.m_bi || bi;
+            return;
+        }
+        m_inserts++;
+        lean_inc(a); lean_inc(b);
+        if (e.m_a) {
+            lean_dec(e.m_a);
+            lean_dec(e.m_b);
+        } else {
+            m_num_young++;
+        }
+        e.m_a = a; e.m_b = b; e.m_bi = bi;
+        if (m_num_young >= LEAN_EQ_MEMO_CAPACITY / 2) {
+            if (m_num_old > 0) release(m_old);
+            std::swap(m_old, m_young);
+            m_num_old   = m_num_young;
+            m_num_young = 0;
+        }
+    }
+
+    /** \brief Return true if `a` and `b` are known to be equal. If `bi` is true, then the binder information
+        must have been compared too. */
+    bool contains(object * a, object * b, bool bi) {
+        m_lookups++;
+        if (m_young.empty())
+            return false;
+        if (a > b) std::swap(a, b);
+        unsigned i = index(a, b);
+        entry const & y = m_young[i];
+        if (y.m_a == a && y.m_b == b && (y.m_bi || !bi)) {
+            m_hits++;
+            return true;
+        }
+        entry const & o = m_old[i];
+        if (o.m_a == a && o.m_b == b && (o.m_bi || !bi)) {
+            m_hits++;
+            bool o_bi = o.m_bi;
+            insert(a, b, o_bi);
+            return true;
+        }
+        return false;
+    }
+};
+
+/* CACHE_RESET: No */
+MK_THREAD_LOCAL_GET_DEF(eq_memo, get_eq_memo);
+
+scoped_expr_eq_memo::scoped_expr_eq_memo():m_active(true) {
+    get_eq_memo().m_scopes++;
+}
+
+scoped_expr_eq_memo::scoped_expr_eq_memo(scoped_expr_eq_memo && s):m_active(s.m_active) {
+    s.m_active = false;
+}
+
+scoped_expr_eq_memo::~scoped_expr_eq_memo() {
+    if (!m_active)
+        return;
+    eq_memo & memo = get_eq_memo();
+    lean_assert(memo.m_scopes > 0);
+    if (--memo.m_scopes == 0)
+        memo.clear();
+}
+
+void display_expr_eq_memo_stats(std::ostream & out) {
+    out << std::left << std::setw(39) << "kernel expr equality memo:" << g_num_eq_memo_hits.load() << " hits, "
+        << g_num_eq_memo_lookups.load() << " lookups, " << g_num_eq_memo_inserts.load() << " inserts\n";
+}
+
 /** \brief Functional object for comparing expressions.
 
     Remark if CompareBinderInfo is true, then functional object will also compare
@@ -59,6 +214,8 @@ MK_THREAD_LOCAL_GET_DEF(eq_cache, get_eq_cache);
 template<bool CompareBinderInfo>
 class expr_eq_fn {
     eq_cache & m_cache;
+    /* `nullptr` if no `scoped_expr_eq_memo` is alive in this thread. */
+    eq_memo *  m_memo;
 
     static void check_system() {
         ::lean::check_system("expression equality test");
@@ -69,8 +226,19 @@ class expr_eq_fn {
         if (hash(a) != hash(b))    return false;
         if (a.kind() != b.kind())  return false;
         if (is_bvar(a))            return bvar_idx(a) == bvar_idx(b);
+        bool memo = m_memo && eq_memo::can_store(a, b);
+        if (memo && m_memo->contains(a.raw(), b.raw(), CompareBinderInfo))
+            return true;
         if (m_cache.check(a, b))
             return true;
+        if (!apply_core(a, b))
+            return false;
+        if (memo)
+            m_memo->insert(a.raw(), b.raw(), CompareBinderInfo);
+        return true;
+    }
+
+    bool apply_core(expr const & a, expr const & b) {
         /*
            We increase the number of heartbeats here because some code (e.g., `simp`) may spend a lot of time comparing
            `Expr`s (e.g., checking a cache with many collisions) without allocating any significant amount of memory.
@@ -123,7 +291,10 @@ class expr_eq_fn {
         lean_unreachable(); // LCOV_EXCL_LINE
     }
 public:
-    expr_eq_fn():m_cache(get_eq_cache()) {}
+    expr_eq_fn():m_cache(get_eq_cache()), m_memo(&get_eq_memo()) {
+        if (m_memo->m_scopes == 0)
+            m_memo = nullptr;
+    }
     ~expr_eq_fn() { m_cache.clear(); }
     bool operator()(expr const & a, expr const & b) { return apply(a, b); }
 };
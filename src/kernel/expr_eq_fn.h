@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include <iosfwd>
 
 namespace lean {
 class expr;
@@ -26,4 +27,20 @@ struct is_cond_bi_equal_proc {
     is_cond_bi_equal_proc(bool b):m_use_bi(b) {}
     bool operator()(expr const & e1, expr const & e2) const { return m_use_bi ? is_bi_equal(e1, e2) : e1 == e2; }
 };
+
+/** \brief While an object of this class is alive, `is_equal` and `is_bi_equal` remember the pairs of (shared)
+    compound terms proved equal in the current thread, and reuse them in later comparisons. The memo keeps a
+    reference to the terms, and it is released when the last object of this class in the thread is destroyed.
+    It is used by the kernel type checker. */
+class scoped_expr_eq_memo {
+    bool m_active;
+public:
+    scoped_expr_eq_memo();
+    scoped_expr_eq_memo(scoped_expr_eq_memo && s);
+    scoped_expr_eq_memo(scoped_expr_eq_memo const &) = delete;
+    ~scoped_expr_eq_memo();
+};
+
+/** \brief Display the lookups and hits of the memo enabled by `scoped_expr_eq_memo`. */
+void display_expr_eq_memo_stats(std::ostream & out);
 }
@@ -7,12 +7,17 @@ Author: Leonardo de Moura
 #pragma once
 #include <unordered_map>
 #include <functional>
+#include "util/flat_hash_map.h"
 #include "kernel/expr.h"
 
 namespace lean {
 // Maps based on structural equality. That is, two keys are equal iff they are structurally equal
 template<typename T>
 using expr_map = typename std::unordered_map<expr, T, expr_hash, std::equal_to<expr>>;
+// Same as `expr_map`, but entries are stored inline in an open addressing table, see `flat_hash_map`.
+// Entries cannot be erased. It is used for the caches of the kernel type checker.
+template<typename T>
+using expr_flat_map = flat_hash_map<expr, T, expr_hash, std::equal_to<expr>>;
 // The following map also takes into account binder information
 template<typename T>
 using expr_bi_map = typename std::unordered_map<expr, T, expr_hash, is_bi_equal_proc>;
@@ -9,8 +9,12 @@ Author: Leonardo de Moura
 #include <utility>
 #include <functional>
 #include "runtime/hash.h"
+#include "util/flat_hash_map.h"
 #include "kernel/expr.h"
 
 namespace lean {
 typedef std::unordered_set<expr, expr_hash, std::equal_to<expr>> expr_set;
+// Open addressing versions of `expr_set`, see `flat_hash_map`.
+typedef flat_hash_set<expr, expr_hash, std::equal_to<expr>> expr_flat_set;
+typedef flat_hash_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_flat_set;
 }
@@ -4,8 +4,14 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <algorithm>
 #include "runtime/sstream.h"
 #include "runtime/utf8.h"
+#include "runtime/thread.h"
 #include "util/name_generator.h"
 #include "kernel/environment.h"
 #include "kernel/type_checker.h"
@@ -18,6 +24,16 @@ Author: Leonardo de Moura
 namespace lean {
 static name * g_ind_fresh = nullptr;
 
+/* Maximal number of threads used for checking the constructors and building the recursors of an inductive
+   declaration, and minimal number of work items (constructors or inductive types) per thread. Spawning threads
+   for small declarations costs more than it saves. */
+static unsigned g_inductive_num_threads = 1;
+static constexpr unsigned g_inductive_items_per_thread = 16;
+
+void set_inductive_num_threads(unsigned n) {
+    g_inductive_num_threads = std::max(n, 1u);
+}
+
 /**\ brief Return recursor name for the given inductive datatype name */
 name mk_rec_name(name const & I) {
     return I + name("rec");
@@ -194,6 +210,74 @@ public:
     expr mk_lambda(buffer<expr> const & fvars, expr const & e) const { return m_lctx.mk_lambda(fvars, e); }
     expr mk_lambda(expr const & fvar, expr const & e) const { return m_lctx.mk_lambda(1, &fvar, e); }
 
+    /** \brief Mark the objects referenced by this object as multi-threaded, they are shared by the workers
+        created by `parallel_for`. */
+    void mark_shared_mt() {
+        auto mt = [](object_ref const & o) { mark_mt(o.raw()); };
+        mt(m_env); mt(m_lctx); mt(m_lparams); mt(m_result_level); mt(m_levels); mt(m_elim_level);
+        for (inductive_type const & ind_type : m_ind_types) mt(ind_type);
+        for (expr const & param : m_params) mt(param);
+        for (expr const & c : m_ind_cnsts) mt(c);
+        for (rec_info const & info : m_rec_infos) {
+            mt(info.m_C); mt(info.m_major);
+            for (expr const & m : info.m_minors) mt(m);
+            for (expr const & idx : info.m_indices) mt(idx);
+        }
+    }
+
+    /** \brief Invoke `fn(w, i)` for each `i < n`, where `w` is a copy of this object with its own name generator.
+        `fn` may extend the local context of `w`, but it must not modify other fields.
+
+        If `n` is big enough, the calls are distributed over several threads, which inherit the kernel state of the
+        current thread (see `kernel_worker_scope`). Exceptions are propagated after all calls are finished, and the
+        exception thrown for the smallest `i` is rethrown, as in a sequential execution. */
+    template<typename F> void parallel_for(unsigned n, F const & fn) {
+        unsigned num_threads = std::min(g_inductive_num_threads, n / g_inductive_items_per_thread);
+        if (num_threads <= 1) {
+            for (unsigned i = 0; i < n; i++)
+                fn(*this, i);
+            return;
+        }
+        mark_shared_mt();
+        std::vector<std::unique_ptr<add_inductive_fn>> workers;
+        for (unsigned t = 0; t < num_threads; t++) {
+            workers.emplace_back(new add_inductive_fn(*this));
+            workers.back()->m_ngen = m_ngen.mk_child();
+        }
+        kernel_thread_context ctx;
+        std::atomic<unsigned> next(0);
+        std::vector<std::exception_ptr> exs(n);
+        auto run = [&](add_inductive_fn & w) {
+            while (true) {
+                unsigned i = next.fetch_add(1);
+                if (i >= n)
+                    return;
+                try {
+                    fn(w, i);
+                } catch (...) {
+                    exs[i] = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::unique_ptr<lthread>> threads;
+        try {
+            for (unsigned t = 1; t < num_threads; t++)
+                threads.emplace_back(new lthread([&, t]() {
+                            kernel_worker_scope scope(ctx);
+                            run(*workers[t]);
+                        }));
+        } catch (exception &) {
+            // failed to create a thread, the remaining items are processed by the threads we have
+        }
+        run(*workers[0]);
+        for (std::unique_ptr<lthread> & t : threads)
+            t->join();
+        for (std::exception_ptr const & ex : exs) {
+            if (ex)
+                std::rethrow_exception(ex);
+        }
+    }
+
     /**
        \brief Check whether the type of each datatype is well typed, and do not contain free variables or meta variables,
        all inductive datatypes have the same parameters, the number of parameters match the argument m_nparams,
@@ -406,9 +490,45 @@ public:
         }
     }
 
-    /** \brief Check whether the constructor declarations are type correct, parameters are in the expected positions,
-        constructor fields are in acceptable universe levels, positivity constraints, and returns the expected result. */
+    /** \brief Check whether the constructor `cnstr` of the inductive datatype at position `idx` is type correct,
+        parameters are in the expected positions, constructor fields are in acceptable universe levels,
+        positivity constraints, and returns the expected result. */
+    void check_constructor(unsigned idx, constructor const & cnstr) {
+        name const & n = constructor_name(cnstr);
+        expr t = constructor_type(cnstr);
+        m_env.check_name(n);
+        check_no_metavar_no_fvar(m_env, n, t);
+        tc().check(t, m_lparams);
+        unsigned i = 0;
+        while (is_pi(t)) {
+            if (i < m_nparams) {
+                if (!is_def_eq(binding_domain(t), get_param_type(i)))
+                    throw kernel_exception(m_env, sstream() << "arg #" << (i + 1) << " of '" << n << "' "
+                                           << "does not match inductive datatypes parameters'");
+                t = instantiate(binding_body(t), m_params[i]);
+            } else {
+                expr s = tc().ensure_type(binding_domain(t));
+                // the sort is ok IF
+                //   1- its level is <= inductive datatype level, OR
+                //   2- is an inductive predicate
+                if (!(is_geq(m_result_level, sort_level(s)) || is_zero(m_result_level))) {
+                    throw kernel_exception(m_env, sstream() << "universe level of type_of(arg #" << (i + 1) << ") "
+                                           << "of '" << n << "' is too big for the corresponding inductive datatype");
+                }
+                if (!m_is_unsafe)
+                    check_positivity(binding_domain(t), n, i);
+                expr local = mk_local_decl_for(t);
+                t = instantiate(binding_body(t), local);
+            }
+            i++;
+        }
+        if (!is_valid_ind_app(t, idx))
+            throw kernel_exception(m_env, sstream() << "invalid return type for '" << n << "'");
+    }
+
+    /** \brief Check the constructor declarations, see `check_constructor`. The constructors are checked in parallel. */
     void check_constructors() {
+        buffer<pair<unsigned, constructor>> cnstrs;
         for (unsigned idx = 0; idx < m_ind_types.size(); idx++) {
             inductive_type const & ind_type = m_ind_types[idx];
             name_set found_cnstrs;
@@ -418,37 +538,12 @@ public:
                     throw kernel_exception(m_env, sstream() << "duplicate constructor name '" << n << "'");
                 }
                 found_cnstrs.insert(n);
-                expr t = constructor_type(cnstr);
-                m_env.check_name(n);
-                check_no_metavar_no_fvar(m_env, n, t);
-                tc().check(t, m_lparams);
-                unsigned i = 0;
-                while (is_pi(t)) {
-                    if (i < m_nparams) {
-                        if (!is_def_eq(binding_domain(t), get_param_type(i)))
-                            throw kernel_exception(m_env, sstream() << "arg #" << (i + 1) << " of '" << n << "' "
-                                                   << "does not match inductive datatypes parameters'");
-                        t = instantiate(binding_body(t), m_params[i]);
-                    } else {
-                        expr s = tc().ensure_type(binding_domain(t));
-                        // the sort is ok IF
-                        //   1- its level is <= inductive datatype level, OR
-                        //   2- is an inductive predicate
-                        if (!(is_geq(m_result_level, sort_level(s)) || is_zero(m_result_level))) {
-                            throw kernel_exception(m_env, sstream() << "universe level of type_of(arg #" << (i + 1) << ") "
-                                                   << "of '" << n << "' is too big for the corresponding inductive datatype");
-                        }
-                        if (!m_is_unsafe)
-                            check_positivity(binding_domain(t), n, i);
-                        expr local = mk_local_decl_for(t);
-                        t = instantiate(binding_body(t), local);
-                    }
-                    i++;
-                }
-                if (!is_valid_ind_app(t, idx))
-                    throw kernel_exception(m_env, sstream() << "invalid return type for '" << n << "'");
+                cnstrs.push_back(mk_pair(idx, cnstr));
             }
         }
+        parallel_for(cnstrs.size(), [&](add_inductive_fn & w, unsigned i) {
+                w.check_constructor(cnstrs[i].first, cnstrs[i].second);
+            });
     }
 
     void declare_constructors() {
@@ -613,61 +708,72 @@ public:
             m_rec_infos.push_back(info);
             d_idx++;
         }
-        /* First, populate the field m_minors */
-        d_idx = 0;
-        for (inductive_type const & ind_type : m_ind_types) {
-            name ind_type_name = ind_type.get_name();
-            for (constructor const & cnstr : ind_type.get_cnstrs()) {
-                buffer<expr> b_u; // nonrec and rec args;
-                buffer<expr> u;   // rec args
-                buffer<expr> v;   // inductive args
-                name cnstr_name = constructor_name(cnstr);
-                expr t          = constructor_type(cnstr);
-                unsigned i      = 0;
-                while (is_pi(t)) {
-                    if (i < m_nparams) {
-                        t = instantiate(binding_body(t), m_params[i]);
-                    } else {
-                        expr l = mk_local_decl_for(t);
-                        b_u.push_back(l);
-                        if (is_rec_argument(binding_domain(t)))
-                            u.push_back(l);
-                        t = instantiate(binding_body(t), l);
-                    }
-                    i++;
-                }
-                buffer<expr> it_indices;
-                unsigned it_idx = get_I_indices(t, it_indices);
-                expr C_app      = mk_app(m_rec_infos[it_idx].m_C, it_indices);
-                expr intro_app  = mk_app(mk_app(mk_constant(cnstr_name, m_levels), m_params), b_u);
-                C_app = mk_app(C_app, intro_app);
-                /* populate v using u */
-                for (unsigned i = 0; i < u.size(); i++) {
-                    expr u_i    = u[i];
-                    expr u_i_ty = whnf(infer_type(u_i));
-                    buffer<expr> xs;
-                    while (is_pi(u_i_ty)) {
-                        expr x = mk_local_decl_for(u_i_ty);
-                        xs.push_back(x);
-                        u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
-                    }
-                    buffer<expr> it_indices;
-                    unsigned it_idx = get_I_indices(u_i_ty, it_indices);
-                    expr C_app  = mk_app(m_rec_infos[it_idx].m_C, it_indices);
-                    expr u_app  = mk_app(u_i, xs);
-                    C_app = mk_app(C_app, u_app);
-                    expr v_i_ty = mk_pi(xs, C_app);
-                    local_decl u_i_decl = m_lctx.get_local_decl(fvar_name(u_i));
-                    expr v_i    = mk_local_decl(u_i_decl.get_user_name().append_after("_ih"), v_i_ty, binder_info());
-                    v.push_back(v_i);
-                }
-                expr minor_ty   = mk_pi(b_u, mk_pi(v, C_app));
-                name minor_name = cnstr_name.replace_prefix(ind_type_name, name());
-                expr minor      = mk_local_decl(minor_name, minor_ty);
-                m_rec_infos[d_idx].m_minors.push_back(minor);
+        /* Then, populate the field m_minors. The types of the minor premises are computed in parallel. */
+        buffer<pair<unsigned, constructor>> cnstrs;
+        for (unsigned d_idx = 0; d_idx < m_ind_types.size(); d_idx++) {
+            for (constructor const & cnstr : m_ind_types[d_idx].get_cnstrs())
+                cnstrs.push_back(mk_pair(d_idx, cnstr));
+        }
+        buffer<expr> minor_tys;
+        minor_tys.resize(cnstrs.size(), expr());
+        parallel_for(cnstrs.size(), [&](add_inductive_fn & w, unsigned i) {
+                minor_tys[i] = w.mk_minor_premise_type(cnstrs[i].second);
+            });
+        for (unsigned i = 0; i < cnstrs.size(); i++) {
+            unsigned d_idx  = cnstrs[i].first;
+            name minor_name = constructor_name(cnstrs[i].second).replace_prefix(m_ind_types[d_idx].get_name(), name());
+            expr minor      = mk_local_decl(minor_name, minor_tys[i]);
+            m_rec_infos[d_idx].m_minors.push_back(minor);
+        }
+    }
+
+    /** \brief Return the type of the minor premise for the given constructor.
+        \pre The fields m_C, m_indices and m_major of m_rec_infos have been populated. */
+    expr mk_minor_premise_type(constructor const & cnstr) {
+        buffer<expr> b_u; // nonrec and rec args;
+        buffer<expr> u;   // rec args
+        buffer<expr> v;   // inductive args
+        name cnstr_name = constructor_name(cnstr);
+        expr t          = constructor_type(cnstr);
+        unsigned i      = 0;
+        while (is_pi(t)) {
+            if (i < m_nparams) {
+                t = instantiate(binding_body(t), m_params[i]);
+            } else {
+                expr l = mk_local_decl_for(t);
+                b_u.push_back(l);
+                if (is_rec_argument(binding_domain(t)))
+                    u.push_back(l);
+                t = instantiate(binding_body(t), l);
             }
-            d_idx++;
+            i++;
+        }
+        buffer<expr> it_indices;
+        unsigned it_idx = get_I_indices(t, it_indices);
+        expr C_app      = mk_app(m_rec_infos[it_idx].m_C, it_indices);
+        expr intro_app  = mk_app(mk_app(mk_constant(cnstr_name, m_levels), m_params), b_u);
+        C_app = mk_app(C_app, intro_app);
+        /* populate v using u */
+        for (unsigned i = 0; i < u.size(); i++) {
+            expr u_i    = u[i];
+            expr u_i_ty = whnf(infer_type(u_i));
+            buffer<expr> xs;
+            while (is_pi(u_i_ty)) {
+                expr x = mk_local_decl_for(u_i_ty);
+                xs.push_back(x);
+                u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
+            }
+            buffer<expr> it_indices;
+            unsigned it_idx = get_I_indices(u_i_ty, it_indices);
+            expr C_app  = mk_app(m_rec_infos[it_idx].m_C, it_indices);
+            expr u_app  = mk_app(u_i, xs);
+            C_app = mk_app(C_app, u_app);
+            expr v_i_ty = mk_pi(xs, C_app);
+            local_decl u_i_decl = m_lctx.get_local_decl(fvar_name(u_i));
+            expr v_i    = mk_local_decl(u_i_decl.get_user_name().append_after("_ih"), v_i_ty, binder_info());
+            v.push_back(v_i);
         }
+        return mk_pi(b_u, mk_pi(v, C_app));
     }
 
     /** \brief Return the levels for the recursor. */
@@ -699,75 +805,95 @@ public:
             ms.append(m_rec_infos[i].m_minors);
     }
 
-    recursor_rules mk_rec_rules(unsigned d_idx, buffer<expr> const & Cs, buffer<expr> const & minors, unsigned & minor_idx) {
-        inductive_type const & d = m_ind_types[d_idx];
+    /** \brief Return the recursor rule for the given constructor, `minor_idx` is the position of its minor premise. */
+    recursor_rule mk_rec_rule(constructor const & cnstr, buffer<expr> const & Cs, buffer<expr> const & minors, unsigned minor_idx) {
         levels lvls = get_rec_levels();
-        buffer<recursor_rule> rules;
-        for (constructor const & cnstr : d.get_cnstrs()) {
-            buffer<expr> b_u;
-            buffer<expr> u;
-            expr t = constructor_type(cnstr);
-            unsigned i = 0;
-            while (is_pi(t)) {
-                if (i < m_nparams) {
-                    t = instantiate(binding_body(t), m_params[i]);
-                } else {
-                    expr l = mk_local_decl_for(t);
-                    b_u.push_back(l);
-                    if (is_rec_argument(binding_domain(t)))
-                        u.push_back(l);
-                    t = instantiate(binding_body(t), l);
-                }
-                i++;
+        buffer<expr> b_u;
+        buffer<expr> u;
+        expr t = constructor_type(cnstr);
+        unsigned i = 0;
+        while (is_pi(t)) {
+            if (i < m_nparams) {
+                t = instantiate(binding_body(t), m_params[i]);
+            } else {
+                expr l = mk_local_decl_for(t);
+                b_u.push_back(l);
+                if (is_rec_argument(binding_domain(t)))
+                    u.push_back(l);
+                t = instantiate(binding_body(t), l);
             }
-            buffer<expr> v;
-            for (unsigned i = 0; i < u.size(); i++) {
-                expr u_i    = u[i];
-                expr u_i_ty = whnf(infer_type(u_i));
-                buffer<expr> xs;
-                while (is_pi(u_i_ty)) {
-                    expr x = mk_local_decl_for(u_i_ty);
-                    xs.push_back(x);
-                    u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
-                }
-                buffer<expr> it_indices;
-                unsigned it_idx = get_I_indices(u_i_ty, it_indices);
-                name rec_name   = mk_rec_name(m_ind_types[it_idx].get_name());
-                expr rec_app    = mk_constant(rec_name, lvls);
-                rec_app         = mk_app(mk_app(mk_app(mk_app(mk_app(rec_app, m_params), Cs), minors), it_indices), mk_app(u_i, xs));
-                v.push_back(mk_lambda(xs, rec_app));
+            i++;
+        }
+        buffer<expr> v;
+        for (unsigned i = 0; i < u.size(); i++) {
+            expr u_i    = u[i];
+            expr u_i_ty = whnf(infer_type(u_i));
+            buffer<expr> xs;
+            while (is_pi(u_i_ty)) {
+                expr x = mk_local_decl_for(u_i_ty);
+                xs.push_back(x);
+                u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
             }
-            expr e_app    = mk_app(mk_app(minors[minor_idx], b_u), v);
-            expr comp_rhs = mk_lambda(m_params, mk_lambda(Cs, mk_lambda(minors, mk_lambda(b_u, e_app))));
-            rules.push_back(recursor_rule(constructor_name(cnstr), b_u.size(), comp_rhs));
-            minor_idx++;
+            buffer<expr> it_indices;
+            unsigned it_idx = get_I_indices(u_i_ty, it_indices);
+            name rec_name   = mk_rec_name(m_ind_types[it_idx].get_name());
+            expr rec_app    = mk_constant(rec_name, lvls);
+            rec_app         = mk_app(mk_app(mk_app(mk_app(mk_app(rec_app, m_params), Cs), minors), it_indices), mk_app(u_i, xs));
+            v.push_back(mk_lambda(xs, rec_app));
         }
-        return recursor_rules(rules);
+        expr e_app    = mk_app(mk_app(minors[minor_idx], b_u), v);
+        expr comp_rhs = mk_lambda(m_params, mk_lambda(Cs, mk_lambda(minors, mk_lambda(b_u, e_app))));
+        return recursor_rule(constructor_name(cnstr), b_u.size(), comp_rhs);
     }
 
-    /** \brief Declare recursors. */
+    /** \brief Return the type of the recursor for the inductive datatype at position `d_idx`. */
+    expr mk_rec_type(unsigned d_idx, buffer<expr> const & Cs, buffer<expr> const & minors) {
+        rec_info const & info = m_rec_infos[d_idx];
+        expr C_app            = mk_app(mk_app(info.m_C, info.m_indices), info.m_major);
+        expr rec_ty           = mk_pi(info.m_major, C_app);
+        rec_ty                = mk_pi(info.m_indices, rec_ty);
+        rec_ty                = mk_pi(minors, rec_ty);
+        rec_ty                = mk_pi(Cs, rec_ty);
+        rec_ty                = mk_pi(m_params, rec_ty);
+        return infer_implicit(rec_ty, true /* strict */);
+    }
+
+    /** \brief Declare recursors. The recursor types and rules are built in parallel. */
     void declare_recursors() {
         buffer<expr> Cs; collect_Cs(Cs);
         buffer<expr> minors; collect_minor_premises(minors);
         unsigned nminors   = minors.size();
         unsigned nmotives  = Cs.size();
         names all          = get_all_inductive_names();
+        unsigned ntypes    = m_ind_types.size();
+        /* The constructors of all inductive datatypes, in the order of the minor premises. */
+        buffer<constructor> cnstrs;
+        for (inductive_type const & ind_type : m_ind_types)
+            to_buffer(ind_type.get_cnstrs(), cnstrs);
+        lean_assert(cnstrs.size() == nminors);
+        buffer<expr> rec_tys;
+        rec_tys.resize(ntypes, expr());
+        buffer<optional<recursor_rule>> rules;
+        rules.resize(nminors);
+        /* Work items `[0, ntypes)` build the recursor types, the remaining ones build the recursor rules. */
+        parallel_for(ntypes + nminors, [&](add_inductive_fn & w, unsigned i) {
+                if (i < ntypes)
+                    rec_tys[i] = w.mk_rec_type(i, Cs, minors);
+                else
+                    rules[i - ntypes] = w.mk_rec_rule(cnstrs[i - ntypes], Cs, minors, i - ntypes);
+            });
+        names rec_lparams  = get_rec_lparams();
         unsigned minor_idx = 0;
-        for (unsigned d_idx = 0; d_idx < m_ind_types.size(); d_idx++) {
-            rec_info const & info = m_rec_infos[d_idx];
-            expr C_app            = mk_app(mk_app(info.m_C, info.m_indices), info.m_major);
-            expr rec_ty           = mk_pi(info.m_major, C_app);
-            rec_ty                = mk_pi(info.m_indices, rec_ty);
-            rec_ty                = mk_pi(minors, rec_ty);
-            rec_ty                = mk_pi(Cs, rec_ty);
-            rec_ty                = mk_pi(m_params, rec_ty);
-            rec_ty                = infer_implicit(rec_ty, true /* strict */);
-            recursor_rules rules  = mk_rec_rules(d_idx, Cs, minors, minor_idx);
-            name rec_name         = mk_rec_name(m_ind_types[d_idx].get_name());
-            names rec_lparams     = get_rec_lparams();
-            m_env.add_core(constant_info(recursor_val(rec_name, rec_lparams, rec_ty, all,
+        for (unsigned d_idx = 0; d_idx < ntypes; d_idx++) {
+            buffer<recursor_rule> d_rules;
+            for (unsigned j = 0; j < length(m_ind_types[d_idx].get_cnstrs()); j++) {
+                d_rules.push_back(*rules[minor_idx]);
+                minor_idx++;
+            }
+            name rec_name = mk_rec_name(m_ind_types[d_idx].get_name());
+            m_env.add_core(constant_info(recursor_val(rec_name, rec_lparams, rec_tys[d_idx], all,
                                                       m_nparams, m_nindices[d_idx], nmotives, nminors,
-                                                      rules, m_K_target, m_is_unsafe)));
+                                                      recursor_rules(d_rules), m_K_target, m_is_unsafe)));
         }
     }
 
@@ -140,6 +140,10 @@ optional<expr> inductive_is_stuck(environment const & env, expr const & e, WHNF
     }
 }
 
+/** \brief Set the maximal number of threads used for checking the constructors and building the recursors of
+    large inductive declarations. The default is 1. */
+void set_inductive_num_threads(unsigned n);
+
 void initialize_inductive();
 void finalize_inductive();
 }
@@ -6,34 +6,228 @@ Author: Leonardo de Moura
 */
 #include <algorithm>
 #include <limits>
+#include <vector>
+#include <iostream>
+#include "runtime/thread.h"
+#include "util/flat_hash_map.h"
+#include "kernel/cache_stack.h"
 #include "kernel/replace_fn.h"
 #include "kernel/declaration.h"
 #include "kernel/kernel_exception.h"
 #include "kernel/instantiate.h"
 
+#ifdef LEAN_RUNTIME_STATS
+#define LEAN_RUNTIME_STAT_CODE(c) c
+#else
+#define LEAN_RUNTIME_STAT_CODE(c)
+#endif
+
+#ifndef LEAN_INSTANTIATE_CACHE_MAX_REUSED_CAPACITY
+#define LEAN_INSTANTIATE_CACHE_MAX_REUSED_CAPACITY 1024*16
+#endif
+
+#ifndef LEAN_INSTANTIATE_LPARAMS_CACHE_CAPACITY
+#define LEAN_INSTANTIATE_LPARAMS_CACHE_CAPACITY 1024*8
+#endif
+
 namespace lean {
+#ifdef LEAN_RUNTIME_STATS
+static atomic<uint64> g_num_instantiate(0);
+static atomic<uint64> g_num_instantiate_visited(0);
+static atomic<uint64> g_max_instantiate_visited(0);
+static atomic<uint64> g_num_instantiate_cache_hits(0);
+static atomic<uint64> g_num_instantiate_lparams(0);
+static atomic<uint64> g_num_instantiate_lparams_cache_hits(0);
+struct instantiate_stats {
+    ~instantiate_stats() {
+        std::cerr << "num. instantiate:              " << g_num_instantiate << "\n";
+        std::cerr << "num. instantiate visited:      " << g_num_instantiate_visited << "\n";
+        std::cerr << "max. instantiate visited:      " << g_max_instantiate_visited << "\n";
+        std::cerr << "num. instantiate cache hits:   " << g_num_instantiate_cache_hits << "\n";
+        std::cerr << "num. instantiate lparams:      " << g_num_instantiate_lparams << "\n";
+        std::cerr << "num. inst. lparams cache hits: " << g_num_instantiate_lparams_cache_hits << "\n";
+    }
+};
+static instantiate_stats g_instantiate_stats;
+#endif
+
+/* Results for shared subterms, keyed by their address and the number of binders above them.
+   The table grows instead of evicting entries. Like `replace_cache`, it keeps track of the used slots, so that
+   clearing it only costs as much as the previous call used it, and it is reused by the calls of a thread
+   (see `instantiate_cache_ref`). Tables that grew beyond `m_max_reused_capacity` are released when cleared. */
+class instantiate_cache {
+    struct entry {
+        object * m_cell = nullptr;
+        unsigned m_offset;
+        expr     m_result;
+    };
+    unsigned              m_max_reused_capacity;
+    std::vector<entry>    m_entries; /* empty or a power of two */
+    std::vector<unsigned> m_used;
+
+    static unsigned hash_key(object * cell, unsigned offset) {
+        return static_cast<unsigned>(hash(reinterpret_cast<uintptr_t>(cell) >> 3, offset));
+    }
+
+    entry & find_entry(object * cell, unsigned offset) {
+        unsigned mask = m_entries.size() - 1;
+        unsigned i    = hash_key(cell, offset) & mask;
+        while (m_entries[i].m_cell != nullptr && (m_entries[i].m_cell != cell || m_entries[i].m_offset != offset))
+            i = (i + 1) & mask;
+        return m_entries[i];
+    }
+
+    void grow() {
+        std::vector<entry> old_entries(m_entries.empty() ? 64 : 2 * m_entries.size());
+        old_entries.swap(m_entries);
+        std::vector<unsigned> old_used;
+        old_used.swap(m_used);
+        for (unsigned i : old_used) {
+            entry & e = old_entries[i];
+            insert_core(e.m_cell, e.m_offset, std::move(e.m_result));
+        }
+    }
+
+    void insert_core(object * cell, unsigned offset, expr && r) {
+        entry & e = find_entry(cell, offset);
+        lean_assert(e.m_cell == nullptr);
+        e.m_cell   = cell;
+        e.m_offset = offset;
+        e.m_result = std::move(r);
+        m_used.push_back(&e - m_entries.data());
+    }
+public:
+    explicit instantiate_cache(unsigned max_reused_capacity):m_max_reused_capacity(max_reused_capacity) {}
+
+    expr const * find(expr const & e, unsigned offset) {
+        if (m_used.empty())
+            return nullptr;
+        entry & r = find_entry(e.raw(), offset);
+        return r.m_cell ? &r.m_result : nullptr;
+    }
+
+    void insert(expr const & e, unsigned offset, expr const & r) {
+        /* Keep the load factor at most 1/2. */
+        if (2 * (m_used.size() + 1) > m_entries.size())
+            grow();
+        insert_core(e.raw(), offset, expr(r));
+    }
+
+    void clear() {
+        if (m_entries.size() > m_max_reused_capacity) {
+            std::vector<entry>().swap(m_entries);
+            std::vector<unsigned>().swap(m_used);
+            return;
+        }
+        for (unsigned i : m_used) {
+            m_entries[i].m_cell   = nullptr;
+            m_entries[i].m_result = expr();
+        }
+        m_used.clear();
+    }
+};
+
+/* CACHE_RESET: NO */
+MK_CACHE_STACK(instantiate_cache, LEAN_INSTANTIATE_CACHE_MAX_REUSED_CAPACITY)
+
+/* Traversal implementing `instantiate` and `instantiate_rev`.
+   We do not use `replace` because its cache is direct-mapped with a fixed capacity: on big proof terms,
+   collisions evict the results for shared subterms and they are instantiated again.
+   Subterms without loose bound variables in the instantiated range are skipped before accessing the cache. */
+class instantiate_fn {
+    unsigned            m_s;
+    unsigned            m_n;
+    expr const *        m_subst;
+    bool                m_rev;
+    instantiate_cache & m_cache;
+    LEAN_RUNTIME_STAT_CODE(uint64 m_visited = 0;)
+
+    expr const & get_subst(size_t i) const {
+        return m_rev ? m_subst[m_n - i - 1] : m_subst[i];
+    }
+
+    expr apply_children(expr const & e, unsigned offset) {
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::Sort:
+        case expr_kind::BVar:  case expr_kind::Lit:
+        case expr_kind::MVar:  case expr_kind::FVar:
+            lean_unreachable(); // LCOV_EXCL_LINE
+        case expr_kind::MData:
+            return update_mdata(e, apply(mdata_expr(e), offset));
+        case expr_kind::Proj:
+            return update_proj(e, apply(proj_expr(e), offset));
+        case expr_kind::App: {
+            expr new_f = apply(app_fn(e), offset);
+            expr new_a = apply(app_arg(e), offset);
+            return update_app(e, new_f, new_a);
+        }
+        case expr_kind::Pi: case expr_kind::Lambda: {
+            expr new_d = apply(binding_domain(e), offset);
+            expr new_b = apply(binding_body(e), offset+1);
+            return update_binding(e, new_d, new_b);
+        }
+        case expr_kind::Let: {
+            expr new_t = apply(let_type(e), offset);
+            expr new_v = apply(let_value(e), offset);
+            expr new_b = apply(let_body(e), offset+1);
+            return update_let(e, new_t, new_v, new_b);
+        }
+        }
+        lean_unreachable(); // LCOV_EXCL_LINE
+    }
+
+    expr apply(expr const & e, unsigned offset) {
+        unsigned s1 = m_s + offset;
+        if (s1 < m_s /* overflow, vidx can't be >= max unsigned */ || s1 >= get_loose_bvar_range(e))
+            return e;
+        LEAN_RUNTIME_STAT_CODE(m_visited++);
+        if (is_bvar(e)) {
+            nat const & vidx = bvar_idx(e);
+            size_t h = static_cast<size_t>(s1) + m_n;
+            if (vidx.is_small() && vidx.get_small_value() < h) {
+                return lift_loose_bvars(get_subst(vidx.get_small_value() - s1), offset);
+            } else {
+                return mk_bvar(vidx - nat(m_n));
+            }
+        }
+        bool shared = is_shared(e);
+        if (shared) {
+            if (expr const * r = m_cache.find(e, offset)) {
+                LEAN_RUNTIME_STAT_CODE(g_num_instantiate_cache_hits++);
+                return *r;
+            }
+        }
+        check_system("instantiate");
+        expr r = apply_children(e, offset);
+        if (shared)
+            m_cache.insert(e, offset, r);
+        return r;
+    }
+public:
+    instantiate_fn(unsigned s, unsigned n, expr const * subst, bool rev, instantiate_cache & cache):
+        m_s(s), m_n(n), m_subst(subst), m_rev(rev), m_cache(cache) {}
+
+    expr operator()(expr const & e) {
+        expr r = apply(e, 0);
+#ifdef LEAN_RUNTIME_STATS
+        g_num_instantiate++;
+        g_num_instantiate_visited += m_visited;
+        uint64 max = g_max_instantiate_visited.load();
+        while (m_visited > max && !g_max_instantiate_visited.compare_exchange_weak(max, m_visited)) {}
+#endif
+        return r;
+    }
+};
+
+static expr instantiate_core(expr const & a, unsigned s, unsigned n, expr const * subst, bool rev) {
+    instantiate_cache_ref cache;
+    return instantiate_fn(s, n, subst, rev, *cache)(a);
+}
+
 expr instantiate(expr const & a, unsigned s, unsigned n, expr const * subst) {
     if (s >= get_loose_bvar_range(a) || n == 0)
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
-            unsigned s1 = s + offset;
-            if (s1 < s)
-                return some_expr(m); // overflow, vidx can't be >= max unsigned
-            if (s1 >= get_loose_bvar_range(m))
-                return some_expr(m); // expression m does not contain loose bound variables with idx >= s1
-            if (is_bvar(m)) {
-                nat const & vidx = bvar_idx(m);
-                if (vidx >= s1) {
-                    unsigned h = s1 + n;
-                    if (h < s1 /* overflow, h is bigger than any vidx */ || vidx < h) {
-                        return some_expr(lift_loose_bvars(subst[vidx.get_small_value() - s1], offset));
-                    } else {
-                        return some_expr(mk_bvar(vidx - nat(n)));
-                    }
-                }
-            }
-            return none_expr();
-        });
+    return instantiate_core(a, s, n, subst, false);
 }
 
 expr instantiate(expr const & e, unsigned n, expr const * s) { return instantiate(e, 0, n, s); }
@@ -58,23 +252,9 @@ static object * lean_expr_instantiate_core(b_obj_arg a0, size_t n, object** subs
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
-            if (offset >= get_loose_bvar_range(m))
-                return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
-            if (is_bvar(m)) {
-                nat const & vidx = bvar_idx(m);
-                if (vidx >= offset) {
-                    size_t h = offset + n;
-                    if (h < offset /* overflow, h is bigger than any vidx */ || (vidx.is_small() && vidx.get_small_value() < h)) {
-                        object * v = subst[vidx.get_small_value() - offset];
-                        return some_expr(lift_loose_bvars(TO_REF(expr, v), offset));
-                    } else {
-                        return some_expr(mk_bvar(vidx - nat::of_size_t(n)));
-                    }
-                }
-            }
-            return none_expr();
-        });
+    if (n > std::numeric_limits<unsigned>::max())
+        lean_internal_panic("too many arguments for Expr.instantiate");
+    expr r = instantiate_core(a, 0, n, reinterpret_cast<expr const *>(subst), false);
     return r.steal();
 }
 
@@ -97,49 +277,36 @@ extern "C" LEAN_EXPORT object * lean_expr_instantiate_range(b_obj_arg a, b_obj_a
 }
 
 expr instantiate_rev(expr const & a, unsigned n, expr const * subst) {
-    if (!has_loose_bvars(a))
+    if (!has_loose_bvars(a) || n == 0)
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
-            if (offset >= get_loose_bvar_range(m))
-                return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
-            if (is_bvar(m)) {
-                nat const & vidx = bvar_idx(m);
-                if (vidx >= offset) {
-                    size_t h = offset + n;
-                    if (h < offset /* overflow, h is bigger than any vidx */ || (vidx.is_small() && vidx.get_small_value() < h)) {
-                        return some_expr(lift_loose_bvars(subst[n - (vidx.get_small_value() - offset) - 1], offset));
-                    } else {
-                        return some_expr(mk_bvar(vidx - nat(n)));
-                    }
-                }
-            }
-            return none_expr();
-        });
+    return instantiate_core(a, 0, n, subst, true);
+}
+
+instantiate_rev_telescope_fn::instantiate_rev_telescope_fn():m_n(0) {}
+instantiate_rev_telescope_fn::~instantiate_rev_telescope_fn() {}
+
+expr instantiate_rev_telescope_fn::operator()(expr const & a, unsigned n, expr const * subst) {
+    if (!has_loose_bvars(a) || n == 0)
+        return a;
+    if (!m_cache) {
+        m_cache.reset(new instantiate_cache(LEAN_INSTANTIATE_CACHE_MAX_REUSED_CAPACITY));
+    } else if (n != m_n) {
+        /* The cached results are only valid for the same substitution. */
+        m_cache->clear();
+    }
+    m_n = n;
+    return instantiate_fn(0, n, subst, true, *m_cache)(a);
 }
 
 static object * lean_expr_instantiate_rev_core(object * a0, size_t n, object ** subst) {
     expr const & a = reinterpret_cast<expr const &>(a0);
-    if (!has_loose_bvars(a)) {
+    if (!has_loose_bvars(a) || n == 0) {
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
-            if (offset >= get_loose_bvar_range(m))
-                return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
-            if (is_bvar(m)) {
-                nat const & vidx = bvar_idx(m);
-                if (vidx >= offset) {
-                    size_t h = offset + n;
-                    if (h < offset /* overflow, h is bigger than any vidx */ || (vidx.is_small() && vidx.get_small_value() < h)) {
-                        object * v = subst[n - (vidx.get_small_value() - offset) - 1];
-                        return some_expr(lift_loose_bvars(TO_REF(expr, v), offset));
-                    } else {
-                        return some_expr(mk_bvar(vidx - nat::of_size_t(n)));
-                    }
-                }
-            }
-            return none_expr();
-        });
+    if (n > std::numeric_limits<unsigned>::max())
+        lean_internal_panic("too many arguments for Expr.instantiateRev");
+    expr r = instantiate_core(a, 0, n, reinterpret_cast<expr const *>(subst), true);
     return r.steal();
 }
 
@@ -229,12 +396,66 @@ expr instantiate_lparams(expr const & e, names const & lps, levels const & ls) {
         });
 }
 
+/** \brief Memo table for `instantiate_type_lparams` and `instantiate_value_lparams`.
+    The key is the type or value of the constant, compared by pointer, the universe level parameters of the
+    constant, and the universe level arguments. The parameter names are part of the key because different
+    constants may share the same type or value object (e.g., after hash-consing) while declaring their universe
+    parameters in a different order.
+    The table holds a reference to the key, so the pointer cannot be reused by another expression while
+    the entry is alive. It is reset when it reaches `LEAN_INSTANTIATE_LPARAMS_CACHE_CAPACITY` entries. */
+struct instantiate_lparams_cache {
+    struct key {
+        expr   m_expr;
+        names  m_lparams;
+        levels m_levels;
+        key(expr const & e, names const & lps, levels const & ls):m_expr(e), m_lparams(lps), m_levels(ls) {}
+    };
+    struct key_hash {
+        unsigned operator()(key const & k) const {
+            unsigned h = hash(k.m_expr);
+            for (name const & n : k.m_lparams)
+                h = hash(h, n.hash());
+            for (level const & l : k.m_levels)
+                h = hash(h, l.hash());
+            return h;
+        }
+    };
+    struct key_eq {
+        bool operator()(key const & k1, key const & k2) const {
+            return
+                is_eqp(k1.m_expr, k2.m_expr) &&
+                (is_eqp(k1.m_lparams, k2.m_lparams) || k1.m_lparams == k2.m_lparams) &&
+                k1.m_levels == k2.m_levels;
+        }
+    };
+    flat_hash_map<key, expr, key_hash, key_eq> m_cache;
+};
+
+/* CACHE_RESET: No */
+MK_THREAD_LOCAL_GET_DEF(instantiate_lparams_cache, get_instantiate_lparams_cache);
+
+static expr cached_instantiate_lparams(expr const & e, names const & lps, levels const & ls) {
+    LEAN_RUNTIME_STAT_CODE(g_num_instantiate_lparams++);
+    auto & cache = get_instantiate_lparams_cache().m_cache;
+    instantiate_lparams_cache::key k(e, lps, ls);
+    auto it = cache.find(k);
+    if (it != cache.end()) {
+        LEAN_RUNTIME_STAT_CODE(g_num_instantiate_lparams_cache_hits++);
+        return it->second;
+    }
+    expr r = instantiate_lparams(e, lps, ls);
+    if (cache.size() >= LEAN_INSTANTIATE_LPARAMS_CACHE_CAPACITY)
+        cache.clear();
+    cache.insert(mk_pair(k, r));
+    return r;
+}
+
 expr instantiate_type_lparams(constant_info const & info, levels const & ls) {
     if (info.get_num_lparams() != length(ls))
         lean_internal_panic("#universes mismatch at instantiateTypeLevelParams");
     if (is_nil(ls) || !has_param_univ(info.get_type()))
         return info.get_type();
-    return instantiate_lparams(info.get_type(), info.get_lparams(), ls);
+    return cached_instantiate_lparams(info.get_type(), info.get_lparams(), ls);
 }
 
 expr instantiate_value_lparams(constant_info const & info, levels const & ls) {
@@ -244,7 +465,7 @@ expr instantiate_value_lparams(constant_info const & info, levels const & ls) {
         lean_internal_panic("definition/theorem expected at instantiateValueLevelParams");
     if (is_nil(ls) || !has_param_univ(info.get_value()))
         return info.get_value();
-    return instantiate_lparams(info.get_value(), info.get_lparams(), ls);
+    return cached_instantiate_lparams(info.get_value(), info.get_lparams(), ls);
 }
 
 }
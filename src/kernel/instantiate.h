@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <functional>
+#include <memory>
 #include "kernel/expr.h"
 
 namespace lean {
@@ -24,6 +25,23 @@ inline expr instantiate_rev(expr const & e, buffer<expr> const & s) {
     return instantiate_rev(e, s.size(), s.data());
 }
 
+class instantiate_cache;
+/** \brief Instantiate the components of a telescope `(x_1 : A_1) ... (x_n : A_n), B` with `s_1 ... s_n`.
+    A call `f(A_i, i-1, s)` is equivalent to `instantiate_rev(A_i, i-1, s)`, but consecutive calls with the same `n`
+    (e.g., the type and value of a `let`) share the results for common subterms. Results cannot be shared between
+    calls with different `n`, since `instantiate_rev` maps the bound variable `i` to `s[n-i-1]`.
+    \pre Each call uses an extension of the substitution used in the previous calls, and the arguments of
+    consecutive calls with the same `n` are kept alive until the last of them. */
+class instantiate_rev_telescope_fn {
+    std::unique_ptr<instantiate_cache> m_cache;
+    unsigned                           m_n;
+public:
+    instantiate_rev_telescope_fn();
+    ~instantiate_rev_telescope_fn();
+    expr operator()(expr const & e, unsigned n, expr const * s);
+    expr operator()(expr const & e, buffer<expr> const & s) { return operator()(e, s.size(), s.data()); }
+};
+
 expr apply_beta(expr f, unsigned num_rev_args, expr const * rev_args);
 bool is_head_beta(expr const & t);
 expr head_beta_reduce(expr const & t);
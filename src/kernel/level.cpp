@@ -12,10 +12,16 @@ Author: Leonardo de Moura
 #include "runtime/interrupt.h"
 #include "runtime/hash.h"
 #include "runtime/buffer.h"
+#include "runtime/thread.h"
 #include "util/list.h"
+#include "util/flat_hash_map.h"
 #include "kernel/level.h"
 #include "kernel/environment.h"
 
+#ifndef LEAN_LEVEL_CACHE_CAPACITY
+#define LEAN_LEVEL_CACHE_CAPACITY 1024*16
+#endif
+
 namespace lean {
 
 extern "C" unsigned lean_level_hash(obj_arg l);
@@ -426,7 +432,51 @@ level mk_succ(level l, unsigned k) {
     return l;
 }
 
-level normalize(level const & l) {
+/** \brief Memo table for `normalize`. The normal forms are hash-consed: structurally equal normal forms
+    (and their subterms) are represented by the same object, so comparing them in `is_equivalent` and
+    `is_geq_core` usually succeeds by pointer equality. The tables hold references to their entries and are
+    reset when they reach `LEAN_LEVEL_CACHE_CAPACITY` entries. */
+struct level_normalize_cache {
+    flat_hash_map<level, level, level_hash, level_eq> m_normalized;
+    flat_hash_set<level, level_hash, level_eq>        m_levels;
+
+    level hcons(level const & l) {
+        auto it = m_levels.find(l);
+        if (it != m_levels.end())
+            return *it;
+        level r = l;
+        switch (kind(l)) {
+        case level_kind::Zero: case level_kind::Param: case level_kind::MVar:
+            break;
+        case level_kind::Succ: {
+            level a = hcons(succ_of(l));
+            if (!is_eqp(a, succ_of(l)))
+                r = mk_succ(a);
+            break;
+        }
+        case level_kind::Max: case level_kind::IMax: {
+            level a1 = hcons(level_lhs(l));
+            level a2 = hcons(level_rhs(l));
+            if (!is_eqp(a1, level_lhs(l)) || !is_eqp(a2, level_rhs(l)))
+                r = is_max(l) ? mk_max_core(a1, a2) : mk_imax_core(a1, a2);
+            break;
+        }}
+        m_levels.insert(r);
+        return r;
+    }
+
+    void reset_if_full() {
+        if (m_normalized.size() >= LEAN_LEVEL_CACHE_CAPACITY || m_levels.size() >= LEAN_LEVEL_CACHE_CAPACITY) {
+            m_normalized.clear();
+            m_levels.clear();
+        }
+    }
+};
+
+/* CACHE_RESET: No */
+MK_THREAD_LOCAL_GET_DEF(level_normalize_cache, get_level_normalize_cache);
+
+static level normalize_core(level const & l) {
     auto p = to_offset(l);
     level const & r = p.first;
     switch (kind(r)) {
@@ -490,6 +540,24 @@ level normalize(level const & l) {
     lean_unreachable(); // LCOV_EXCL_LINE
 }
 
+level normalize(level const & l) {
+    switch (kind(to_offset(l).first)) {
+    case level_kind::Zero: case level_kind::Param: case level_kind::MVar:
+        return l;
+    case level_kind::Succ: case level_kind::Max: case level_kind::IMax:
+        break;
+    }
+    level_normalize_cache & cache = get_level_normalize_cache();
+    auto it = cache.m_normalized.find(l);
+    if (it != cache.m_normalized.end())
+        return it->second;
+    level r = normalize_core(l);
+    cache.reset_if_full();
+    r = cache.hcons(r);
+    cache.m_normalized.insert(mk_pair(l, r));
+    return r;
+}
+
 bool is_equivalent(level const & lhs, level const & rhs) {
     check_system("level constraints");
     return lhs == rhs || normalize(lhs) == normalize(rhs);
@@ -6,10 +6,18 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <memory>
+#include <algorithm>
 #include "runtime/interrupt.h"
 #include "runtime/sstream.h"
 #include "runtime/flet.h"
 #include "util/lbool.h"
+#include "util/name_hash_map.h"
+#include "util/flat_hash_map.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr_maps.h"
 #include "kernel/instantiate.h"
@@ -35,9 +43,414 @@ static expr * g_nat_mod      = nullptr;
 static expr * g_nat_div      = nullptr;
 static expr * g_nat_beq      = nullptr;
 static expr * g_nat_ble      = nullptr;
+static expr * g_nat_land     = nullptr;
+static expr * g_nat_lor      = nullptr;
+static expr * g_nat_xor      = nullptr;
+static expr * g_nat_shiftl   = nullptr;
+static expr * g_nat_shiftr   = nullptr;
+static expr * g_nat_log2     = nullptr;
+
+/* Counters collected by the kernel profiler for a declaration. */
+struct kernel_decl_profile {
+    name                  m_decl;
+    std::chrono::steady_clock::time_point m_start;
+    double                m_time = 0; /* seconds */
+    uint64                m_is_def_eq = 0;
+    uint64                m_whnf_core = 0;
+    uint64                m_lazy_delta_steps = 0;
+    /* Maximal number of steps of a single `lazy_delta_reduction` */
+    uint64                m_max_lazy_delta_steps = 0;
+    /* Maximal number of nested `lazy_delta_reduction` invocations */
+    unsigned              m_max_lazy_delta_depth = 0;
+    uint64                m_eqv_hits = 0;
+    uint64                m_failure_hits = 0;
+    /* Number of delta-unfoldings of each constant */
+    name_hash_map<uint64> m_unfolds;
+
+    explicit kernel_decl_profile(name const & n):m_decl(n) {}
+
+    void merge(kernel_decl_profile const & p) {
+        m_time                 += p.m_time;
+        m_is_def_eq            += p.m_is_def_eq;
+        m_whnf_core            += p.m_whnf_core;
+        m_lazy_delta_steps     += p.m_lazy_delta_steps;
+        m_max_lazy_delta_steps  = std::max(m_max_lazy_delta_steps, p.m_max_lazy_delta_steps);
+        m_max_lazy_delta_depth  = std::max(m_max_lazy_delta_depth, p.m_max_lazy_delta_depth);
+        m_eqv_hits             += p.m_eqv_hits;
+        m_failure_hits         += p.m_failure_hits;
+        for (auto const & u : p.m_unfolds)
+            m_unfolds[u.first] += u.second;
+    }
+};
+
+static std::atomic<bool> g_kernel_profiler(false);
+LEAN_THREAD_PTR(kernel_decl_profile, g_decl_profile);
+static mutex * g_kernel_profile_mutex = nullptr;
+/* Profiles of the declarations in the order they were first checked. The profiles of declarations checked
+   in several steps (e.g., a theorem whose proof is checked asynchronously) are merged. */
+static std::vector<std::unique_ptr<kernel_decl_profile>> * g_kernel_profile = nullptr;
+static name_hash_map<size_t> * g_kernel_profile_idx = nullptr;
+
+void set_kernel_profiler(bool enabled) {
+    g_kernel_profiler.store(enabled, std::memory_order_relaxed);
+}
+
+static std::atomic<bool> g_kernel_hash_consing(false);
+LEAN_THREAD_PTR(kernel_decl_scope, g_kernel_decl_scope);
+/* Time spent in outermost `kernel_decl_scope`s, in nanoseconds. */
+static std::atomic<uint64> g_kernel_time(0);
+
+void set_kernel_hash_consing(bool enabled) {
+    g_kernel_hash_consing.store(enabled, std::memory_order_relaxed);
+}
+
+kernel_decl_scope::kernel_decl_scope(name const & n):
+    m_decl(n), m_prev_scope(g_kernel_decl_scope), m_profile(nullptr), m_prev(g_decl_profile),
+    m_outermost(!g_kernel_decl_scope), m_hcons(g_kernel_hash_consing.load(std::memory_order_relaxed)) {
+    g_kernel_decl_scope = this;
+    if (m_outermost)
+        m_start = std::chrono::steady_clock::now();
+    if (g_kernel_profiler.load(std::memory_order_relaxed)) {
+        m_profile = new kernel_decl_profile(n);
+        m_profile->m_start = std::chrono::steady_clock::now();
+        g_decl_profile = m_profile;
+    }
+}
+
+kernel_decl_scope::~kernel_decl_scope() {
+    g_kernel_decl_scope = m_prev_scope;
+    if (m_outermost) {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        g_kernel_time += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+    if (!m_profile)
+        return;
+    g_decl_profile = m_prev;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_profile->m_start;
+    m_profile->m_time = elapsed.count();
+    std::unique_ptr<kernel_decl_profile> p(m_profile);
+    lock_guard<mutex> _(*g_kernel_profile_mutex);
+    auto it = g_kernel_profile_idx->find(p->m_decl);
+    if (it != g_kernel_profile_idx->end()) {
+        (*g_kernel_profile)[it->second]->merge(*p);
+    } else {
+        g_kernel_profile_idx->insert(mk_pair(p->m_decl, g_kernel_profile->size()));
+        g_kernel_profile->push_back(std::move(p));
+    }
+}
+
+kernel_thread_context::kernel_thread_context():m_task(get_current_task_object()) {
+    if (g_kernel_decl_scope) {
+        m_decl = g_kernel_decl_scope->m_decl;
+        /* The helper threads copy it. */
+        mark_mt(m_decl->raw());
+    }
+}
+
+kernel_worker_scope::kernel_worker_scope(kernel_thread_context const & ctx):m_cancel(ctx.m_task) {
+    if (ctx.m_decl)
+        m_scope.reset(new kernel_decl_scope(*ctx.m_decl));
+}
+
+static void display_json_string(std::ostream & out, std::string const & s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned>(c)
+                << std::dec << std::setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+/* Display `unfolds` as a JSON object, the constants unfolded more often first. */
+static void display_json_unfolds(std::ostream & out, name_hash_map<uint64> const & unfolds) {
+    std::vector<std::pair<name, uint64>> entries(unfolds.begin(), unfolds.end());
+    std::sort(entries.begin(), entries.end(), [](std::pair<name, uint64> const & a, std::pair<name, uint64> const & b) {
+            return a.second > b.second || (a.second == b.second && quick_cmp(a.first, b.first) < 0);
+        });
+    out << "{";
+    bool first = true;
+    for (auto const & e : entries) {
+        if (!first) out << ", ";
+        first = false;
+        display_json_string(out, e.first.to_string());
+        out << ": " << e.second;
+    }
+    out << "}";
+}
+
+void display_kernel_profile(std::ostream & out) {
+    if (!g_kernel_profiler.load(std::memory_order_relaxed))
+        return;
+    lock_guard<mutex> _(*g_kernel_profile_mutex);
+    std::ostringstream ss;
+    name_hash_map<uint64> total_unfolds;
+    ss << "{\"kernel_profile\": {\"declarations\": [";
+    bool first = true;
+    for (std::unique_ptr<kernel_decl_profile> const & p : *g_kernel_profile) {
+        if (!first) ss << ",";
+        first = false;
+        ss << "\n  {\"name\": ";
+        display_json_string(ss, p->m_decl.to_string());
+        ss << ", \"time\": " << p->m_time
+           << ", \"is_def_eq\": " << p->m_is_def_eq
+           << ", \"whnf_core\": " << p->m_whnf_core
+           << ", \"lazy_delta_steps\": " << p->m_lazy_delta_steps
+           << ", \"max_lazy_delta_steps\": " << p->m_max_lazy_delta_steps
+           << ", \"max_lazy_delta_depth\": " << p->m_max_lazy_delta_depth
+           << ", \"equiv_manager_hits\": " << p->m_eqv_hits
+           << ", \"failure_cache_hits\": " << p->m_failure_hits
+           << ", \"unfolds\": ";
+        display_json_unfolds(ss, p->m_unfolds);
+        ss << "}";
+        for (auto const & u : p->m_unfolds)
+            total_unfolds[u.first] += u.second;
+    }
+    ss << "],\n \"unfolds\": ";
+    display_json_unfolds(ss, total_unfolds);
+    ss << "}}\n";
+    // output atomically, like IO.print
+    out << ss.str();
+}
 
 type_checker::state::state(environment const & env):
-    m_env(env), m_ngen(*g_kernel_fresh) {}
+    m_env(env), m_ngen(*g_kernel_fresh), m_profile(g_decl_profile) {}
+
+/* Kernel caches shared across declarations.
+   The results of `infer_type_core` (in `infer_only` mode), `whnf_core` and `whnf` on a closed term that
+   only references imported constants depend only on the imported declarations. So, they are valid for all
+   environments with the same imports (see `environment::get_imports_key`), and are reused by later `add_decl`
+   calls instead of being recomputed by each fresh `type_checker::state`. */
+enum class shared_cache_kind { Infer, WhnfCore, Whnf };
+static char const * g_shared_cache_kind_names[3] = { "infer", "whnf_core", "whnf" };
+
+class shared_cache {
+    mutex          m_mutex;
+    size_t         m_capacity = 0;
+    /* Imports key of the environments the entries are valid for. We keep a reference to make sure
+       the pointer is not reused by environments with different imports. */
+    object *       m_imports_key = nullptr;
+    expr_flat_map<expr> m_maps[3];
+    uint64         m_hits[3] = { 0, 0, 0 };
+    uint64         m_misses[3] = { 0, 0, 0 };
+public:
+    ~shared_cache() {
+        if (m_imports_key)
+            dec(m_imports_key);
+    }
+
+    void set_capacity(size_t capacity) {
+        lock_guard<mutex> _(m_mutex);
+        m_capacity = capacity;
+        for (expr_flat_map<expr> & m : m_maps)
+            m.clear();
+    }
+
+    optional<expr> find(environment const & env, shared_cache_kind k, expr const & e) {
+        unsigned i = static_cast<unsigned>(k);
+        lock_guard<mutex> _(m_mutex);
+        if (m_imports_key == env.get_imports_key()) {
+            auto it = m_maps[i].find(e);
+            if (it != m_maps[i].end()) {
+                m_hits[i]++;
+                return some_expr(it->second);
+            }
+        }
+        m_misses[i]++;
+        return none_expr();
+    }
+
+    void insert(environment const & env, shared_cache_kind k, expr const & e, expr const & r) {
+        unsigned i = static_cast<unsigned>(k);
+        lock_guard<mutex> _(m_mutex);
+        object * key = env.get_imports_key();
+        if (m_imports_key != key) {
+            for (expr_flat_map<expr> & m : m_maps)
+                m.clear();
+            if (m_imports_key)
+                dec(m_imports_key);
+            mark_mt(key);
+            inc(key);
+            m_imports_key = key;
+        }
+        if (m_maps[i].size() >= m_capacity)
+            m_maps[i].clear();
+        /* The entries are shared by all threads. */
+        mark_mt(e.raw());
+        mark_mt(r.raw());
+        m_maps[i].insert(mk_pair(e, r));
+    }
+
+    void display_stats(std::ostream & out) {
+        lock_guard<mutex> _(m_mutex);
+        for (unsigned i = 0; i < 3; i++) {
+            std::string label = std::string("kernel cache '") + g_shared_cache_kind_names[i] + "':";
+            out << std::left << std::setw(39) << label << m_hits[i] << " hits, " << m_misses[i] << " misses, "
+                << m_maps[i].size() << " entries\n";
+        }
+    }
+};
+
+static shared_cache * g_shared_cache = nullptr;
+static std::atomic<bool> g_shared_cache_enabled(false);
+
+#ifndef LEAN_CONSTANT_TYPE_CACHE_CAPACITY
+#define LEAN_CONSTANT_TYPE_CACHE_CAPACITY 1024*64
+#endif
+
+/* Memo table for `infer_constant` shared by all `type_checker` objects.
+   It maps an imported constant `c` and universe levels `ls` to the type of `c` instantiated with `ls`.
+   As in `shared_cache`, the entries are valid for all environments with the same imports key.
+   The table is split into shards with their own lock to reduce contention between threads. */
+class constant_type_cache {
+    typedef std::pair<name, levels> key;
+    struct key_hash {
+        unsigned operator()(key const & k) const {
+            unsigned h = k.first.hash();
+            for (level const & l : k.second)
+                h = hash(h, l.hash());
+            return h;
+        }
+    };
+    struct key_eq {
+        bool operator()(key const & k1, key const & k2) const {
+            return k1.first == k2.first && k1.second == k2.second;
+        }
+    };
+    static constexpr unsigned num_shards = 16;
+    struct shard {
+        mutex    m_mutex;
+        object * m_imports_key = nullptr;
+        flat_hash_map<key, expr, key_hash, key_eq> m_map;
+    };
+    shard               m_shards[num_shards];
+    std::atomic<uint64> m_hits{0};
+    std::atomic<uint64> m_misses{0};
+public:
+    ~constant_type_cache() {
+        for (shard & s : m_shards) {
+            if (s.m_imports_key)
+                dec(s.m_imports_key);
+        }
+    }
+
+    optional<expr> find(environment const & env, name const & n, levels const & ls) {
+        key k(n, ls);
+        unsigned h = key_hash()(k);
+        shard & s = m_shards[h % num_shards];
+        {
+            lock_guard<mutex> _(s.m_mutex);
+            if (s.m_imports_key == env.get_imports_key()) {
+                auto it = s.m_map.find(k);
+                if (it != s.m_map.end()) {
+                    m_hits.fetch_add(1, std::memory_order_relaxed);
+                    return some_expr(it->second);
+                }
+            }
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return none_expr();
+    }
+
+    void insert(environment const & env, name const & n, levels const & ls, expr const & r) {
+        key k(n, ls);
+        unsigned h = key_hash()(k);
+        shard & s = m_shards[h % num_shards];
+        lock_guard<mutex> _(s.m_mutex);
+        object * imports_key = env.get_imports_key();
+        if (s.m_imports_key != imports_key) {
+            s.m_map.clear();
+            if (s.m_imports_key)
+                dec(s.m_imports_key);
+            mark_mt(imports_key);
+            inc(imports_key);
+            s.m_imports_key = imports_key;
+        }
+        if (s.m_map.size() >= LEAN_CONSTANT_TYPE_CACHE_CAPACITY / num_shards)
+            s.m_map.clear();
+        /* The entries are shared by all threads. */
+        mark_mt(n.raw());
+        mark_mt(ls.raw());
+        mark_mt(r.raw());
+        s.m_map.insert(mk_pair(k, r));
+    }
+
+    void display_stats(std::ostream & out) {
+        size_t size = 0;
+        for (shard & s : m_shards) {
+            lock_guard<mutex> _(s.m_mutex);
+            size += s.m_map.size();
+        }
+        out << std::left << std::setw(39) << "kernel cache 'constant type':" << m_hits.load() << " hits, "
+            << m_misses.load() << " misses, " << size << " entries\n";
+    }
+};
+
+static constant_type_cache * g_constant_type_cache = nullptr;
+
+void set_kernel_cache_capacity(size_t capacity) {
+    g_shared_cache->set_capacity(capacity);
+    g_shared_cache_enabled.store(capacity > 0, std::memory_order_release);
+}
+
+void display_kernel_cache_stats(std::ostream & out) {
+    out << std::left << std::setw(39) << "kernel time:" << g_kernel_time.load() / 1e9 << "s\n";
+    display_expr_eq_memo_stats(out);
+    if (g_kernel_hash_consing.load(std::memory_order_relaxed))
+        display_expr_hcons_stats(out);
+    g_constant_type_cache->display_stats(out);
+    if (g_shared_cache_enabled.load(std::memory_order_acquire))
+        g_shared_cache->display_stats(out);
+}
+
+/** \brief Return true iff the closed term \c e only references imported constants. */
+bool type_checker::only_imported_consts(expr const & e) {
+    auto it = m_st->m_imported_only.find(e);
+    if (it != m_st->m_imported_only.end())
+        return it->second;
+    bool r = true;
+    switch (e.kind()) {
+    case expr_kind::BVar: case expr_kind::Sort: case expr_kind::Lit:
+        break;
+    case expr_kind::FVar: case expr_kind::MVar:
+        r = false;
+        break;
+    case expr_kind::Const:
+        r = env().is_imported(const_name(e));
+        break;
+    case expr_kind::MData:
+        r = only_imported_consts(mdata_expr(e));
+        break;
+    case expr_kind::Proj:
+        r = env().is_imported(proj_sname(e)) && only_imported_consts(proj_expr(e));
+        break;
+    case expr_kind::App:
+        r = only_imported_consts(app_fn(e)) && only_imported_consts(app_arg(e));
+        break;
+    case expr_kind::Lambda: case expr_kind::Pi:
+        r = only_imported_consts(binding_domain(e)) && only_imported_consts(binding_body(e));
+        break;
+    case expr_kind::Let:
+        r = only_imported_consts(let_type(e)) && only_imported_consts(let_value(e)) && only_imported_consts(let_body(e));
+        break;
+    }
+    m_st->m_imported_only.insert(mk_pair(e, r));
+    return r;
+}
+
+/** \brief Return true iff the results for \c e can be stored in the caches shared across declarations. */
+bool type_checker::use_shared_cache(expr const & e) {
+    return
+        g_shared_cache_enabled.load(std::memory_order_relaxed) &&
+        m_definition_safety == definition_safety::safe &&
+        !has_fvar(e) && !has_loose_bvars(e) &&
+        only_imported_consts(e);
+}
 
 /** \brief Make sure \c e "is" a sort, and return the corresponding sort.
     If \c e is not a sort, then the whnf procedure is invoked.
@@ -104,15 +517,24 @@ expr type_checker::infer_constant(expr const & e, bool infer_only) {
             check_level(l);
         }
     }
-    return instantiate_type_lparams(info, ls);
+    if (is_nil(ls) || !has_param_univ(info.get_type()))
+        return info.get_type();
+    if (!env().is_imported(const_name(e)))
+        return instantiate_type_lparams(info, ls);
+    if (auto r = g_constant_type_cache->find(env(), const_name(e), ls))
+        return *r;
+    expr r = instantiate_type_lparams(info, ls);
+    g_constant_type_cache->insert(env(), const_name(e), ls, r);
+    return r;
 }
 
 expr type_checker::infer_lambda(expr const & _e, bool infer_only) {
     flet<local_ctx> save_lctx(m_lctx, m_lctx);
     buffer<expr> fvars;
+    instantiate_rev_telescope_fn instantiate_telescope;
     expr e = _e;
     while (is_lambda(e)) {
-        expr d    = instantiate_rev(binding_domain(e), fvars.size(), fvars.data());
+        expr d    = instantiate_telescope(binding_domain(e), fvars);
         expr fvar = m_lctx.mk_local_decl(m_st->m_ngen, binding_name(e), d, binding_info(e));
         fvars.push_back(fvar);
         if (!infer_only) {
@@ -120,7 +542,7 @@ expr type_checker::infer_lambda(expr const & _e, bool infer_only) {
         }
         e = binding_body(e);
     }
-    expr r = infer_type_core(instantiate_rev(e, fvars.size(), fvars.data()), infer_only);
+    expr r = infer_type_core(instantiate_telescope(e, fvars), infer_only);
     r = cheap_beta_reduce(r);
     return m_lctx.mk_pi(fvars, r);
 }
@@ -129,16 +551,17 @@ expr type_checker::infer_pi(expr const & _e, bool infer_only) {
     flet<local_ctx> save_lctx(m_lctx, m_lctx);
     buffer<expr> fvars;
     buffer<level> us;
+    instantiate_rev_telescope_fn instantiate_telescope;
     expr e = _e;
     while (is_pi(e)) {
-        expr d  = instantiate_rev(binding_domain(e), fvars.size(), fvars.data());
+        expr d  = instantiate_telescope(binding_domain(e), fvars);
         expr t1 = ensure_sort_core(infer_type_core(d, infer_only), d);
         us.push_back(sort_level(t1));
         expr fvar  = m_lctx.mk_local_decl(m_st->m_ngen, binding_name(e), d, binding_info(e));
         fvars.push_back(fvar);
         e = binding_body(e);
     }
-    e = instantiate_rev(e, fvars.size(), fvars.data());
+    e = instantiate_telescope(e, fvars);
     expr s  = ensure_sort_core(infer_type_core(e, infer_only), e);
     level r = sort_level(s);
     unsigned i = fvars.size();
@@ -198,10 +621,11 @@ expr type_checker::infer_let(expr const & _e, bool infer_only) {
     flet<local_ctx> save_lctx(m_lctx, m_lctx);
     buffer<expr> fvars;
     buffer<expr> vals;
+    instantiate_rev_telescope_fn instantiate_telescope;
     expr e = _e;
     while (is_let(e)) {
-        expr type = instantiate_rev(let_type(e), fvars.size(), fvars.data());
-        expr val  = instantiate_rev(let_value(e), fvars.size(), fvars.data());
+        expr type = instantiate_telescope(let_type(e), fvars);
+        expr val  = instantiate_telescope(let_value(e), fvars);
         expr fvar = m_lctx.mk_local_decl(m_st->m_ngen, let_name(e), type, val);
         fvars.push_back(fvar);
         vals.push_back(val);
@@ -214,7 +638,7 @@ expr type_checker::infer_let(expr const & _e, bool infer_only) {
         }
         e = let_body(e);
     }
-    expr r = infer_type_core(instantiate_rev(e, fvars.size(), fvars.data()), infer_only);
+    expr r = infer_type_core(instantiate_telescope(e, fvars), infer_only);
     r = cheap_beta_reduce(r); // use `cheap_beta_reduce` (to try) to reduce number of dependencies
     buffer<bool, 128> used;
     used.resize(fvars.size(), false);
@@ -293,6 +717,14 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     if (it != m_st->m_infer_type[infer_only].end())
         return it->second;
 
+    bool shared = infer_only && use_shared_cache(e);
+    if (shared) {
+        if (auto r = g_shared_cache->find(env(), shared_cache_kind::Infer, e)) {
+            m_st->m_infer_type[infer_only].insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
     expr r;
     switch (e.kind()) {
     case expr_kind::Lit:      r = lit_type(lit_value(e)); break;
@@ -314,6 +746,8 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     }
 
     m_st->m_infer_type[infer_only].insert(mk_pair(e, r));
+    if (shared)
+        g_shared_cache->insert(env(), shared_cache_kind::Infer, e, r);
     return r;
 }
 
@@ -411,6 +845,8 @@ static bool is_let_fvar(local_ctx const & lctx, expr const & e) {
     We also do not cache results. */
 expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     check_system("type checker: whnf", /* do_check_interrupted */ true);
+    if (m_st->m_profile)
+        m_st->m_profile->m_whnf_core++;
 
     // handle easy cases
     switch (e.kind()) {
@@ -435,6 +871,14 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     if (it != m_st->m_whnf_core.end())
         return it->second;
 
+    bool shared = !cheap_rec && !cheap_proj && use_shared_cache(e);
+    if (shared) {
+        if (auto r = g_shared_cache->find(env(), shared_cache_kind::WhnfCore, e)) {
+            m_st->m_whnf_core.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
     // do the actual work
     expr r;
     switch (e.kind()) {
@@ -485,6 +929,8 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     if (!cheap_rec && !cheap_proj) {
         m_st->m_whnf_core.insert(mk_pair(e, r));
     }
+    if (shared)
+        g_shared_cache->insert(env(), shared_cache_kind::WhnfCore, e, r);
     return r;
 }
 
@@ -503,8 +949,11 @@ optional<constant_info> type_checker::is_delta(expr const & e) const {
 optional<expr> type_checker::unfold_definition_core(expr const & e) {
     if (is_constant(e)) {
         if (auto d = is_delta(e)) {
-            if (length(const_levels(e)) == d->get_num_lparams())
+            if (length(const_levels(e)) == d->get_num_lparams()) {
+                if (m_st->m_profile)
+                    m_st->m_profile->m_unfolds[const_name(e)]++;
                 return some_expr(instantiate_value_lparams(*d, const_levels(e)));
+            }
         }
     }
     return none_expr();
@@ -586,6 +1035,20 @@ template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const &
     return f(v1.raw(), v2.raw()) ? some_expr(mk_bool_true()) : some_expr(mk_bool_false());
 }
 
+/* Exponents (and shift amounts) above this bound are not reduced using GMP, the result would not fit in memory anyway. */
+static const size_t g_nat_max_exponent = 1 << 24;
+
+template<typename F> optional<expr> type_checker::reduce_bin_nat_exp_op(F const & f, expr const & e) {
+    expr arg2 = whnf(app_arg(e));
+    if (!is_nat_lit_ext(arg2)) return none_expr();
+    nat v2 = get_nat_val(arg2);
+    if (!v2.is_small() || v2.get_small_value() > g_nat_max_exponent) return none_expr();
+    expr arg1 = whnf(app_arg(app_fn(e)));
+    if (!is_nat_lit_ext(arg1)) return none_expr();
+    nat v1 = get_nat_val(arg1);
+    return some_expr(mk_lit(literal(nat(f(v1.raw(), v2.raw())))));
+}
+
 optional<expr> type_checker::reduce_nat(expr const & e) {
     if (has_fvar(e)) return none_expr();
     unsigned nargs = get_app_num_args(e);
@@ -597,18 +1060,29 @@ optional<expr> type_checker::reduce_nat(expr const & e) {
             nat v = get_nat_val(arg);
             return some_expr(mk_lit(literal(nat(v+nat(1)))));
         }
+        if (f == *g_nat_log2) {
+            expr arg = whnf(app_arg(e));
+            if (!is_nat_lit_ext(arg)) return none_expr();
+            nat v = get_nat_val(arg);
+            return some_expr(mk_lit(literal(nat(nat_log2(v.raw())))));
+        }
     } else if (nargs == 2) {
         expr const & f = app_fn(app_fn(e));
         if (!is_constant(f)) return none_expr();
         if (f == *g_nat_add) return reduce_bin_nat_op(nat_add, e);
         if (f == *g_nat_sub) return reduce_bin_nat_op(nat_sub, e);
         if (f == *g_nat_mul) return reduce_bin_nat_op(nat_mul, e);
-        if (f == *g_nat_pow) return reduce_bin_nat_op(nat_pow, e);
+        if (f == *g_nat_pow) return reduce_bin_nat_exp_op(nat_pow, e);
         if (f == *g_nat_gcd) return reduce_bin_nat_op(nat_gcd, e);
         if (f == *g_nat_mod) return reduce_bin_nat_op(nat_mod, e);
         if (f == *g_nat_div) return reduce_bin_nat_op(nat_div, e);
         if (f == *g_nat_beq) return reduce_bin_nat_pred(nat_eq, e);
         if (f == *g_nat_ble) return reduce_bin_nat_pred(nat_le, e);
+        if (f == *g_nat_land) return reduce_bin_nat_op(nat_land, e);
+        if (f == *g_nat_lor) return reduce_bin_nat_op(nat_lor, e);
+        if (f == *g_nat_xor) return reduce_bin_nat_op(nat_lxor, e);
+        if (f == *g_nat_shiftl) return reduce_bin_nat_exp_op(nat_shiftl, e);
+        if (f == *g_nat_shiftr) return reduce_bin_nat_op(nat_shiftr, e);
     }
     return none_expr();
 }
@@ -637,23 +1111,35 @@ expr type_checker::whnf(expr const & e) {
     if (it != m_st->m_whnf.end())
         return it->second;
 
+    bool shared = use_shared_cache(e);
+    if (shared) {
+        if (auto r = g_shared_cache->find(env(), shared_cache_kind::Whnf, e)) {
+            m_st->m_whnf.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
     expr t = e;
+    expr r;
     while (true) {
         expr t1 = whnf_core(t);
         if (auto v = reduce_native(env(), t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto v = reduce_nat(t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto next_t = unfold_definition(t1)) {
             t = *next_t;
         } else {
-            auto r = t1;
-            m_st->m_whnf.insert(mk_pair(e, r));
-            return r;
+            r = t1;
+            break;
         }
     }
+    m_st->m_whnf.insert(mk_pair(e, r));
+    if (shared)
+        g_shared_cache->insert(env(), shared_cache_kind::Whnf, e, r);
+    return r;
 }
 
 /** \brief Given lambda/Pi expressions \c t and \c s, return true iff \c t is def eq to \c s.
@@ -714,8 +1200,11 @@ bool type_checker::is_def_eq(levels const & ls1, levels const & ls2) {
 
 /** \brief This is an auxiliary method for is_def_eq. It handles the "easy cases". */
 lbool type_checker::quick_is_def_eq(expr const & t, expr const & s, bool use_hash) {
-    if (m_st->m_eqv_manager.is_equiv(t, s, use_hash))
+    if (m_st->m_eqv_manager.is_equiv(t, s, use_hash)) {
+        if (m_st->m_profile)
+            m_st->m_profile->m_eqv_hits++;
         return l_true;
+    }
     if (t.kind() == s.kind()) {
         switch (t.kind()) {
         case expr_kind::Lambda: case expr_kind::Pi:
@@ -819,15 +1308,19 @@ lbool type_checker::is_def_eq_proof_irrel(expr const & t, expr const & s) {
 }
 
 bool type_checker::failed_before(expr const & t, expr const & s) const {
+    bool r;
     if (hash(t) < hash(s)) {
-        return m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end();
+        r = m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end();
     } else if (hash(t) > hash(s)) {
-        return m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
+        r = m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
     } else {
-        return
+        r =
             m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end() ||
             m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
     }
+    if (r && m_st->m_profile)
+        m_st->m_profile->m_failure_hits++;
+    return r;
 }
 
 void type_checker::cache_failure(expr const & t, expr const & s) {
@@ -946,6 +1439,11 @@ lbool type_checker::is_def_eq_offset(expr const & t, expr const & s) {
 }
 
 lbool type_checker::lazy_delta_reduction(expr & t_n, expr & s_n) {
+    kernel_decl_profile * prof = m_st->m_profile;
+    flet<unsigned> inc_depth(m_st->m_lazy_delta_depth, m_st->m_lazy_delta_depth + 1);
+    if (prof)
+        prof->m_max_lazy_delta_depth = std::max(prof->m_max_lazy_delta_depth, m_st->m_lazy_delta_depth);
+    uint64 steps = 0;
     while (true) {
         lbool r = is_def_eq_offset(t_n, s_n);
         if (r != l_undef) return r;
@@ -964,6 +1462,11 @@ lbool type_checker::lazy_delta_reduction(expr & t_n, expr & s_n) {
             return to_lbool(is_def_eq_core(t_n, *s_v));
         }
 
+        if (prof) {
+            steps++;
+            prof->m_lazy_delta_steps++;
+            prof->m_max_lazy_delta_steps = std::max(prof->m_max_lazy_delta_steps, steps);
+        }
         switch (lazy_delta_reduction_step(t_n, s_n)) {
         case reduction_status::Continue:   break;
         case reduction_status::DefUnknown: return l_undef;
@@ -1003,6 +1506,8 @@ bool type_checker::is_def_eq_unit_like(expr const & t, expr const & s) {
 
 bool type_checker::is_def_eq_core(expr const & t, expr const & s) {
     check_system("is_definitionally_equal", /* do_check_interrupted */ true);
+    if (m_st->m_profile)
+        m_st->m_profile->m_is_def_eq++;
     bool use_hash = true;
     lbool r = quick_is_def_eq(t, s, use_hash);
     if (r != l_undef) return r == l_true;
@@ -1114,7 +1619,7 @@ type_checker::type_checker(state & st, local_ctx const & lctx, definition_safety
 
 type_checker::type_checker(type_checker && src):
     m_st_owner(src.m_st_owner), m_st(src.m_st), m_lctx(std::move(src.m_lctx)),
-    m_definition_safety(src.m_definition_safety), m_lparams(src.m_lparams) {
+    m_definition_safety(src.m_definition_safety), m_lparams(src.m_lparams), m_eq_memo(std::move(src.m_eq_memo)) {
     src.m_st_owner = false;
 }
 
@@ -1136,6 +1641,11 @@ extern "C" LEAN_EXPORT lean_object * lean_kernel_whnf(lean_object * env, lean_ob
 }
 
 void initialize_type_checker() {
+    g_shared_cache = new shared_cache();
+    g_constant_type_cache = new constant_type_cache();
+    g_kernel_profile_mutex = new mutex();
+    g_kernel_profile = new std::vector<std::unique_ptr<kernel_decl_profile>>();
+    g_kernel_profile_idx = new name_hash_map<size_t>();
     g_dont_care    = new expr(mk_const("dontcare"));
     mark_persistent(g_dont_care->raw());
     g_kernel_fresh = new name("_kernel_fresh");
@@ -1163,6 +1673,18 @@ void initialize_type_checker() {
     mark_persistent(g_nat_beq->raw());
     g_nat_ble      = new expr(mk_constant(name{"Nat", "ble"}));
     mark_persistent(g_nat_ble->raw());
+    g_nat_land     = new expr(mk_constant(name{"Nat", "land"}));
+    mark_persistent(g_nat_land->raw());
+    g_nat_lor      = new expr(mk_constant(name{"Nat", "lor"}));
+    mark_persistent(g_nat_lor->raw());
+    g_nat_xor      = new expr(mk_constant(name{"Nat", "xor"}));
+    mark_persistent(g_nat_xor->raw());
+    g_nat_shiftl   = new expr(mk_constant(name{"Nat", "shiftLeft"}));
+    mark_persistent(g_nat_shiftl->raw());
+    g_nat_shiftr   = new expr(mk_constant(name{"Nat", "shiftRight"}));
+    mark_persistent(g_nat_shiftr->raw());
+    g_nat_log2     = new expr(mk_constant(name{"Nat", "log2"}));
+    mark_persistent(g_nat_log2->raw());
     g_string_mk    = new expr(mk_constant(name{"String", "mk"}));
     mark_persistent(g_string_mk->raw());
     g_lean_reduce_bool = new expr(mk_constant(name{"Lean", "reduceBool"}));
@@ -1173,6 +1695,11 @@ void initialize_type_checker() {
 }
 
 void finalize_type_checker() {
+    delete g_shared_cache;
+    delete g_constant_type_cache;
+    delete g_kernel_profile_idx;
+    delete g_kernel_profile;
+    delete g_kernel_profile_mutex;
     delete g_dont_care;
     delete g_kernel_fresh;
     delete g_nat_succ;
@@ -1186,6 +1713,12 @@ void finalize_type_checker() {
     delete g_nat_mod;
     delete g_nat_beq;
     delete g_nat_ble;
+    delete g_nat_land;
+    delete g_nat_lor;
+    delete g_nat_xor;
+    delete g_nat_shiftl;
+    delete g_nat_shiftr;
+    delete g_nat_log2;
     delete g_string_mk;
     delete g_lean_reduce_bool;
     delete g_lean_reduce_nat;
@@ -9,29 +9,37 @@ Author: Leonardo de Moura
 #include <memory>
 #include <utility>
 #include <algorithm>
+#include <chrono>
 #include "util/lbool.h"
 #include "util/name_set.h"
 #include "util/name_generator.h"
 #include "kernel/environment.h"
 #include "kernel/local_ctx.h"
 #include "kernel/expr_maps.h"
+#include "kernel/expr_sets.h"
 #include "kernel/equiv_manager.h"
 
 namespace lean {
+struct kernel_decl_profile;
+
 /** \brief Lean Type Checker. It can also be used to infer types, check whether a
     type \c A is convertible to a type \c B, etc. */
 class type_checker {
 public:
     class state {
-        typedef expr_map<expr> infer_cache;
-        typedef std::unordered_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
+        typedef expr_flat_map<expr> infer_cache;
         environment               m_env;
         name_generator            m_ngen;
         infer_cache               m_infer_type[2];
-        expr_map<expr>            m_whnf_core;
-        expr_map<expr>            m_whnf;
+        expr_flat_map<expr>       m_whnf_core;
+        expr_flat_map<expr>       m_whnf;
         equiv_manager             m_eqv_manager;
-        expr_pair_set             m_failure;
+        expr_pair_flat_set        m_failure;
+        /* Memoizes whether a closed term only references imported constants, see `use_shared_cache`. */
+        expr_flat_map<bool>       m_imported_only;
+        /* Counters of the kernel profiler, `nullptr` if it is disabled. See `kernel_decl_scope`. */
+        kernel_decl_profile *     m_profile;
+        unsigned                  m_lazy_delta_depth = 0;
         friend type_checker;
     public:
         state(environment const & env);
@@ -47,6 +55,8 @@ private:
     /* When `m_lparams != nullptr, the `check` method makes sure all level parameters
        are in `m_lparams`. */
     names const *             m_lparams;
+    /* Structural equality checks remember the subterms proved equal while the type checker is alive. */
+    scoped_expr_eq_memo       m_eq_memo;
 
     expr ensure_sort_core(expr e, expr const & s);
     expr ensure_pi_core(expr e, expr const & s);
@@ -58,6 +68,8 @@ private:
     expr infer_app(expr const & e, bool infer_only);
     expr infer_proj(expr const & e, bool infer_only);
     expr infer_let(expr const & e, bool infer_only);
+    bool only_imported_consts(expr const & e);
+    bool use_shared_cache(expr const & e);
     expr infer_type_core(expr const & e, bool infer_only);
     expr infer_type(expr const & e);
 
@@ -98,6 +110,7 @@ private:
 
     template<typename F> optional<expr> reduce_bin_nat_op(F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_pred(F const & f, expr const & e);
+    template<typename F> optional<expr> reduce_bin_nat_exp_op(F const & f, expr const & e);
     optional<expr> reduce_nat(expr const & e);
 public:
     type_checker(state & st, local_ctx const & lctx, definition_safety ds = definition_safety::safe);
@@ -157,6 +170,60 @@ public:
     optional<expr> unfold_definition(expr const & e);
 };
 
+/** \brief Set the maximum number of entries of each kernel cache shared across declarations.
+    The caches store the results of type inference and weak head normalization of closed terms that
+    only reference imported constants. They are disabled (capacity 0) by default. */
+void set_kernel_cache_capacity(size_t capacity);
+/** \brief Display the hits and misses of the caches above and of the (always enabled) memo table
+    for the instantiated types of imported constants used by `infer_constant`. */
+void display_kernel_cache_stats(std::ostream & out);
+
+/** \brief Enable the kernel profiler. For each declaration, it counts how often each constant is delta-unfolded,
+    the lazy delta reduction steps, and the hits in the `equiv_manager` and the failure cache. */
+void set_kernel_profiler(bool enabled);
+/** \brief Display the data collected by the kernel profiler as a JSON object. */
+void display_kernel_profile(std::ostream & out);
+
+/** \brief Enable hash-consing (see `scoped_expr_hcons`) of the terms built by the kernel while checking a
+    declaration. It is disabled by default. */
+void set_kernel_hash_consing(bool enabled);
+
+/** \brief Kernel work of the current thread on the declaration `n`.
+    While an object of this class is alive, the work of the type checkers created by the current thread is
+    attributed to `n` if the kernel profiler is enabled, and the terms they build are hash-consed if kernel
+    hash-consing is enabled. The time spent in outermost scopes is displayed by `display_kernel_cache_stats`. */
+class kernel_decl_scope {
+    name                  m_decl;
+    kernel_decl_scope *   m_prev_scope;
+    kernel_decl_profile * m_profile;
+    kernel_decl_profile * m_prev;
+    bool                  m_outermost;
+    std::chrono::steady_clock::time_point m_start;
+    scoped_expr_hcons     m_hcons;
+    friend struct kernel_thread_context;
+public:
+    kernel_decl_scope(name const & n);
+    ~kernel_decl_scope();
+};
+
+/** \brief Kernel state of the current thread inherited by the helper threads it creates, see `kernel_worker_scope`. */
+struct kernel_thread_context {
+    /* Declaration of the innermost `kernel_decl_scope`, if any. */
+    optional<name>     m_decl;
+    lean_task_object * m_task;
+    kernel_thread_context();
+};
+
+/** \brief Kernel work of a helper thread on behalf of the thread that created `ctx`, which must wait for the helper
+    thread. The work is attributed to the same declaration (see `kernel_decl_scope`), and `check_interrupted` reports
+    the cancellation of the task executed by that thread. */
+class kernel_worker_scope {
+    scoped_inherited_task_cancellation m_cancel;
+    std::unique_ptr<kernel_decl_scope> m_scope;
+public:
+    explicit kernel_worker_scope(kernel_thread_context const & ctx);
+};
+
 void initialize_type_checker();
 void finalize_type_checker();
 }
@@ -31,6 +31,7 @@ Author: Leonardo de Moura
 #include "library/compiler/extern_attribute.h"
 #include "library/compiler/struct_cases_on.h"
 #include "library/compiler/ir.h"
+#include "library/compiler/compiler_cache.h"
 
 namespace lean {
 static name * g_extract_closed = nullptr;
@@ -200,30 +201,44 @@ environment compile(environment const & env, options const & opts, names cs) {
 
     comp_decls ds = to_comp_decls(env, cs);
     csimp_cfg cfg(opts);
+    compiler_cache cache(env, opts, cfg, ds);
+    if (optional<pair<environment, comp_decls>> r = cache.find()) {
+        /* The entries of matchers only contain their stage1 version, see below. */
+        if (is_matcher(r->first, r->second))
+            return r->first;
+        /* compile IR. */
+        return compile_ir(r->first, opts, r->second);
+    }
     // Use the following line to see compiler intermediate steps
     // scope_traces_as_string trace_scope;
     auto simp  = [&](environment const & env, expr const & e) { return csimp(env, e, cfg); };
     auto esimp = [&](environment const & env, expr const & e) { return cesimp(env, e, cfg); };
     trace_compiler(name({"compiler", "input"}), ds);
-    ds = apply(eta_expand, env, ds);
-    trace_compiler(name({"compiler", "eta_expand"}), ds);
-    ds = apply(to_lcnf, env, ds);
-    ds = apply(find_jp, env, ds);
-    // trace(ds);
-    trace_compiler(name({"compiler", "lcnf"}), ds);
-    // trace(ds);
-    ds = apply(cce, env, ds);
-    trace_compiler(name({"compiler", "cce"}), ds);
-    ds = apply(csimp_replace_constants, env, ds);
-    ds = apply(simp, env, ds);
-    trace_compiler(name({"compiler", "simp"}), ds);
-    // trace(ds);
     environment new_env = env;
-    std::tie(new_env, ds) = eager_lambda_lifting(new_env, ds, cfg);
-    trace_compiler(name({"compiler", "eager_lambda_lifting"}), ds);
-    ds = apply(max_sharing, ds);
-    trace_compiler(name({"compiler", "stage1"}), ds);
-    new_env = cache_stage1(new_env, ds);
+    {
+        time_task t("compilation: lcnf", opts);
+        ds = apply(eta_expand, env, ds);
+        trace_compiler(name({"compiler", "eta_expand"}), ds);
+        ds = apply(to_lcnf, env, ds);
+        ds = apply(find_jp, env, ds);
+        // trace(ds);
+        trace_compiler(name({"compiler", "lcnf"}), ds);
+        // trace(ds);
+        ds = apply(cce, env, ds);
+        trace_compiler(name({"compiler", "cce"}), ds);
+    }
+    {
+        time_task t("compilation: csimp", opts);
+        ds = apply(csimp_replace_constants, env, ds);
+        ds = apply(simp, env, ds);
+        trace_compiler(name({"compiler", "simp"}), ds);
+        // trace(ds);
+        std::tie(new_env, ds) = eager_lambda_lifting(new_env, ds, cfg);
+        trace_compiler(name({"compiler", "eager_lambda_lifting"}), ds);
+        ds = apply(max_sharing, ds);
+        trace_compiler(name({"compiler", "stage1"}), ds);
+        new_env = cache_stage1(new_env, ds);
+    }
     if (is_matcher(new_env, ds)) {
         /* Auxiliary matcher applications are marked as inlined, and are always fully applied
            (if users don't use them manually). So, we skip code generation for them.
@@ -231,44 +246,58 @@ environment compile(environment const & env, options const & opts, names cs) {
 
            TODO: we should have a "[strong_inline]" annotation that will inline a definition even
            when it is partially applied. Then, we can mark all `match` auxiliary functions as `[strong_inline]` */
+        cache.store(ds);
         return new_env;
     }
-    std::tie(new_env, ds) = specialize(new_env, ds, cfg);
-    // The following check is incorrect. It was exposed by issue #1812.
-    // We will not fix the check since we will delete the compiler.
-    // lean_assert(lcnf_check_let_decls(new_env, ds));
-    trace_compiler(name({"compiler", "specialize"}), ds);
-    ds = apply(elim_dead_let, ds);
-    trace_compiler(name({"compiler", "elim_dead_let"}), ds);
-    ds = apply(erase_irrelevant, new_env, ds);
-    trace_compiler(name({"compiler", "erase_irrelevant"}), ds);
-    ds = apply(struct_cases_on, new_env, ds);
-    trace_compiler(name({"compiler", "struct_cases_on"}), ds);
-    ds = apply(esimp, new_env, ds);
-    trace_compiler(name({"compiler", "simp"}), ds);
-    ds = reduce_arity(new_env, ds);
-    trace_compiler(name({"compiler", "reduce_arity"}), ds);
-    std::tie(new_env, ds) = lambda_lifting(new_env, ds);
-    trace_compiler(name({"compiler", "lambda_lifting"}), ds);
-    // trace(ds);
-    ds = apply(esimp, new_env, ds);
-    trace_compiler(name({"compiler", "simp"}), ds);
-    new_env = cache_stage2(new_env, ds);
-    trace_compiler(name({"compiler", "stage2"}), ds);
-    if (is_extract_closed_enabled(opts)) {
-        std::tie(new_env, ds) = extract_closed(new_env, ds);
+    {
+        time_task t("compilation: specialize", opts);
+        std::tie(new_env, ds) = specialize(new_env, ds, cfg);
+        // The following check is incorrect. It was exposed by issue #1812.
+        // We will not fix the check since we will delete the compiler.
+        // lean_assert(lcnf_check_let_decls(new_env, ds));
+        trace_compiler(name({"compiler", "specialize"}), ds);
         ds = apply(elim_dead_let, ds);
+        trace_compiler(name({"compiler", "elim_dead_let"}), ds);
+    }
+    {
+        time_task t("compilation: erase_irrelevant", opts);
+        ds = apply(erase_irrelevant, new_env, ds);
+        trace_compiler(name({"compiler", "erase_irrelevant"}), ds);
+        ds = apply(struct_cases_on, new_env, ds);
+        trace_compiler(name({"compiler", "struct_cases_on"}), ds);
+        ds = apply(esimp, new_env, ds);
+        trace_compiler(name({"compiler", "simp"}), ds);
+        ds = reduce_arity(new_env, ds);
+        trace_compiler(name({"compiler", "reduce_arity"}), ds);
+    }
+    {
+        time_task t("compilation: lambda_lifting", opts);
+        std::tie(new_env, ds) = lambda_lifting(new_env, ds);
+        trace_compiler(name({"compiler", "lambda_lifting"}), ds);
+        // trace(ds);
         ds = apply(esimp, new_env, ds);
-        trace_compiler(name({"compiler", "extract_closed"}), ds);
+        trace_compiler(name({"compiler", "simp"}), ds);
+        new_env = cache_stage2(new_env, ds);
+        trace_compiler(name({"compiler", "stage2"}), ds);
+    }
+    {
+        time_task t("compilation: extract_closed", opts);
+        if (is_extract_closed_enabled(opts)) {
+            std::tie(new_env, ds) = extract_closed(new_env, ds);
+            ds = apply(elim_dead_let, ds);
+            ds = apply(esimp, new_env, ds);
+            trace_compiler(name({"compiler", "extract_closed"}), ds);
+        }
+        new_env = cache_new_stage2(new_env, ds);
+        ds = apply(esimp, new_env, ds);
+        trace_compiler(name({"compiler", "simp"}), ds);
+        ds = apply(simp_app_args, new_env, ds);
+        ds = apply(ecse, new_env, ds);
+        ds = apply(elim_dead_let, ds);
+        trace_compiler(name({"compiler", "simp_app_args"}), ds);
     }
-    new_env = cache_new_stage2(new_env, ds);
-    ds = apply(esimp, new_env, ds);
-    trace_compiler(name({"compiler", "simp"}), ds);
-    ds = apply(simp_app_args, new_env, ds);
-    ds = apply(ecse, new_env, ds);
-    ds = apply(elim_dead_let, ds);
-    trace_compiler(name({"compiler", "simp_app_args"}), ds);
     // std::cout << trace_scope.get_string() << "\n";
+    cache.store(ds);
     /* compile IR. */
     return compile_ir(new_env, opts, ds);
 }
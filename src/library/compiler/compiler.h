@@ -7,6 +7,8 @@ Author: Leonardo de Moura
 #pragma once
 #include "kernel/environment.h"
 namespace lean {
+/** \brief Return true iff closed terms are extracted into auxiliary declarations (option `compiler.extract_closed`). */
+bool is_extract_closed_enabled(options const & opts);
 environment compile(environment const & env, options const & opts, names cs);
 inline environment compile(environment const & env, options const & opts, name const & c) {
     return compile(env, opts, names(c));
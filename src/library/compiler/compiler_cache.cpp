@@ -0,0 +1,507 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include "runtime/compact.h"
+#include "runtime/hash.h"
+#include "runtime/thread.h"
+#include "kernel/expr_eq_fn.h"
+#include "kernel/for_each_fn.h"
+#include "library/trace.h"
+#include "library/compiler/compiler.h"
+#include "library/compiler/compiler_cache.h"
+#include "library/compiler/closed_term_cache.h"
+#include "library/compiler/export_attribute.h"
+#include "library/compiler/extern_attribute.h"
+#include "library/compiler/implemented_by_attribute.h"
+#include "library/compiler/init_attribute.h"
+#include "library/compiler/specialize.h"
+#include "util/option_declarations.h"
+#include "githash.h" // NOLINT
+
+namespace lean {
+extern "C" uint64 lean_environment_imports_fingerprint(object * env);
+extern "C" object * lean_compiler_cache_imported_entries(object * env);
+extern "C" uint64 lean_compiler_cache_local_csimp_hash(object * env);
+extern "C" object * lean_cache_specialization(object * env, object * e, object * fn);
+extern "C" object * lean_add_specialization_info(object * env, object * fn, object * info);
+extern "C" object * lean_io_create_dir(b_obj_arg p, obj_arg w);
+extern "C" object * lean_io_rename(b_obj_arg from, b_obj_arg to, obj_arg w);
+
+static name * g_compiler_cache_dir = nullptr;
+static char const * g_compiler_cache_header = "leancompilercache";
+static std::atomic<unsigned> g_compiler_cache_hits(0);
+static std::atomic<unsigned> g_compiler_cache_misses(0);
+LEAN_THREAD_PTR(std::vector<object_ref>, g_recorded_ops);
+
+/* Environment updates stored in cache entries, see `replay`. */
+enum class env_op { Decl, ClosedTerm, Specialization, SpecInfo };
+
+static void record(env_op op, object_ref const & a, object_ref const & b = object_ref(box(0))) {
+    if (g_recorded_ops)
+        g_recorded_ops->push_back(mk_cnstr(static_cast<unsigned>(op), a, b));
+}
+
+void compiler_cache_record_decl(name const & n, declaration const & d) { record(env_op::Decl, d, n); }
+void compiler_cache_record_closed_term(expr const & e, name const & n) { record(env_op::ClosedTerm, e, n); }
+void compiler_cache_record_specialization(expr const & key, name const & fn) { record(env_op::Specialization, key, fn); }
+void compiler_cache_record_spec_info(name const & fn, object_ref const & info) { record(env_op::SpecInfo, fn, info); }
+
+static environment replay(environment const & env, object_ref const & op) {
+    object_ref const & a = cnstr_get_ref(op, 0);
+    object_ref const & b = cnstr_get_ref(op, 1);
+    switch (static_cast<env_op>(cnstr_tag(op.raw()))) {
+    case env_op::Decl:
+        return env.add(static_cast<declaration const &>(a), false);
+    case env_op::ClosedTerm:
+        return cache_closed_term_name(env, static_cast<expr const &>(a), static_cast<name const &>(b));
+    case env_op::Specialization:
+        return environment(lean_cache_specialization(env.to_obj_arg(), a.to_obj_arg(), b.to_obj_arg()));
+    case env_op::SpecInfo:
+        return environment(lean_add_specialization_info(env.to_obj_arg(), a.to_obj_arg(), b.to_obj_arg()));
+    }
+    lean_unreachable();
+}
+
+/** \brief Structural hash of an object graph that is stable across processes, used for the imported entries of
+    environment extensions. Shared subobjects are hashed only once. Closures and other objects that cannot occur in
+    `.olean` files are only hashed by their kind. */
+class object_hash_fn {
+    std::unordered_map<object *, uint64> m_cache;
+public:
+    uint64 operator()(object * o) {
+        if (is_scalar(o))
+            return unbox(o);
+        auto it = m_cache.find(o);
+        if (it != m_cache.end())
+            return it->second;
+        uint64 h = hash(lean_ptr_tag(o), lean_ptr_other(o));
+        switch (lean_ptr_tag(o)) {
+        case LeanArray:
+            for (size_t i = 0; i < array_size(o); i++)
+                h = hash(h, operator()(array_cptr(o)[i]));
+            break;
+        case LeanScalarArray:
+            h = hash_str(sarray_size(o) * sarray_elem_size(o), sarray_cptr(o), h);
+            break;
+        case LeanString:
+            h = hash_str(string_size(o), reinterpret_cast<unsigned char const *>(string_cstr(o)), h);
+            break;
+        case LeanMPZ: {
+            std::string s = mpz_value(o).to_string();
+            h = hash_str(s.size(), reinterpret_cast<unsigned char const *>(s.data()), h);
+            break;
+        }
+        default:
+            if (lean_ptr_tag(o) <= LeanMaxCtorTag) {
+                unsigned num_objs = lean_ctor_num_objs(o);
+                for (unsigned i = 0; i < num_objs; i++)
+                    h = hash(h, operator()(cnstr_get(o, i)));
+                // the scalar fields; see `lean_alloc_ctor_memory` for why the padding is initialized
+                unsigned char const * scalars = reinterpret_cast<unsigned char const *>(lean_ctor_obj_cptr(o) + num_objs);
+                size_t scalars_size = lean_object_byte_size(o) - (scalars - reinterpret_cast<unsigned char const *>(o));
+                h = hash_str(scalars_size, scalars, h);
+            }
+            break;
+        }
+        m_cache.insert(mk_pair(o, h));
+        return h;
+    }
+};
+
+/** \brief Copy an object graph of a compacted region to the heap, preserving sharing, so that the region can be freed.
+    Cache entries only contain constructor objects, arrays, strings, and numerals. */
+class copy_object_fn {
+    std::unordered_map<object *, object *> m_cache;
+public:
+    obj_res operator()(b_obj_arg o) {
+        if (is_scalar(o))
+            return o;
+        auto it = m_cache.find(o);
+        if (it != m_cache.end()) {
+            inc(it->second);
+            return it->second;
+        }
+        object * r;
+        switch (lean_ptr_tag(o)) {
+        case LeanArray: {
+            size_t sz = array_size(o);
+            r = alloc_array(sz, sz);
+            for (size_t i = 0; i < sz; i++)
+                array_cptr(r)[i] = operator()(array_cptr(o)[i]);
+            break;
+        }
+        case LeanScalarArray: {
+            size_t sz = sarray_size(o);
+            r = lean_alloc_sarray(sarray_elem_size(o), sz, sz);
+            std::memcpy(sarray_cptr(r), sarray_cptr(o), sz * sarray_elem_size(o));
+            break;
+        }
+        case LeanString: {
+            size_t sz = string_size(o);
+            r = lean_alloc_string(sz, sz, lean_string_len(o));
+            std::memcpy(lean_to_string(r)->m_data, string_cstr(o), sz);
+            break;
+        }
+        case LeanMPZ:
+            r = mk_nat_obj_core(mpz_value(o));
+            break;
+        default: {
+            if (lean_ptr_tag(o) > LeanMaxCtorTag)
+                throw exception("unexpected object in compiler cache entry");
+            unsigned num_objs = lean_ctor_num_objs(o);
+            char const * scalars = reinterpret_cast<char const *>(lean_ctor_obj_cptr(o) + num_objs);
+            size_t scalars_size = lean_object_byte_size(o) - (scalars - reinterpret_cast<char const *>(o));
+            r = lean_alloc_ctor(lean_ptr_tag(o), num_objs, scalars_size);
+            for (unsigned i = 0; i < num_objs; i++)
+                lean_ctor_set(r, i, operator()(cnstr_get(o, i)));
+            std::memcpy(lean_ctor_obj_cptr(r) + num_objs, scalars, scalars_size);
+            break;
+        }
+        }
+        // `o` is kept alive by the region, and `r` by its first parent
+        m_cache.insert(mk_pair(o, r));
+        return r;
+    }
+};
+
+/** \brief Fingerprints of the imported modules, which are expensive to compute, for the most recently used set of
+    imports (see `environment::get_imports_key`). Besides `Environment.importsFingerprint`, they include the contents
+    of the imported entries of the environment extensions used by the compiler stages. */
+class imports_fingerprint_cache {
+    mutex      m_mutex;
+    object_ref m_imports_key;
+    uint64     m_fingerprint = 0;
+public:
+    uint64 get(environment const & env) {
+        lock_guard<mutex> _(m_mutex);
+        if (m_imports_key.raw() != env.get_imports_key()) {
+            m_fingerprint = lean_environment_imports_fingerprint(env.to_obj_arg());
+            object_ref entries(lean_compiler_cache_imported_entries(env.to_obj_arg()));
+            m_fingerprint = hash(m_fingerprint, object_hash_fn()(entries.raw()));
+            m_imports_key = object_ref(env.get_imports_key(), true);
+        }
+        return m_fingerprint;
+    }
+};
+
+static imports_fingerprint_cache * g_imports_fingerprint_cache = nullptr;
+
+/** \brief Return the information about the declaration `n` of the current module the compiler stages may use: the types
+    and values of `n` and of its compiled versions, and its compiler attributes. It is stored in cache entries and
+    compared using `is_equal_local_decl_info` on a hit.
+
+    The result is a constructor object with the fields `n`, the list of expressions, a bit mask of the attributes and
+    of the presence of the optional parts, and the list of declaration names in attribute payloads. */
+static object_ref local_decl_info(environment const & env, name const & n) {
+    buffer<expr> es;
+    unsigned mask = 0;
+    unsigned bit  = 0;
+    for (name const & m : {n, mk_cstage1_name(n), mk_cstage2_name(n)}) {
+        if (optional<constant_info> info = env.find(m)) {
+            mask |= 1u << bit;
+            es.push_back(info->get_type());
+            if (info->has_value()) {
+                mask |= 2u << bit;
+                es.push_back(info->get_value());
+            }
+        }
+        bit += 2;
+    }
+    for (bool attr : {has_inline_attribute(env, n), has_noinline_attribute(env, n), has_inline_if_reduce_attribute(env, n),
+                      has_macro_inline_attribute(env, n), has_never_extract_attribute(env, n),
+                      has_specialize_attribute(env, n), has_nospecialize_attribute(env, n), is_extern_constant(env, n)}) {
+        mask |= static_cast<unsigned>(attr) << bit;
+        bit++;
+    }
+    // attributes with a declaration name as payload
+    buffer<name> ns;
+    for (optional<name> const & m : {get_implemented_by_attribute(env, n), get_init_fn_name_for(env, n),
+                                     get_export_name_for(env, n)}) {
+        if (m) {
+            mask |= 1u << bit;
+            ns.push_back(*m);
+        }
+        bit++;
+    }
+    return mk_cnstr(0, n, exprs(es), object_ref(box(mask)), names(ns));
+}
+
+static name const & local_decl_info_name(object_ref const & info) { return static_cast<name const &>(cnstr_get_ref(info, 0)); }
+static exprs const & local_decl_info_exprs(object_ref const & info) { return static_cast<exprs const &>(cnstr_get_ref(info, 1)); }
+static unsigned local_decl_info_mask(object_ref const & info) { return unbox(cnstr_get(info.raw(), 2)); }
+static names const & local_decl_info_names(object_ref const & info) { return static_cast<names const &>(cnstr_get_ref(info, 3)); }
+
+static uint64 local_decl_info_hash(object_ref const & info) {
+    uint64 h = hash(local_decl_info_name(info).hash(), local_decl_info_mask(info));
+    for (expr const & e : local_decl_info_exprs(info))
+        h = hash(h, hash(e));
+    for (name const & m : local_decl_info_names(info))
+        h = hash(h, m.hash());
+    return h;
+}
+
+/* The structural hash of expressions ignores metadata, binder names and binder information, and may collide. Thus, we
+   compare the expressions themselves, including these parts. */
+static bool is_equal_local_decl_info(object_ref const & info1, object_ref const & info2) {
+    if (local_decl_info_name(info1) != local_decl_info_name(info2) ||
+        local_decl_info_mask(info1) != local_decl_info_mask(info2) ||
+        local_decl_info_names(info1) != local_decl_info_names(info2))
+        return false;
+    exprs const & es1 = local_decl_info_exprs(info1);
+    exprs const & es2 = local_decl_info_exprs(info2);
+    return length(es1) == length(es2) && std::equal(es1.begin(), es1.end(), es2.begin(), is_bi_equal);
+}
+
+/** \brief Add the declarations of the current module occurring in `e` to `deps`, and, transitively, the ones occurring
+    in their (compiled) values, as the stages may inline them. */
+static void collect_local_deps(environment const & env, expr const & e, name_set & visited, buffer<name> & deps) {
+    buffer<expr> todo;
+    todo.push_back(e);
+    while (!todo.empty()) {
+        expr curr = todo.back();
+        todo.pop_back();
+        for_each(curr, [&](expr const & c, unsigned) {
+                if (!is_constant(c))
+                    return true;
+                name const & n = const_name(c);
+                if (visited.contains(n) || env.is_imported(n))
+                    return false;
+                visited.insert(n);
+                deps.push_back(n);
+                if (optional<constant_info> info = env.find(mk_cstage1_name(n)))
+                    todo.push_back(info->get_value());
+                else if (optional<constant_info> info = env.find(n))
+                    if (info->has_value())
+                        todo.push_back(info->get_value());
+                return false;
+            });
+    }
+}
+
+static bool is_equal_decls(comp_decls const & ds1, comp_decls const & ds2) {
+    if (length(ds1) != length(ds2))
+        return false;
+    auto it2 = ds2.begin();
+    for (comp_decl const & d1 : ds1) {
+        comp_decl const & d2 = *it2;
+        if (d1.fst() != d2.fst() || !is_bi_equal(d1.snd(), d2.snd()))
+            return false;
+        ++it2;
+    }
+    return true;
+}
+
+compiler_cache::compiler_cache(environment const & env, options const & opts, csimp_cfg const & cfg, comp_decls const & ds):
+    m_env(env), m_input(ds) {
+    char const * dir = opts.get_string(*g_compiler_cache_dir, "");
+    // traces of the stages are only produced when they are executed
+    if (!*dir || is_trace_enabled())
+        return;
+    m_enabled = true;
+    uint64 h = hash_str(std::strlen(LEAN_GITHASH), reinterpret_cast<unsigned char const *>(LEAN_GITHASH), 11);
+    h = hash(h, g_imports_fingerprint_cache->get(env));
+    h = hash(h, env.get_main_module().hash());
+    h = hash(h, is_extract_closed_enabled(opts));
+    h = hash(h, cfg.m_inline);
+    h = hash(h, cfg.m_inline_threshold);
+    h = hash(h, cfg.m_float_cases_threshold);
+    h = hash(h, cfg.m_inline_jp_threshold);
+    // `[csimp]` replacements apply to all constants, including the imported ones
+    h = hash(h, lean_compiler_cache_local_csimp_hash(env.to_obj_arg()));
+    name_set visited;
+    buffer<name> deps;
+    for (comp_decl const & d : ds) {
+        h = hash(h, hash(d.snd()));
+        // the attributes of the input declarations are relevant as well
+        if (!visited.contains(d.fst())) {
+            visited.insert(d.fst());
+            deps.push_back(d.fst());
+        }
+        collect_local_deps(env, d.snd(), visited, deps);
+    }
+    for (name const & n : deps) {
+        object_ref info = local_decl_info(env, n);
+        h = hash(h, local_decl_info_hash(info));
+        m_deps.push_back(info);
+    }
+    std::ostringstream path;
+    path << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << h;
+    m_path = path.str();
+}
+
+compiler_cache::~compiler_cache() {
+    if (m_recording)
+        g_recorded_ops = m_saved_ops;
+}
+
+/* Return true iff `entry` was computed from the same input, and the declarations of the current module it depends on
+   have not changed. */
+bool compiler_cache::is_valid(object_ref const & entry) const {
+    // the input is compared to rule out hash collisions
+    if (!is_equal_decls(static_cast<comp_decls const &>(cnstr_get_ref(entry, 0)), m_input))
+        return false;
+    for (object_ref const & dep : static_cast<list_ref<object_ref> const &>(cnstr_get_ref(entry, 1))) {
+        if (!is_equal_local_decl_info(dep, local_decl_info(m_env, local_decl_info_name(dep))))
+            return false;
+    }
+    return true;
+}
+
+optional<pair<environment, comp_decls>> compiler_cache::load() const {
+    std::ifstream in(m_path, std::ios_base::binary);
+    if (in.fail())
+        return optional<pair<environment, comp_decls>>();
+    in.seekg(0, in.end);
+    size_t size = in.tellg();
+    in.seekg(0);
+    size_t header_size = std::strlen(g_compiler_cache_header);
+    if (size <= header_size + 2 * sizeof(uint64))
+        return optional<pair<environment, comp_decls>>();
+    std::string header(header_size, ' ');
+    in.read(&header[0], header_size);
+    uint64 stored_size, checksum;
+    in.read(reinterpret_cast<char *>(&stored_size), sizeof(uint64));
+    in.read(reinterpret_cast<char *>(&checksum), sizeof(uint64));
+    size_t data_size = size - header_size - 2 * sizeof(uint64);
+    /* `compacted_region::read` trusts its input, so truncated or otherwise corrupted entries (e.g. after a crash or a
+       full disk) must be rejected before. */
+    if (!in || header != g_compiler_cache_header || stored_size != data_size || data_size % sizeof(void *) != 0)
+        return optional<pair<environment, comp_decls>>();
+    char * buffer = static_cast<char *>(malloc(data_size));
+    in.read(buffer, data_size);
+    if (!in || hash_str(data_size, reinterpret_cast<unsigned char const *>(buffer), 11) != checksum) {
+        free(buffer);
+        return optional<pair<environment, comp_decls>>();
+    }
+    environment env = m_env;
+    try {
+        object_ref entry;
+        {
+            compacted_region region(data_size, buffer, nullptr, false, [=]() { free(buffer); });
+            object * root = region.read();
+            if (!is_valid(object_ref(root, true)))
+                return optional<pair<environment, comp_decls>>();
+            /* The environment must not refer to the objects of the region, which would keep it alive forever. */
+            entry = object_ref(copy_object_fn()(root));
+        }
+        for (object_ref const & op : static_cast<list_ref<object_ref> const &>(cnstr_get_ref(entry, 2))) {
+            // auxiliary declarations must still be fresh
+            if (static_cast<env_op>(cnstr_tag(op.raw())) == env_op::Decl &&
+                env.find(static_cast<name const &>(cnstr_get_ref(op, 1))))
+                return optional<pair<environment, comp_decls>>();
+            env = replay(env, op);
+        }
+        return optional<pair<environment, comp_decls>>(mk_pair(env, static_cast<comp_decls const &>(cnstr_get_ref(entry, 3))));
+    } catch (exception &) {
+        return optional<pair<environment, comp_decls>>();
+    }
+}
+
+optional<pair<environment, comp_decls>> compiler_cache::find() {
+    if (!m_enabled)
+        return optional<pair<environment, comp_decls>>();
+    if (optional<pair<environment, comp_decls>> r = load()) {
+        g_compiler_cache_hits++;
+        return r;
+    }
+    g_compiler_cache_misses++;
+    m_recording = true;
+    m_saved_ops = g_recorded_ops;
+    g_recorded_ops = &m_ops;
+    return optional<pair<environment, comp_decls>>();
+}
+
+void compiler_cache::store(comp_decls const & ds) {
+    if (!m_recording)
+        return;
+    g_recorded_ops = m_saved_ops;
+    m_recording = false;
+    /* The results may also refer to auxiliary declarations created when compiling other declarations, such as closed
+       terms and specializations, which must not have changed either. */
+    name_set visited;
+    for (object_ref const & dep : m_deps)
+        visited.insert(local_decl_info_name(dep));
+    for (object_ref const & op : m_ops) {
+        if (static_cast<env_op>(cnstr_tag(op.raw())) == env_op::Decl)
+            visited.insert(static_cast<name const &>(cnstr_get_ref(op, 1)));
+    }
+    buffer<object_ref> deps(m_deps);
+    auto add_deps = [&](expr const & e) {
+        for_each(e, [&](expr const & c, unsigned) {
+                if (is_constant(c) && !visited.contains(const_name(c)) && !m_env.is_imported(const_name(c))) {
+                    visited.insert(const_name(c));
+                    deps.push_back(local_decl_info(m_env, const_name(c)));
+                }
+                return true;
+            });
+    };
+    for (comp_decl const & d : ds)
+        add_deps(d.snd());
+    for (object_ref const & op : m_ops) {
+        if (static_cast<env_op>(cnstr_tag(op.raw())) == env_op::Decl) {
+            declaration const & d = static_cast<declaration const &>(cnstr_get_ref(op, 0));
+            if (d.is_definition()) {
+                add_deps(d.to_definition_val().get_type());
+                add_deps(d.to_definition_val().get_value());
+            } else if (d.is_axiom()) {
+                add_deps(d.to_axiom_val().get_type());
+            }
+        }
+    }
+    object_ref entry = mk_cnstr(0, m_input, list_ref<object_ref>(deps.begin(), deps.end()),
+                                list_ref<object_ref>(m_ops.begin(), m_ops.end()), ds);
+    object_compactor compactor;
+    compactor(entry.raw());
+    std::string dir = m_path.substr(0, m_path.rfind('/'));
+    object_ref(lean_io_create_dir(string_ref(dir).raw(), io_mk_world()));
+    /* Write to a temporary file first, so that concurrent readers never see partially written entries. */
+    std::ostringstream tmp_path;
+    tmp_path << m_path << ".tmp" << std::hex << std::random_device()();
+    std::ofstream out(tmp_path.str(), std::ios_base::binary);
+    if (out.fail())
+        return;
+    uint64 data_size = compactor.size();
+    uint64 checksum = hash_str(compactor.size(), static_cast<unsigned char const *>(compactor.data()), 11);
+    out.write(g_compiler_cache_header, std::strlen(g_compiler_cache_header));
+    out.write(reinterpret_cast<char const *>(&data_size), sizeof(uint64));
+    out.write(reinterpret_cast<char const *>(&checksum), sizeof(uint64));
+    out.write(static_cast<char const *>(compactor.data()), compactor.size());
+    out.close();
+    if (out.fail()) {
+        std::remove(tmp_path.str().c_str());
+        return;
+    }
+    object_ref(lean_io_rename(string_ref(tmp_path.str()).raw(), string_ref(m_path).raw(), io_mk_world()));
+}
+
+void display_compiler_cache_stats(std::ostream & out) {
+    unsigned hits = g_compiler_cache_hits, misses = g_compiler_cache_misses;
+    if (hits + misses == 0)
+        return;
+    out << "compiler cache: " << hits << " hits, " << misses << " misses\n";
+}
+
+void initialize_compiler_cache() {
+    g_compiler_cache_dir = new name{"compiler", "cache_dir"};
+    mark_persistent(g_compiler_cache_dir->raw());
+    register_option(*g_compiler_cache_dir, {}, data_value_kind::String, "",
+                    "(compiler) directory of the persistent cache for the compiler stages, disabled if empty");
+    g_imports_fingerprint_cache = new imports_fingerprint_cache();
+}
+
+void finalize_compiler_cache() {
+    delete g_imports_fingerprint_cache;
+    delete g_compiler_cache_dir;
+}
+}
@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <iostream>
+#include <vector>
+#include "kernel/environment.h"
+#include "library/compiler/util.h"
+#include "library/compiler/csimp.h"
+
+namespace lean {
+/** \brief Persistent cache for the compiler stages from `lcnf` to `extract_closed` (see `compile`), enabled by
+    setting the option `compiler.cache_dir`.
+
+    An entry is keyed by a hash of the input declarations, the compiler configuration, the imported modules, and the
+    declarations of the current module the input may depend on. Since the hash may collide, the entry also contains
+    the input and these declarations, which are compared with the current ones on a hit. Besides the resulting declarations, it contains the
+    updates the stages made to the environment (auxiliary declarations, closed terms, specializations), which are
+    replayed on a hit. The entries are serialized using `object_compactor`, and stored with their size and a checksum,
+    so that truncated or corrupted files are treated as misses. */
+class compiler_cache {
+    environment             m_env;
+    bool                    m_enabled = false;
+    std::string             m_path;
+    comp_decls              m_input;
+    buffer<object_ref>      m_deps;
+    std::vector<object_ref> m_ops;
+    std::vector<object_ref> * m_saved_ops = nullptr;
+    bool                    m_recording = false;
+    bool is_valid(object_ref const & entry) const;
+    optional<pair<environment, comp_decls>> load() const;
+public:
+    compiler_cache(environment const & env, options const & opts, csimp_cfg const & cfg, comp_decls const & ds);
+    ~compiler_cache();
+    /** \brief Return the environment and the declarations produced by the cached stages if there is a valid entry.
+        Otherwise, start recording the updates made to the environment. */
+    optional<pair<environment, comp_decls>> find();
+    /** \brief Store the declarations `ds` produced by the stages and the recorded environment updates. */
+    void store(comp_decls const & ds);
+};
+
+/* The following functions record updates of the environment performed by the compiler stages for `compiler_cache`.
+   They do nothing when no entry is being computed. */
+void compiler_cache_record_decl(name const & n, declaration const & d);
+void compiler_cache_record_closed_term(expr const & e, name const & n);
+void compiler_cache_record_specialization(expr const & key, name const & fn);
+void compiler_cache_record_spec_info(name const & fn, object_ref const & info);
+
+/** \brief Display the number of hits and misses of the compiler cache, if it was used. */
+void display_compiler_cache_stats(std::ostream & out);
+
+void initialize_compiler_cache();
+void finalize_compiler_cache();
+}
@@ -13,6 +13,7 @@ Author: Leonardo de Moura
 #include "library/trace.h"
 #include "library/class.h"
 #include "library/compiler/util.h"
+#include "library/compiler/compiler_cache.h"
 #include "library/compiler/csimp.h"
 #include "library/compiler/closed_term_cache.h"
 
@@ -239,6 +240,7 @@ class eager_lambda_lifting_fn {
                other definitions that use `n`.
                We used a similar hack at `specialize.cpp`. */
             declaration aux_ax = mk_axiom(n, names(), type, true /* meta */);
+            compiler_cache_record_decl(n, aux_ax);
             m_st.env() = env().add(aux_ax, false);
             m_new_decls.push_back(comp_decl(n, code));
             return mk_app(mk_constant(n), new_params);
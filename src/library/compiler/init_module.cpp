@@ -11,10 +11,12 @@ Author: Leonardo de Moura
 #include "library/compiler/specialize.h"
 #include "library/compiler/llnf.h"
 #include "library/compiler/compiler.h"
+#include "library/compiler/compiler_cache.h"
 #include "library/compiler/borrowed_annotation.h"
 #include "library/compiler/ll_infer_type.h"
 #include "library/compiler/ir.h"
 #include "library/compiler/ir_interpreter.h"
+#include "library/compiler/ir_jit.h"
 
 namespace lean {
 void initialize_compiler_module() {
@@ -25,17 +27,21 @@ void initialize_compiler_module() {
     initialize_specialize();
     initialize_llnf();
     initialize_compiler();
+    initialize_compiler_cache();
     initialize_borrowed_annotation();
     initialize_ll_infer_type();
     initialize_ir();
     initialize_ir_interpreter();
+    initialize_ir_jit();
 }
 
 void finalize_compiler_module() {
+    finalize_ir_jit();
     finalize_ir_interpreter();
     finalize_ir();
     finalize_ll_infer_type();
     finalize_borrowed_annotation();
+    finalize_compiler_cache();
     finalize_compiler();
     finalize_llnf();
     finalize_specialize();
@@ -10,22 +10,33 @@ Motivation
 ==========
 
 Even with a JIT compiler, we still have a need for a simpler interpreter on platforms LLVM JIT does not support (i.e.
-WebAssembly). Because this is mostly an edge case, we strive for simplicity instead of performance and thus reuse the
-existing compiler IR instead of inventing something like a new bytecode format.
+WebAssembly). The interpreter is also used for all code of the current module, which is not compiled yet. We first
+implemented it by walking the compiler IR directly, which is simple but spends most of its time on decoding the IR
+objects. Thus, declarations are now translated into a simple bytecode on first use (see "Bytecode" below); the
+tree-walking interpreter is kept behind the option `interpreter.bytecode` for debugging and comparison.
 
 Implementation
 ==============
 
 The interpreter mainly consists of a homogeneous stack of `value`s, which are either unboxed values or pointers to boxed
 objects. The IR type system tells us which union member is active at any time. IR variables are mapped to stack
-slots by adding the current base pointer to the variable index. Further stacks are used for storing join points and call
-stack metadata. The interpreted IR is taken directly from the environment. Whenever possible, we try to switch to native
+slots by adding the current base pointer to the variable index. Further stacks are used for storing join points (only
+by the tree-walking interpreter) and call stack metadata. The interpreted IR is taken directly from the environment. Whenever possible, we try to switch to native
 code by checking for the mangled symbol via dlsym/GetProcAddress, which is also how we can call external functions
 (which only works if the file declaring them has already been compiled). We always call the "boxed" versions of native
 functions, which have a (relatively) homogeneous ABI that we can use without runtime code generation; see also
-`call/lookup_symbol` below.
+`call/lookup_symbol` below. Symbol lookups and values of nullary functions are cached per interpreter and, for imported
+declarations, in a cache shared by all interpreters and threads; see `shared_interpreter_cache` below. When Lean is
+built with `LLVM_JIT`, declarations of the current module that are called more than `interpreter.jit_threshold` times
+are compiled to native code together with their local dependencies, which is then used by all interpreters; see
+`jit_cache` below.
 
 */
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 #ifdef LEAN_WINDOWS
@@ -40,17 +51,37 @@ functions, which have a (relatively) homogeneous ABI that we can use without run
 #include "runtime/io.h"
 #include "runtime/option_ref.h"
 #include "runtime/array_ref.h"
+#include "runtime/thread.h"
 #include "library/time_task.h"
 #include "library/trace.h"
 #include "library/compiler/ir.h"
 #include "library/compiler/init_attribute.h"
+#include "library/compiler/ir_jit.h"
 #include "util/nat.h"
+#include "util/name_hash_map.h"
 #include "util/option_declarations.h"
 
 #ifndef LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE
 #define LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE true
 #endif
 
+#ifndef LEAN_DEFAULT_INTERPRETER_BYTECODE
+#define LEAN_DEFAULT_INTERPRETER_BYTECODE true
+#endif
+
+#ifndef LEAN_DEFAULT_INTERPRETER_JIT_THRESHOLD
+#ifdef LEAN_LLVM_JIT
+#define LEAN_DEFAULT_INTERPRETER_JIT_THRESHOLD 1000
+#else
+#define LEAN_DEFAULT_INTERPRETER_JIT_THRESHOLD 0
+#endif
+#endif
+
+// maximal number of declarations compiled together by the JIT
+#ifndef LEAN_JIT_MAX_DECLS
+#define LEAN_JIT_MAX_DECLS 256
+#endif
+
 namespace lean {
 namespace ir {
 // C++ wrappers of Lean data types
@@ -191,6 +222,8 @@ static string_ref * g_mangle_prefix = nullptr;
 static string_ref * g_boxed_suffix = nullptr;
 static string_ref * g_boxed_mangled_suffix = nullptr;
 static name * g_interpreter_prefer_native = nullptr;
+static name * g_interpreter_bytecode = nullptr;
+static name * g_interpreter_jit_threshold = nullptr;
 
 // constants (lacking native declarations) initialized by `lean_run_init`
 static name_map<object *> * g_init_globals;
@@ -319,6 +352,673 @@ void * lookup_symbol_in_cur_exe(char const * sym) {
 #endif
 }
 
+struct constant_cache_entry {
+    bool m_is_scalar;
+    value m_val;
+};
+
+struct symbol_cache_entry {
+    decl m_decl;
+    // symbol address; `nullptr` if function does not have native code
+    void * m_addr;
+    // true iff we chose the boxed version of a function where the IR uses the unboxed version
+    bool m_boxed;
+};
+
+/** \brief Symbol lookups and values of nullary functions ("constants") of imported declarations, shared by all
+    interpreter instances and threads.
+
+    The IR of an imported declaration is the same in all environments created from the same `import_modules` call, so,
+    as in the kernel's shared caches, the entries are valid for all environments with the same imports key (see
+    `environment::get_imports_key`), and the cache is cleared when it is used with different imports. The symbol
+    entries store the result of the native symbol lookup independently of `interpreter.prefer_native`, which is
+    applied by each interpreter. Constant values are marked as multi-threaded and the cache holds a reference to them,
+    which is released when the cache is cleared. */
+class shared_interpreter_cache {
+    mutex    m_mutex;
+    object * m_imports_key = nullptr;
+    name_hash_map<symbol_cache_entry>   m_symbols;
+    name_hash_map<constant_cache_entry> m_constants;
+
+    /* \pre `m_mutex` is locked */
+    void clear_constants() {
+        for (auto const & p : m_constants) {
+            if (!p.second.m_is_scalar)
+                dec(p.second.m_val.m_obj);
+        }
+        m_constants.clear();
+    }
+
+    /* \pre `m_mutex` is locked */
+    void set_imports(environment const & env) {
+        object * key = env.get_imports_key();
+        if (m_imports_key != key) {
+            m_symbols.clear();
+            clear_constants();
+            if (m_imports_key)
+                dec(m_imports_key);
+            mark_mt(key);
+            inc(key);
+            m_imports_key = key;
+        }
+    }
+public:
+    ~shared_interpreter_cache() {
+        clear_constants();
+        if (m_imports_key)
+            dec(m_imports_key);
+    }
+
+    bool find_symbol(environment const & env, name const & fn, symbol_cache_entry & r) {
+        lock_guard<mutex> _(m_mutex);
+        if (m_imports_key != env.get_imports_key())
+            return false;
+        auto it = m_symbols.find(fn);
+        if (it == m_symbols.end())
+            return false;
+        r = it->second;
+        return true;
+    }
+
+    void insert_symbol(environment const & env, name const & fn, symbol_cache_entry const & e) {
+        lock_guard<mutex> _(m_mutex);
+        set_imports(env);
+        mark_mt(fn.raw());
+        mark_mt(e.m_decl.raw());
+        m_symbols.insert(mk_pair(fn, e));
+    }
+
+    /* If the value of `fn` is in the cache, store it in `r`, and return true. The caller owns a reference to it. */
+    bool find_constant(environment const & env, name const & fn, constant_cache_entry & r) {
+        lock_guard<mutex> _(m_mutex);
+        if (m_imports_key != env.get_imports_key())
+            return false;
+        auto it = m_constants.find(fn);
+        if (it == m_constants.end())
+            return false;
+        r = it->second;
+        if (!r.m_is_scalar)
+            inc(r.m_val.m_obj);
+        return true;
+    }
+
+    /* Store the value `e` of `fn`. The cache takes its own reference to it.
+       \pre `e.m_val` is a scalar or has been marked as multi-threaded. */
+    void insert_constant(environment const & env, name const & fn, constant_cache_entry const & e) {
+        lock_guard<mutex> _(m_mutex);
+        set_imports(env);
+        mark_mt(fn.raw());
+        if (m_constants.insert(mk_pair(fn, e)).second && !e.m_is_scalar)
+            inc(e.m_val.m_obj);
+    }
+};
+
+static shared_interpreter_cache * g_shared_interpreter_cache = nullptr;
+
+/** \brief Native code of declarations of the current module compiled by the JIT, shared by all interpreter instances
+    and threads. The entries are keyed by the declaration object, which they keep alive, as different environments may
+    contain different declarations of the same name. */
+class jit_cache {
+    mutex m_mutex;
+    std::unordered_map<object *, symbol_cache_entry> m_entries;
+public:
+    bool find(decl const & d, symbol_cache_entry & r) {
+        lock_guard<mutex> _(m_mutex);
+        auto it = m_entries.find(d.raw());
+        if (it == m_entries.end())
+            return false;
+        r = it->second;
+        return true;
+    }
+
+    void insert(symbol_cache_entry const & e) {
+        lock_guard<mutex> _(m_mutex);
+        mark_mt(e.m_decl.raw());
+        m_entries.insert(mk_pair(e.m_decl.raw(), e));
+    }
+};
+
+static jit_cache * g_jit_cache = nullptr;
+
+/*
+Bytecode
+========
+
+Before a declaration is interpreted for the first time, its body is translated into a flat array of instructions. The
+translation resolves everything that does not depend on runtime values: variable indices are converted into stack
+slot offsets, join points into instruction offsets, `case` alternatives into tables indexed by constructor tag, and
+numeric literals of unboxed types into values. Callees are looked up on the first execution of a call instruction and
+the result is stored in the instruction, so declarations that are never called are never looked up.
+
+A frame consists of `m_frame_size` slots. The parameters are stored in the first slots, and the last one always
+contains `box(0)`, which is used for irrelevant arguments. In debug builds, the first instruction emitted for an IR
+instruction points back to it, so that `trace.interpreter.step` shows the same output as with the tree-walking
+interpreter, except for join point declarations, which do not produce any instruction.
+*/
+enum class opcode : uint8 {
+    // `x := e` instructions, storing their result at slot `m_dst`
+    Ctor, Reset, Reuse, Proj, UProj, SProj, FAp, Load, PAp, Ap, Box, Unbox, LitVal, LitObj, IsShared, IsTaggedPtr,
+    // other instructions
+    TailCall, Set, SetTag, USet, SSet, Inc, Dec, Del, Case, Ret, Jmp, Unreachable, Invalid
+};
+
+/** \brief Decoded `ctor_info` */
+struct ctor_desc {
+    size_t m_tag;
+    size_t m_size;
+    size_t m_usize;
+    size_t m_ssize;
+};
+
+struct code;
+
+/** \brief Callee of a `FAp`, `Load` or `PAp` instruction, resolved on the first execution. */
+struct call_site {
+    name               m_fn;
+    bool               m_resolved = false;
+    symbol_cache_entry m_sym;
+    // bytecode of the callee if it is interpreted, translated on the first call
+    code *             m_code = nullptr;
+    // value of a nullary function once it is in the interpreter's constant cache
+    bool               m_has_const = false;
+    constant_cache_entry m_const;
+    explicit call_site(name const & fn):m_fn(fn) {}
+};
+
+/** \brief Branch targets of a `Case` instruction. */
+struct case_table {
+    static constexpr unsigned no_target = std::numeric_limits<unsigned>::max();
+    std::vector<unsigned> m_targets; // indexed by tag
+    unsigned              m_default = no_target;
+    unsigned get(unsigned tag) const {
+        return tag < m_targets.size() ? m_targets[tag] : m_default;
+    }
+};
+// `std::vector::resize` takes `no_target` by reference, so it needs a definition in C++14
+constexpr unsigned case_table::no_target;
+
+/** \brief Bytecode instruction. The meaning of the fields depends on the opcode, see `bytecode_compiler`. */
+struct instr {
+    opcode   m_op;
+    type     m_type = type::Irrelevant;
+    bool     m_flag = false;
+    unsigned m_dst  = 0;
+    unsigned m_a    = 0;
+    unsigned m_n    = 0;
+    // arguments: `m_nargs` slots starting at `code::m_args[m_args]`
+    unsigned m_args  = 0;
+    unsigned m_nargs = 0;
+    void *   m_aux  = nullptr;
+    value    m_val;
+    // IR instruction this instruction starts, used for `trace.interpreter.step`
+    DEBUG_CODE(fn_body const * m_ir = nullptr;)
+    explicit instr(opcode op):m_op(op) {}
+};
+
+struct code {
+    // keeps the IR objects referenced by the instructions alive
+    decl                   m_decl;
+    name                   m_fn;
+    unsigned               m_frame_size = 0;
+    // slot containing `box(0)`
+    unsigned               m_irrelevant = 0;
+    std::vector<instr>     m_instrs;
+    std::vector<unsigned>  m_args;
+    // the instructions point to the elements of these containers, which must not be moved
+    std::deque<ctor_desc>  m_ctors;
+    std::deque<call_site>  m_calls;
+    std::deque<case_table> m_cases;
+    // number of calls, used for deciding when to compile the declaration with the JIT
+    unsigned               m_num_calls = 0;
+    // native code compiled by the JIT, if any
+    symbol_cache_entry     m_jit { decl(), nullptr, false };
+    explicit code(decl const & d):m_decl(d), m_fn(decl_fun_id(d)) {}
+};
+
+/** \brief Translation of a declaration into bytecode.
+
+    `x := e` instructions:
+    - `Ctor`: `m_aux` is a `ctor_desc`, the arguments are the fields.
+    - `Reset`: `m_a` is the object, `m_n` the number of object fields.
+    - `Reuse`: `m_a` is the object, `m_aux` a `ctor_desc`, `m_flag` is true if the tag must be updated.
+    - `Proj`/`UProj`/`SProj`: `m_a` is the object, `m_n` the index or, for `SProj`, the byte offset.
+    - `FAp`/`Load`/`PAp`: `m_aux` is a `call_site`. `Load` is used for nullary functions.
+    - `Ap`: `m_a` is the closure.
+    - `Box`: `m_a` is the value and `m_type` its type. `Unbox`: `m_a` is the object.
+    - `LitVal`: `m_val` is the value. `LitObj`: `m_aux` is the object.
+    - `IsShared`/`IsTaggedPtr`: `m_a` is the object.
+    Other instructions:
+    - `TailCall`: the arguments are copied to the parameters, and execution restarts at the first instruction.
+    - `Set`/`USet`/`SSet`: `m_dst` is the object, `m_n` the index or byte offset, `m_a` the value.
+    - `SetTag`: `m_dst` is the object, `m_n` the tag.
+    - `Inc`/`Dec`: `m_a` is the object, `m_n` the amount. `Del`: `m_a` is the object.
+    - `Case`: `m_a` is the scrutinee, `m_flag` is true if it is unboxed, `m_aux` is a `case_table`.
+    - `Ret`: `m_a` is the result.
+    - `Jmp`: `m_n` is the target, the arguments are followed by the `m_nargs` parameters of the join point.
+    - `Unreachable`, `Invalid`: throw an exception, `m_aux` is the message of `Invalid`. */
+class bytecode_compiler {
+    code & m_code;
+    // join points in scope: IR index and index into `m_jps`
+    std::vector<std::pair<size_t, unsigned>> m_scope;
+    struct jp_info {
+        std::vector<unsigned> m_params;
+        unsigned              m_pc = 0;
+    };
+    std::vector<jp_info> m_jps;
+    // `Jmp` instructions and the join point they jump to
+    std::vector<std::pair<unsigned, unsigned>> m_jmps;
+    // IR instruction being compiled, attached to the first instruction emitted for it
+    DEBUG_CODE(fn_body const * m_ir = nullptr;)
+
+    static size_t max_var(fn_body const & b0) {
+        size_t r = 0;
+        fn_body const * b = &b0;
+        while (true) {
+            switch (fn_body_tag(*b)) {
+                case fn_body_kind::VDecl:
+                    r = std::max(r, fn_body_vdecl_var(*b).get_small_value());
+                    b = &fn_body_vdecl_cont(*b);
+                    break;
+                case fn_body_kind::JDecl:
+                    for (param const & p : fn_body_jdecl_params(*b))
+                        r = std::max(r, param_var(p).get_small_value());
+                    r = std::max(r, max_var(fn_body_jdecl_body(*b)));
+                    b = &fn_body_jdecl_cont(*b);
+                    break;
+                case fn_body_kind::Set: b = &fn_body_set_cont(*b); break;
+                case fn_body_kind::SetTag: b = &fn_body_set_tag_cont(*b); break;
+                case fn_body_kind::USet: b = &fn_body_uset_cont(*b); break;
+                case fn_body_kind::SSet: b = &fn_body_sset_cont(*b); break;
+                case fn_body_kind::Inc: b = &fn_body_inc_cont(*b); break;
+                case fn_body_kind::Dec: b = &fn_body_dec_cont(*b); break;
+                case fn_body_kind::Del: b = &fn_body_del_cont(*b); break;
+                case fn_body_kind::MData: b = &fn_body_mdata_cont(*b); break;
+                case fn_body_kind::Case:
+                    for (alt_core const & a : fn_body_case_alts(*b))
+                        r = std::max(r, max_var(alt_core_tag(a) == alt_core_kind::Ctor ? alt_core_ctor_cont(a) : alt_core_default_cont(a)));
+                    return r;
+                case fn_body_kind::Ret: case fn_body_kind::Jmp: case fn_body_kind::Unreachable:
+                    return r;
+            }
+        }
+    }
+
+    // variables are 1-indexed
+    static unsigned slot(var_id const & x) { return x.get_small_value() - 1; }
+    unsigned arg_slot(arg const & a) { return arg_is_irrelevant(a) ? m_code.m_irrelevant : slot(arg_var_id(a)); }
+    unsigned pc() const { return m_code.m_instrs.size(); }
+
+    instr & emit(opcode op) {
+        m_code.m_instrs.emplace_back(op);
+        DEBUG_CODE({
+            m_code.m_instrs.back().m_ir = m_ir;
+            m_ir = nullptr;
+        });
+        return m_code.m_instrs.back();
+    }
+
+    instr & emit(opcode op, array_ref<arg> const & args) {
+        unsigned offset = m_code.m_args.size();
+        for (arg const & a : args)
+            m_code.m_args.push_back(arg_slot(a));
+        instr & i = emit(op);
+        i.m_args  = offset;
+        i.m_nargs = args.size();
+        return i;
+    }
+
+    void emit_invalid(char const * msg) {
+        emit(opcode::Invalid).m_aux = const_cast<char *>(msg);
+    }
+
+    ctor_desc * mk_ctor_desc(ctor_info const & c) {
+        m_code.m_ctors.push_back(ctor_desc { ctor_info_tag(c).get_small_value(), ctor_info_size(c).get_small_value(),
+                                             ctor_info_usize(c).get_small_value(), ctor_info_ssize(c).get_small_value() });
+        return &m_code.m_ctors.back();
+    }
+
+    call_site * mk_call_site(name const & fn) {
+        m_code.m_calls.emplace_back(fn);
+        return &m_code.m_calls.back();
+    }
+
+    static bool is_unboxed_sfield_type(type t) {
+        return t == type::Float || t == type::UInt8 || t == type::UInt16 || t == type::UInt32 || t == type::UInt64;
+    }
+
+    void compile_lit(unsigned dst, lit_val const & l, type t) {
+        if (lit_val_tag(l) == lit_val_kind::Str) {
+            instr & i = emit(opcode::LitObj);
+            i.m_dst = dst;
+            i.m_aux = lit_val_str(l).raw();
+            return;
+        }
+        nat const & n = lit_val_num(l);
+        value v;
+        switch (t) {
+            case type::Float:
+                lean_inc(n.raw());
+                v = value::from_float(lean_float_of_nat(n.raw()));
+                break;
+            case type::UInt8:
+            case type::UInt16:
+            case type::UInt32:
+            case type::USize:
+                v = lean_usize_of_nat(n.raw());
+                break;
+            case type::UInt64:
+                v = lean_uint64_of_nat(n.raw());
+                break;
+            // `nat` literal
+            case type::Object:
+            case type::TObject: {
+                instr & i = emit(opcode::LitObj);
+                i.m_dst = dst;
+                i.m_aux = n.raw();
+                return;
+            }
+            case type::Irrelevant:
+                emit_invalid("invalid instruction");
+                return;
+        }
+        instr & i = emit(opcode::LitVal);
+        i.m_dst = dst;
+        i.m_val = v;
+    }
+
+    void compile_vdecl(fn_body const & b) {
+        unsigned dst = slot(fn_body_vdecl_var(b));
+        type t = fn_body_vdecl_type(b);
+        expr const & e = fn_body_vdecl_expr(b);
+        switch (expr_tag(e)) {
+            case expr_kind::Ctor: {
+                instr & i = emit(opcode::Ctor, expr_ctor_args(e));
+                i.m_dst = dst;
+                i.m_aux = mk_ctor_desc(expr_ctor_info(e));
+                return;
+            }
+            case expr_kind::Reset: {
+                instr & i = emit(opcode::Reset);
+                i.m_dst = dst;
+                i.m_a   = slot(expr_reset_obj(e));
+                i.m_n   = expr_reset_num_objs(e).get_small_value();
+                return;
+            }
+            case expr_kind::Reuse: {
+                ctor_desc * c = mk_ctor_desc(expr_reuse_ctor(e));
+                instr & i = emit(opcode::Reuse, expr_reuse_args(e));
+                i.m_dst  = dst;
+                i.m_a    = slot(expr_reuse_obj(e));
+                i.m_aux  = c;
+                i.m_flag = expr_reuse_update_header(e);
+                return;
+            }
+            case expr_kind::Proj: {
+                instr & i = emit(opcode::Proj);
+                i.m_dst = dst;
+                i.m_a   = slot(expr_proj_obj(e));
+                i.m_n   = expr_proj_idx(e).get_small_value();
+                return;
+            }
+            case expr_kind::UProj: {
+                instr & i = emit(opcode::UProj);
+                i.m_dst = dst;
+                i.m_a   = slot(expr_uproj_obj(e));
+                i.m_n   = expr_uproj_idx(e).get_small_value();
+                return;
+            }
+            case expr_kind::SProj: {
+                if (!is_unboxed_sfield_type(t)) {
+                    emit_invalid("invalid instruction");
+                    return;
+                }
+                instr & i = emit(opcode::SProj);
+                i.m_dst  = dst;
+                i.m_a    = slot(expr_sproj_obj(e));
+                i.m_n    = expr_sproj_idx(e).get_small_value() * sizeof(void *) + expr_sproj_offset(e).get_small_value();
+                i.m_type = t;
+                return;
+            }
+            case expr_kind::FAp: {
+                call_site * cs = mk_call_site(expr_fap_fun(e));
+                if (expr_fap_args(e).size()) {
+                    instr & i = emit(opcode::FAp, expr_fap_args(e));
+                    i.m_dst = dst;
+                    i.m_aux = cs;
+                } else {
+                    // nullary function ("constant")
+                    instr & i = emit(opcode::Load);
+                    i.m_dst  = dst;
+                    i.m_aux  = cs;
+                    i.m_type = t;
+                }
+                return;
+            }
+            case expr_kind::PAp: {
+                call_site * cs = mk_call_site(expr_pap_fun(e));
+                instr & i = emit(opcode::PAp, expr_pap_args(e));
+                i.m_dst = dst;
+                i.m_aux = cs;
+                return;
+            }
+            case expr_kind::Ap: {
+                instr & i = emit(opcode::Ap, expr_ap_args(e));
+                i.m_dst = dst;
+                i.m_a   = slot(expr_ap_fun(e));
+                return;
+            }
+            case expr_kind::Box: {
+                instr & i = emit(opcode::Box);
+                i.m_dst  = dst;
+                i.m_a    = slot(expr_box_obj(e));
+                i.m_type = expr_box_type(e);
+                return;
+            }
+            case expr_kind::Unbox: {
+                instr & i = emit(opcode::Unbox);
+                i.m_dst  = dst;
+                i.m_a    = slot(expr_unbox_obj(e));
+                i.m_type = t;
+                return;
+            }
+            case expr_kind::Lit:
+                compile_lit(dst, expr_lit_val(e), t);
+                return;
+            case expr_kind::IsShared: {
+                instr & i = emit(opcode::IsShared);
+                i.m_dst = dst;
+                i.m_a   = slot(expr_is_shared_obj(e));
+                return;
+            }
+            case expr_kind::IsTaggedPtr: {
+                instr & i = emit(opcode::IsTaggedPtr);
+                i.m_dst = dst;
+                i.m_a   = slot(expr_is_tagged_ptr_obj(e));
+                return;
+            }
+        }
+        emit_invalid("unexpected instruction kind");
+    }
+
+    /** \brief Return true if `b` is `x := f ys; ret x` where `f` is the declaration being compiled. */
+    bool is_tail_call(fn_body const & b) {
+        expr const & e = fn_body_vdecl_expr(b);
+        fn_body const & cont = fn_body_vdecl_cont(b);
+        return
+            expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == m_code.m_fn &&
+            fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
+            arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b);
+    }
+
+    void compile_case(fn_body const & b) {
+        m_code.m_cases.emplace_back();
+        case_table & tbl = m_code.m_cases.back();
+        {
+            instr & i = emit(opcode::Case);
+            i.m_a    = slot(fn_body_case_var(b));
+            i.m_flag = type_is_scalar(fn_body_case_var_type(b));
+            i.m_aux  = &tbl;
+        }
+        // the first matching alternative is taken
+        for (alt_core const & a : fn_body_case_alts(b)) {
+            if (alt_core_tag(a) == alt_core_kind::Ctor) {
+                size_t tag = ctor_info_tag(alt_core_ctor_info(a)).get_small_value();
+                if (tag >= tbl.m_targets.size())
+                    tbl.m_targets.resize(tag + 1, case_table::no_target);
+                if (tbl.m_targets[tag] == case_table::no_target) {
+                    tbl.m_targets[tag] = pc();
+                    compile(alt_core_ctor_cont(a));
+                }
+            } else {
+                tbl.m_default = pc();
+                for (unsigned & t : tbl.m_targets) {
+                    if (t == case_table::no_target)
+                        t = tbl.m_default;
+                }
+                compile(alt_core_default_cont(a));
+                break;
+            }
+        }
+    }
+
+    void compile_core(fn_body const & b0) {
+        fn_body const * b = &b0;
+        while (true) {
+            DEBUG_CODE(m_ir = b;)
+            switch (fn_body_tag(*b)) {
+                case fn_body_kind::VDecl:
+                    if (is_tail_call(*b)) {
+                        emit(opcode::TailCall, expr_fap_args(fn_body_vdecl_expr(*b)));
+                        return;
+                    }
+                    compile_vdecl(*b);
+                    b = &fn_body_vdecl_cont(*b);
+                    break;
+                case fn_body_kind::JDecl: {
+                    unsigned idx = m_jps.size();
+                    m_jps.emplace_back();
+                    for (param const & p : fn_body_jdecl_params(*b))
+                        m_jps[idx].m_params.push_back(slot(param_var(p)));
+                    // the body of the join point is placed after the continuation, with the join points of the
+                    // enclosing scope
+                    auto outer = m_scope;
+                    m_scope.emplace_back(fn_body_jdecl_id(*b).get_small_value(), idx);
+                    compile(fn_body_jdecl_cont(*b));
+                    m_scope = outer;
+                    m_jps[idx].m_pc = pc();
+                    compile(fn_body_jdecl_body(*b));
+                    return;
+                }
+                case fn_body_kind::Set: {
+                    instr & i = emit(opcode::Set);
+                    i.m_dst = slot(fn_body_set_var(*b));
+                    i.m_n   = fn_body_set_idx(*b).get_small_value();
+                    i.m_a   = arg_slot(fn_body_set_arg(*b));
+                    b = &fn_body_set_cont(*b);
+                    break;
+                }
+                case fn_body_kind::SetTag: {
+                    instr & i = emit(opcode::SetTag);
+                    i.m_dst = slot(fn_body_set_tag_var(*b));
+                    i.m_n   = fn_body_set_tag_cidx(*b).get_small_value();
+                    b = &fn_body_set_tag_cont(*b);
+                    break;
+                }
+                case fn_body_kind::USet: {
+                    instr & i = emit(opcode::USet);
+                    i.m_dst = slot(fn_body_uset_target(*b));
+                    i.m_n   = fn_body_uset_idx(*b).get_small_value();
+                    i.m_a   = slot(fn_body_uset_source(*b));
+                    b = &fn_body_uset_cont(*b);
+                    break;
+                }
+                case fn_body_kind::SSet: {
+                    if (!is_unboxed_sfield_type(fn_body_sset_type(*b))) {
+                        emit_invalid("invalid instruction");
+                        return;
+                    }
+                    instr & i = emit(opcode::SSet);
+                    i.m_dst  = slot(fn_body_sset_target(*b));
+                    i.m_n    = fn_body_sset_idx(*b).get_small_value() * sizeof(void *) + fn_body_sset_offset(*b).get_small_value();
+                    i.m_a    = slot(fn_body_sset_source(*b));
+                    i.m_type = fn_body_sset_type(*b);
+                    b = &fn_body_sset_cont(*b);
+                    break;
+                }
+                case fn_body_kind::Inc: {
+                    instr & i = emit(opcode::Inc);
+                    i.m_a = slot(fn_body_inc_var(*b));
+                    i.m_n = fn_body_inc_val(*b).get_small_value();
+                    b = &fn_body_inc_cont(*b);
+                    break;
+                }
+                case fn_body_kind::Dec: {
+                    instr & i = emit(opcode::Dec);
+                    i.m_a = slot(fn_body_dec_var(*b));
+                    i.m_n = fn_body_dec_val(*b).get_small_value();
+                    b = &fn_body_dec_cont(*b);
+                    break;
+                }
+                case fn_body_kind::Del:
+                    emit(opcode::Del).m_a = slot(fn_body_del_var(*b));
+                    b = &fn_body_del_cont(*b);
+                    break;
+                case fn_body_kind::MData:
+                    b = &fn_body_mdata_cont(*b);
+                    break;
+                case fn_body_kind::Case:
+                    compile_case(*b);
+                    return;
+                case fn_body_kind::Ret:
+                    emit(opcode::Ret).m_a = arg_slot(fn_body_ret_arg(*b));
+                    return;
+                case fn_body_kind::Jmp: {
+                    size_t id = fn_body_jmp_jp(*b).get_small_value();
+                    auto it = std::find_if(m_scope.rbegin(), m_scope.rend(), [&](std::pair<size_t, unsigned> const & p) { return p.first == id; });
+                    if (it == m_scope.rend()) {
+                        emit_invalid("unknown join point");
+                        return;
+                    }
+                    jp_info const & jp = m_jps[it->second];
+                    if (jp.m_params.size() != fn_body_jmp_args(*b).size()) {
+                        emit_invalid("invalid instruction");
+                        return;
+                    }
+                    m_jmps.emplace_back(pc(), it->second);
+                    emit(opcode::Jmp, fn_body_jmp_args(*b));
+                    for (unsigned p : jp.m_params)
+                        m_code.m_args.push_back(p);
+                    return;
+                }
+                case fn_body_kind::Unreachable:
+                    emit(opcode::Unreachable);
+                    return;
+            }
+        }
+    }
+
+    void compile(fn_body const & b) {
+        auto saved = m_scope;
+        compile_core(b);
+        m_scope = saved;
+    }
+
+public:
+    explicit bytecode_compiler(code & c):m_code(c) {}
+
+    void operator()() {
+        fn_body const & body = decl_fun_body(m_code.m_decl);
+        size_t n = max_var(body);
+        for (param const & p : decl_params(m_code.m_decl))
+            n = std::max(n, param_var(p).get_small_value());
+        m_code.m_irrelevant = n;
+        m_code.m_frame_size = n + 1;
+        compile(body);
+        for (auto const & j : m_jmps)
+            m_code.m_instrs[j.first].m_n = m_jps[j.second].m_pc;
+    }
+};
+
 class interpreter;
 LEAN_THREAD_PTR(interpreter, g_interpreter);
 
@@ -340,21 +1040,16 @@ class interpreter {
     options const & m_opts;
     // if `false`, use IR code where possible
     bool m_prefer_native;
-    struct constant_cache_entry {
-      bool m_is_scalar;
-      value m_val;
-    };
+    // if `false`, use the tree-walking interpreter
+    bool m_bytecode;
+    // number of calls after which a declaration is compiled with the JIT; `0` if disabled
+    unsigned m_jit_threshold;
     // caches values of nullary functions ("constants")
     name_map<constant_cache_entry> m_constant_cache;
-    struct symbol_cache_entry {
-        decl m_decl;
-        // symbol address; `nullptr` if function does not have native code
-        void * m_addr;
-        // true iff we chose the boxed version of a function where the IR uses the unboxed version
-        bool m_boxed;
-    };
     // caches symbol lookup successes _and_ failures
     name_map<symbol_cache_entry> m_symbol_cache;
+    // bytecode of interpreted declarations
+    name_hash_map<std::unique_ptr<code>> m_code_cache;
 
     /** \brief Get current stack frame */
     inline frame & get_frame() {
@@ -759,18 +1454,33 @@ private:
         if (symbol_cache_entry const * e = m_symbol_cache.find(fn)) {
             return *e;
         } else {
-            symbol_cache_entry e_new { get_decl(fn), nullptr, false };
-            if (m_prefer_native || decl_tag(e_new.m_decl) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
-                string_ref mangled = name_mangle(fn, *g_mangle_prefix);
-                string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
-                // check for boxed version first
-                if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
-                    e_new.m_addr = p_boxed;
-                    e_new.m_boxed = true;
-                } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
-                    // if there is no boxed version, there are no unboxed parameters, so use default version
-                    e_new.m_addr = p;
+            symbol_cache_entry e_new;
+            bool imported = m_env.is_imported(fn);
+            if (!imported || !g_shared_interpreter_cache->find_symbol(m_env, fn, e_new)) {
+                e_new = symbol_cache_entry { get_decl(fn), nullptr, false };
+                // symbols of imported declarations are looked up eagerly as the result is shared
+                if (imported || m_prefer_native || decl_tag(e_new.m_decl) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
+                    string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+                    string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+                    // check for boxed version first
+                    if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
+                        e_new.m_addr = p_boxed;
+                        e_new.m_boxed = true;
+                    } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
+                        // if there is no boxed version, there are no unboxed parameters, so use default version
+                        e_new.m_addr = p;
+                    }
                 }
+                if (imported)
+                    g_shared_interpreter_cache->insert_symbol(m_env, fn, e_new);
+            }
+            if (e_new.m_addr && !m_prefer_native && decl_tag(e_new.m_decl) != decl_kind::Extern && !has_init_attribute(m_env, fn)) {
+                e_new.m_addr  = nullptr;
+                e_new.m_boxed = false;
+            }
+            if (!e_new.m_addr && !imported && m_jit_threshold) {
+                // may have been compiled by another interpreter
+                g_jit_cache->find(e_new.m_decl, e_new);
             }
             m_symbol_cache.insert(fn, e_new);
             return e_new;
@@ -823,60 +1533,561 @@ private:
             // We don't know whether `[init]` decls can be re-executed, so let's not.
             throw exception(sstream() << "cannot evaluate `[init]` declaration '" << fn << "' in the same module");
         }
-        push_frame(e.m_decl, m_arg_stack.size());
-        value r = eval_body(decl_fun_body(e.m_decl));
+        bool imported = m_env.is_imported(fn);
+        if (imported) {
+            constant_cache_entry c;
+            if (g_shared_interpreter_cache->find_constant(m_env, fn, c)) {
+                // `find_constant` returns the reference owned by `m_constant_cache`
+                m_constant_cache.insert(fn, c);
+                if (!c.m_is_scalar)
+                    inc(c.m_val.m_obj);
+                return c.m_val;
+            }
+        }
+        size_t bp = m_arg_stack.size();
+        push_frame(e.m_decl, bp);
+        value r = eval_decl_body(e.m_decl, bp);
         pop_frame(r, decl_type(e.m_decl));
-        if (!type_is_scalar(t)) {
+        constant_cache_entry c { type_is_scalar(t), r };
+        if (!c.m_is_scalar) {
+            if (imported) {
+                // `r` was created by this thread, so no other thread can access the objects it marks
+                mark_mt(r.m_obj);
+            }
             inc(r.m_obj);
         }
-        m_constant_cache.insert(fn, constant_cache_entry { type_is_scalar(t), r });
+        if (imported)
+            g_shared_interpreter_cache->insert_constant(m_env, fn, c);
+        m_constant_cache.insert(fn, c);
         return r;
     }
 
-    value call(name const & fn, array_ref<arg> const & args) {
-        size_t old_size = m_arg_stack.size();
+    [[noreturn]] void throw_missing_extern(name const & fn) {
+        string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+        string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+        throw exception(sstream() << "could not find native implementation of external declaration '" << fn
+                                  << "' (symbols '" << boxed_mangled.data() << "' or '" << mangled.data() << "')");
+    }
+
+    /** \brief Call the native code of `e` with `n` arguments, where `get_arg(i)` returns the value of the `i`-th one. */
+    template<class F>
+    value call_native(symbol_cache_entry const & e, unsigned n, F const & get_arg) {
+        object ** args2 = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+        for (unsigned i = 0; i < n; i++) {
+            type t = param_type(decl_params(e.m_decl)[i]);
+            args2[i] = box_t(get_arg(i), t);
+            if (e.m_boxed && param_borrow(decl_params(e.m_decl)[i])) {
+                // NOTE: If we chose the boxed version where the IR chose the unboxed one, we need to manually increment
+                // originally borrowed parameters because the wrapper will decrement these after the call.
+                // Basically the wrapper is more homogeneous (removing both unboxed and borrowed parameters) than we
+                // would need in this instance.
+                inc(args2[i]);
+            }
+        }
+        push_frame(e.m_decl, m_arg_stack.size());
+        object * o = curry(e.m_addr, n, args2);
+        type t = decl_type(e.m_decl);
         value r;
+        if (type_is_scalar(t)) {
+            lean_assert(e.m_boxed);
+            // NOTE: this unboxing does not exist in the IR, so we should manually consume `o`
+            r = unbox_t(o, t);
+            lean_dec(o);
+        } else {
+            r = o;
+        }
+        pop_frame(r, t);
+        return r;
+    }
+
+    value call(name const & fn, array_ref<arg> const & args) {
         symbol_cache_entry e = lookup_symbol(fn);
         if (e.m_addr) {
-            object ** args2 = static_cast<object **>(LEAN_ALLOCA(args.size() * sizeof(object *))); // NOLINT
-            for (size_t i = 0; i < args.size(); i++) {
-                type t = param_type(decl_params(e.m_decl)[i]);
-                args2[i] = box_t(eval_arg(args[i]), t);
-                if (e.m_boxed && param_borrow(decl_params(e.m_decl)[i])) {
-                    // NOTE: If we chose the boxed version where the IR chose the unboxed one, we need to manually increment
-                    // originally borrowed parameters because the wrapper will decrement these after the call.
-                    // Basically the wrapper is more homogeneous (removing both unboxed and borrowed parameters) than we
-                    // would need in this instance.
-                    inc(args2[i]);
-                }
+            return call_native(e, args.size(), [&](unsigned i) { return eval_arg(args[i]); });
+        }
+        if (decl_tag(e.m_decl) == decl_kind::Extern) {
+            throw_missing_extern(fn);
+        }
+        size_t old_size = m_arg_stack.size();
+        // evaluate args in old stack frame
+        for (const auto & arg : args) {
+            m_arg_stack.push_back(eval_arg(arg));
+        }
+        push_frame(e.m_decl, old_size);
+        value r = eval_decl_body(e.m_decl, old_size);
+        pop_frame(r, decl_type(e.m_decl));
+        return r;
+    }
+
+    /** \brief Return the bytecode of the given declaration, translating it on first use. */
+    code & get_code(decl const & d) {
+        name const & fn = decl_fun_id(d);
+        auto it = m_code_cache.find(fn);
+        if (it != m_code_cache.end())
+            return *it->second;
+        std::unique_ptr<code> c(new code(d));
+        bytecode_compiler compiler(*c);
+        compiler();
+        code & r = *c;
+        m_code_cache.emplace(fn, std::move(c));
+        return r;
+    }
+
+    /** \brief Evaluate the body of `d`, whose arguments are stored starting at `bp`. */
+    value eval_decl_body(decl const & d, size_t bp) {
+        if (m_bytecode) {
+            code & c = get_code(d);
+            count_call(c);
+            if (c.m_jit.m_addr) {
+                return call_native(c.m_jit, decl_params(d).size(), [&](unsigned i) { return m_arg_stack[bp + i]; });
             }
-            push_frame(e.m_decl, old_size);
-            object * o = curry(e.m_addr, args.size(), args2);
-            type t = decl_type(e.m_decl);
-            if (type_is_scalar(t)) {
-                lean_assert(e.m_boxed);
-                // NOTE: this unboxing does not exist in the IR, so we should manually consume `o`
-                r = unbox_t(o, t);
-                lean_dec(o);
+            return enter(c, bp);
+        } else {
+            return eval_body(decl_fun_body(d));
+        }
+    }
+
+    /** \brief Record a call of `c`, and compile it with the JIT if it reached the threshold. */
+    void count_call(code & c) {
+        if (m_jit_threshold && ++c.m_num_calls == m_jit_threshold)
+            jit(c);
+    }
+
+    /** \brief Add the declarations of the current module that are needed for compiling `d` with the JIT to `fns`,
+        and the nullary functions ("constants", e.g. extracted closed terms) of the current module they use to
+        `consts`. Return false if `d` cannot be compiled: the module initializer is not run for JIT code, so it must not
+        use `[init]` or external declarations of the current module, and declarations of other modules must have native
+        code. The values of the constants are computed by the interpreter instead, see `set_jit_constants`. */
+    bool collect_jit_decls(decl const & d, name_set & visited, buffer<name> & fns, buffer<name> & consts) {
+        name const & fn = decl_fun_id(d);
+        if (visited.contains(fn))
+            return true;
+        visited.insert(fn);
+        if (decl_tag(d) != decl_kind::Fun || has_init_attribute(m_env, fn) || fns.size() >= LEAN_JIT_MAX_DECLS)
+            return false;
+        if (decl_params(d).size() == 0) {
+            consts.push_back(fn);
+            return true;
+        }
+        fns.push_back(fn);
+        if (option_ref<decl> d_boxed = find_ir_decl(m_env, fn + *g_boxed_suffix)) {
+            if (!collect_jit_decls(*d_boxed.get(), visited, fns, consts))
+                return false;
+        }
+        for (call_site const & cs : get_code(d).m_calls) {
+            if (visited.contains(cs.m_fn))
+                continue;
+            if (m_env.is_imported(cs.m_fn)) {
+                visited.insert(cs.m_fn);
+                decl callee = get_decl(cs.m_fn);
+                // the C names of external declarations are resolved in the current process by the JIT
+                if (decl_tag(callee) != decl_kind::Extern &&
+                    !lookup_symbol_in_cur_exe(name_mangle(cs.m_fn, *g_mangle_prefix).data()))
+                    return false;
+            } else if (!collect_jit_decls(get_decl(cs.m_fn), visited, fns, consts)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** \brief Store the values of the constants `consts` into their global variables in `dylib`. The values are
+        evaluated by the interpreter, and, like the native code, they are never freed. */
+    void set_jit_constants(jit_dylib * dylib, buffer<name> const & consts) {
+        for (name const & fn : consts) {
+            string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+            void * addr = jit_lookup(dylib, mangled.data());
+            if (!addr)
+                throw exception(sstream() << "JIT compilation failed, missing constant '" << fn << "'");
+            type t = decl_type(get_decl(fn));
+            value v = load(fn, t);
+            switch (t) {
+                case type::Float: *static_cast<double *>(addr) = v.m_float; break;
+                case type::UInt8: *static_cast<uint8 *>(addr) = v.m_num; break;
+                case type::UInt16: *static_cast<uint16 *>(addr) = v.m_num; break;
+                case type::UInt32: *static_cast<uint32 *>(addr) = v.m_num; break;
+                case type::UInt64: *static_cast<uint64 *>(addr) = v.m_num; break;
+                case type::USize: *static_cast<size_t *>(addr) = v.m_num; break;
+                case type::Object:
+                case type::TObject:
+                case type::Irrelevant:
+                    // the native code may run in any thread
+                    mark_mt(v.m_obj);
+                    *static_cast<object **>(addr) = v.m_obj;
+                    break;
+            }
+        }
+    }
+
+    /** \brief Compile the declaration of `c` and the declarations of the current module it uses with the JIT. On
+        success, the native code is used by all call sites and interpreters. */
+    void jit(code & c) {
+        if (!jit_supported() || m_env.is_imported(c.m_fn))
+            return;
+        if (g_jit_cache->find(c.m_decl, c.m_jit))
+            return;
+        // constants are evaluated by `set_jit_constants`, not compiled
+        if (decl_params(c.m_decl).size() == 0)
+            return;
+        name_set visited;
+        buffer<name> fns, consts;
+        if (!collect_jit_decls(c.m_decl, visited, fns, consts))
+            return;
+        jit_dylib * dylib;
+        try {
+            dylib = jit_compile(m_env, fns, consts);
+            set_jit_constants(dylib, consts);
+        } catch (exception & ex) {
+            DEBUG_CODE(lean_trace(name({"interpreter", "jit"}), tout() << c.m_fn << ": " << ex.what() << "\n";);)
+            return;
+        }
+        for (name const & fn : fns) {
+            symbol_cache_entry e { get_decl(fn), nullptr, false };
+            string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+            string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+            // as in `lookup_symbol`, prefer the boxed version
+            if (void * p_boxed = jit_lookup(dylib, boxed_mangled.data())) {
+                e.m_addr  = p_boxed;
+                e.m_boxed = true;
+            } else if (void * p = jit_lookup(dylib, mangled.data())) {
+                e.m_addr = p;
             } else {
-                r = o;
+                continue;
             }
+            g_jit_cache->insert(e);
+            m_symbol_cache.insert(fn, e);
+            auto it = m_code_cache.find(fn);
+            if (it != m_code_cache.end())
+                it->second->m_jit = e;
+        }
+        DEBUG_CODE(lean_trace(name({"interpreter", "jit"}), tout() << c.m_fn << ": compiled " << fns.size() << " declarations\n";);)
+    }
+
+    value enter(code & c, size_t bp) {
+        m_arg_stack.resize(bp + c.m_frame_size);
+        // an "irrelevant" argument is type- or proof-erased; we can use an arbitrary value for it
+        m_arg_stack[bp + c.m_irrelevant] = box(0);
+        return run(c, bp);
+    }
+
+    /** \brief Resolve the callee of a call site. */
+    void resolve(call_site & cs) {
+        if (!cs.m_resolved) {
+            cs.m_sym      = lookup_symbol(cs.m_fn);
+            cs.m_resolved = true;
+        }
+    }
+
+    /** \brief Call the bytecode of `cs` with the arguments `args` of the frame at `bp`. */
+    value call_code(call_site & cs, unsigned const * args, unsigned nargs, size_t bp) {
+        if (!cs.m_code)
+            cs.m_code = &get_code(cs.m_sym.m_decl);
+        count_call(*cs.m_code);
+        if (cs.m_code->m_jit.m_addr) {
+            // use the native code from now on
+            cs.m_sym = cs.m_code->m_jit;
+            return call_native(cs.m_sym, nargs, [&](unsigned i) { return m_arg_stack[bp + args[i]]; });
+        }
+        size_t new_bp = m_arg_stack.size();
+        for (unsigned i = 0; i < nargs; i++) {
+            value v = m_arg_stack[bp + args[i]];
+            m_arg_stack.push_back(v);
+        }
+        push_frame(cs.m_sym.m_decl, new_bp);
+        value r = enter(*cs.m_code, new_bp);
+        pop_frame(r, decl_type(cs.m_sym.m_decl));
+        return r;
+    }
+
+    /** \brief Copy the values of the slots `src` to the slots `dst`, or to the parameter slots if `dst` is `nullptr`.
+        The slots may overlap. */
+    void move_args(unsigned const * src, unsigned const * dst, unsigned n, size_t bp) {
+        value * vals = static_cast<value *>(LEAN_ALLOCA(n * sizeof(value))); // NOLINT
+        for (unsigned j = 0; j < n; j++)
+            vals[j] = m_arg_stack[bp + src[j]];
+        for (unsigned j = 0; j < n; j++)
+            m_arg_stack[bp + (dst ? dst[j] : j)] = vals[j];
+    }
+
+    object * mk_pap(call_site & cs, unsigned const * args, unsigned n, size_t bp) {
+        if (cs.m_sym.m_addr) {
+            // point closure directly at native symbol
+            object * cls = alloc_closure(cs.m_sym.m_addr, decl_params(cs.m_sym.m_decl).size(), n);
+            for (unsigned j = 0; j < n; j++)
+                closure_set(cls, j, m_arg_stack[bp + args[j]].m_obj);
+            return cls;
         } else {
-            if (decl_tag(e.m_decl) == decl_kind::Extern) {
-                string_ref mangled = name_mangle(fn, *g_mangle_prefix);
-                string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
-                throw exception(sstream() << "could not find native implementation of external declaration '" << fn
-                                          << "' (symbols '" << boxed_mangled.data() << "' or '" << mangled.data() << "')");
+            // point closure at interpreter stub
+            object ** objs = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+            for (unsigned j = 0; j < n; j++)
+                objs[j] = m_arg_stack[bp + args[j]].m_obj;
+            return mk_stub_closure(cs.m_sym.m_decl, n, objs);
+        }
+    }
+
+    object * apply_closure(object * f, unsigned const * args, unsigned n, size_t bp) {
+        object ** objs = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+        for (unsigned j = 0; j < n; j++)
+            objs[j] = m_arg_stack[bp + args[j]].m_obj;
+        return apply_n(f, n, objs);
+    }
+
+#ifdef LEAN_DEBUG
+    /** \brief Trace the IR instruction starting at `i`, as `eval_body` does. */
+    void trace_step(instr const & i) {
+        if (i.m_ir)
+            lean_trace(name({"interpreter", "step"}),
+                       tout() << std::string(m_call_stack.size(), ' ') << format_fn_body_head(*i.m_ir) << "\n";);
+    }
+
+    /** \brief Trace the value of the variable declared by the IR instruction starting at `i`, if any. */
+    void trace_result(instr const & i, size_t bp) {
+        if (i.m_ir && fn_body_tag(*i.m_ir) == fn_body_kind::VDecl)
+            lean_trace(name({"interpreter", "step"}),
+                       tout() << std::string(m_call_stack.size(), ' ') << "=> x_";
+                       tout() << fn_body_vdecl_var(*i.m_ir).get_small_value() << " = ";
+                       print_value(tout(), m_arg_stack[bp + i.m_dst], fn_body_vdecl_type(*i.m_ir));
+                       tout() << "\n";);
+    }
+#endif
+
+    value run(code & c, size_t bp) {
+        check_system();
+        instr const * const instrs = c.m_instrs.data();
+        unsigned const * const cargs = c.m_args.data();
+        instr const * i = instrs;
+        // NOTE: the stack may be resized by calls, so we must not keep references into it
+#define SLOT(idx) m_arg_stack[bp + (idx)]
+#define ARG(j) SLOT(cargs[i->m_args + (j)])
+#if defined(__GNUC__)
+        // threaded dispatch
+        static void * const labels[] = {
+            &&L_Ctor, &&L_Reset, &&L_Reuse, &&L_Proj, &&L_UProj, &&L_SProj, &&L_FAp, &&L_Load, &&L_PAp, &&L_Ap,
+            &&L_Box, &&L_Unbox, &&L_LitVal, &&L_LitObj, &&L_IsShared, &&L_IsTaggedPtr, &&L_TailCall, &&L_Set,
+            &&L_SetTag, &&L_USet, &&L_SSet, &&L_Inc, &&L_Dec, &&L_Del, &&L_Case, &&L_Ret, &&L_Jmp, &&L_Unreachable,
+            &&L_Invalid
+        };
+#define DISPATCH() { DEBUG_CODE(trace_step(*i);) goto *labels[static_cast<unsigned>(i->m_op)]; }
+#define CASE(op) L_##op:
+        DISPATCH();
+        {
+#else
+#define DISPATCH() goto dispatch
+#define CASE(op) case opcode::op:
+      dispatch:
+        DEBUG_CODE(trace_step(*i);)
+        switch (i->m_op) {
+#endif
+#define NEXT() { DEBUG_CODE(trace_result(*i, bp);) ++i; DISPATCH(); }
+#define JUMP(pc) { i = instrs + (pc); DISPATCH(); }
+        CASE(Ctor) {
+            ctor_desc const & d = *static_cast<ctor_desc const *>(i->m_aux);
+            if (d.m_size == 0 && d.m_usize == 0 && d.m_ssize == 0) {
+                // a constructor without data is optimized to a tagged pointer
+                SLOT(i->m_dst) = box(d.m_tag);
+            } else {
+                object * o = alloc_cnstr(d.m_tag, d.m_size, d.m_usize * sizeof(void *) + d.m_ssize);
+                for (unsigned j = 0; j < i->m_nargs; j++)
+                    cnstr_set(o, j, ARG(j).m_obj);
+                SLOT(i->m_dst) = o;
             }
-            // evaluate args in old stack frame
-            for (const auto & arg : args) {
-                m_arg_stack.push_back(eval_arg(arg));
+            NEXT();
+        }
+        CASE(Reset) { // release fields if unique reference in preparation for `Reuse` below
+            object * o = SLOT(i->m_a).m_obj;
+            if (is_exclusive(o)) {
+                for (unsigned j = 0; j < i->m_n; j++)
+                    cnstr_release(o, j);
+                SLOT(i->m_dst) = o;
+            } else {
+                dec_ref(o);
+                SLOT(i->m_dst) = box(0);
             }
-            push_frame(e.m_decl, old_size);
-            r = eval_body(decl_fun_body(e.m_decl));
+            NEXT();
         }
-        pop_frame(r, decl_type(e.m_decl));
-        return r;
+        CASE(Reuse) { // reuse dead allocation if possible
+            ctor_desc const & d = *static_cast<ctor_desc const *>(i->m_aux);
+            object * o = SLOT(i->m_a).m_obj;
+            // check if `Reset` above had a unique reference it consumed
+            if (is_scalar(o)) {
+                // fall back to regular allocation
+                o = alloc_cnstr(d.m_tag, d.m_size, d.m_usize * sizeof(void *) + d.m_ssize);
+            } else if (i->m_flag) {
+                cnstr_set_tag(o, d.m_tag);
+            }
+            for (unsigned j = 0; j < i->m_nargs; j++)
+                cnstr_set(o, j, ARG(j).m_obj);
+            SLOT(i->m_dst) = o;
+            NEXT();
+        }
+        CASE(Proj) { // object field access
+            SLOT(i->m_dst) = cnstr_get(SLOT(i->m_a).m_obj, i->m_n);
+            NEXT();
+        }
+        CASE(UProj) { // USize field access
+            SLOT(i->m_dst) = cnstr_get_usize(SLOT(i->m_a).m_obj, i->m_n);
+            NEXT();
+        }
+        CASE(SProj) { // other unboxed field access
+            object * o = SLOT(i->m_a).m_obj;
+            value v;
+            switch (i->m_type) {
+                case type::Float: v = value::from_float(cnstr_get_float(o, i->m_n)); break;
+                case type::UInt8: v = cnstr_get_uint8(o, i->m_n); break;
+                case type::UInt16: v = cnstr_get_uint16(o, i->m_n); break;
+                case type::UInt32: v = cnstr_get_uint32(o, i->m_n); break;
+                default: v = cnstr_get_uint64(o, i->m_n); break;
+            }
+            SLOT(i->m_dst) = v;
+            NEXT();
+        }
+        CASE(FAp) { // satured ("full") application of top-level function
+            call_site & cs = *static_cast<call_site *>(i->m_aux);
+            resolve(cs);
+            value r;
+            if (cs.m_sym.m_addr) {
+                r = call_native(cs.m_sym, i->m_nargs, [&](unsigned j) { return ARG(j); });
+            } else {
+                if (decl_tag(cs.m_sym.m_decl) == decl_kind::Extern)
+                    throw_missing_extern(cs.m_fn);
+                r = call_code(cs, cargs + i->m_args, i->m_nargs, bp);
+            }
+            SLOT(i->m_dst) = r;
+            NEXT();
+        }
+        CASE(Load) { // nullary function ("constant")
+            call_site & cs = *static_cast<call_site *>(i->m_aux);
+            value r;
+            if (cs.m_has_const) {
+                r = cs.m_const.m_val;
+                if (!cs.m_const.m_is_scalar)
+                    inc(r.m_obj);
+            } else {
+                r = load(cs.m_fn, i->m_type);
+                if (constant_cache_entry const * cached = m_constant_cache.find(cs.m_fn)) {
+                    cs.m_const     = *cached;
+                    cs.m_has_const = true;
+                }
+            }
+            SLOT(i->m_dst) = r;
+            NEXT();
+        }
+        CASE(PAp) { // unsatured (partial) application of top-level function
+            call_site & cs = *static_cast<call_site *>(i->m_aux);
+            resolve(cs);
+            object * cls = mk_pap(cs, cargs + i->m_args, i->m_nargs, bp);
+            SLOT(i->m_dst) = cls;
+            NEXT();
+        }
+        CASE(Ap) { // (saturated or unsatured) application of closure; mostly handled by runtime
+            object * r = apply_closure(SLOT(i->m_a).m_obj, cargs + i->m_args, i->m_nargs, bp);
+            SLOT(i->m_dst) = r;
+            NEXT();
+        }
+        CASE(Box) { // box unboxed value
+            SLOT(i->m_dst) = box_t(SLOT(i->m_a).m_num, i->m_type);
+            NEXT();
+        }
+        CASE(Unbox) { // unbox boxed value
+            SLOT(i->m_dst) = unbox_t(SLOT(i->m_a).m_obj, i->m_type);
+            NEXT();
+        }
+        CASE(LitVal) {
+            SLOT(i->m_dst) = i->m_val;
+            NEXT();
+        }
+        CASE(LitObj) {
+            object * o = static_cast<object *>(i->m_aux);
+            inc(o);
+            SLOT(i->m_dst) = o;
+            NEXT();
+        }
+        CASE(IsShared) {
+            SLOT(i->m_dst) = static_cast<uint64>(!is_exclusive(SLOT(i->m_a).m_obj));
+            NEXT();
+        }
+        CASE(IsTaggedPtr) {
+            SLOT(i->m_dst) = static_cast<uint64>(!is_scalar(SLOT(i->m_a).m_obj));
+            NEXT();
+        }
+        CASE(TailCall) { // copy argument values to parameter slots and restart
+            move_args(cargs + i->m_args, nullptr, i->m_nargs, bp);
+            check_system();
+            JUMP(0);
+        }
+        CASE(Set) { // set boxed field of unique reference
+            object * o = SLOT(i->m_dst).m_obj;
+            lean_assert(is_exclusive(o));
+            cnstr_set(o, i->m_n, SLOT(i->m_a).m_obj);
+            NEXT();
+        }
+        CASE(SetTag) { // set constructor tag of unique reference
+            object * o = SLOT(i->m_dst).m_obj;
+            lean_assert(is_exclusive(o));
+            cnstr_set_tag(o, i->m_n);
+            NEXT();
+        }
+        CASE(USet) { // set USize field of unique reference
+            object * o = SLOT(i->m_dst).m_obj;
+            lean_assert(is_exclusive(o));
+            cnstr_set_usize(o, i->m_n, SLOT(i->m_a).m_num);
+            NEXT();
+        }
+        CASE(SSet) { // set other unboxed field of unique reference
+            object * o = SLOT(i->m_dst).m_obj;
+            value v = SLOT(i->m_a);
+            lean_assert(is_exclusive(o));
+            switch (i->m_type) {
+                case type::Float: cnstr_set_float(o, i->m_n, v.m_float); break;
+                case type::UInt8: cnstr_set_uint8(o, i->m_n, v.m_num); break;
+                case type::UInt16: cnstr_set_uint16(o, i->m_n, v.m_num); break;
+                case type::UInt32: cnstr_set_uint32(o, i->m_n, v.m_num); break;
+                default: cnstr_set_uint64(o, i->m_n, v.m_num); break;
+            }
+            NEXT();
+        }
+        CASE(Inc) { // increment reference counter
+            inc(SLOT(i->m_a).m_obj, i->m_n);
+            NEXT();
+        }
+        CASE(Dec) { // decrement reference counter
+            for (unsigned j = 0; j < i->m_n; j++)
+                dec(SLOT(i->m_a).m_obj);
+            NEXT();
+        }
+        CASE(Del) { // delete object of unique reference
+            lean_free_object(SLOT(i->m_a).m_obj);
+            NEXT();
+        }
+        CASE(Case) { // branch according to constructor tag
+            value v = SLOT(i->m_a);
+            unsigned tag = i->m_flag ? static_cast<unsigned>(v.m_num) : lean_obj_tag(v.m_obj);
+            unsigned pc = static_cast<case_table const *>(i->m_aux)->get(tag);
+            if (pc == case_table::no_target)
+                throw exception("incomplete case");
+            JUMP(pc);
+        }
+        CASE(Ret) {
+            return SLOT(i->m_a);
+        }
+        CASE(Jmp) { // jump to join-point
+            move_args(cargs + i->m_args, cargs + i->m_args + i->m_nargs, i->m_nargs, bp);
+            JUMP(i->m_n);
+        }
+        CASE(Unreachable) {
+            throw exception("unreachable code");
+        }
+        CASE(Invalid) {
+            throw exception(static_cast<char const *>(i->m_aux));
+        }
+        }
+#undef JUMP
+#undef NEXT
+#undef CASE
+#undef DISPATCH
+#undef ARG
+#undef SLOT
+        lean_unreachable();
     }
 
     // closure stub
@@ -887,7 +2098,7 @@ private:
             m_arg_stack.push_back(args[3 + i]);
         }
         push_frame(d, old_size);
-        object * r = eval_body(decl_fun_body(d)).m_obj;
+        object * r = eval_decl_body(d, old_size).m_obj;
         pop_frame(r, type::TObject);
         return r;
     }
@@ -944,6 +2155,8 @@ private:
 public:
     explicit interpreter(environment const & env, options const & opts) : m_env(env), m_opts(opts) {
         m_prefer_native = opts.get_bool(*g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE);
+        m_bytecode = opts.get_bool(*g_interpreter_bytecode, LEAN_DEFAULT_INTERPRETER_BYTECODE);
+        m_jit_threshold = m_bytecode && jit_supported() ? opts.get_unsigned(*g_interpreter_jit_threshold, LEAN_DEFAULT_INTERPRETER_JIT_THRESHOLD) : 0;
     }
 
     ~interpreter() {
@@ -1109,17 +2322,28 @@ void initialize_ir_interpreter() {
     ir::g_boxed_mangled_suffix = new string_ref("___boxed");
     mark_persistent(ir::g_boxed_mangled_suffix->raw());
     ir::g_interpreter_prefer_native = new name({"interpreter", "prefer_native"});
+    ir::g_interpreter_bytecode = new name({"interpreter", "bytecode"});
+    ir::g_interpreter_jit_threshold = new name({"interpreter", "jit_threshold"});
     ir::g_init_globals = new name_map<object *>();
+    ir::g_shared_interpreter_cache = new ir::shared_interpreter_cache();
+    ir::g_jit_cache = new ir::jit_cache();
     register_bool_option(*ir::g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE, "(interpreter) whether to use precompiled code where available");
+    register_bool_option(*ir::g_interpreter_bytecode, LEAN_DEFAULT_INTERPRETER_BYTECODE, "(interpreter) whether to translate IR code to bytecode before interpreting it");
+    register_unsigned_option(*ir::g_interpreter_jit_threshold, LEAN_DEFAULT_INTERPRETER_JIT_THRESHOLD, "(interpreter) number of calls after which a declaration of the current module is compiled to native code, 0 to disable (requires a Lean build with LLVM_JIT)");
     DEBUG_CODE({
         register_trace_class({"interpreter"});
         register_trace_class({"interpreter", "call"});
         register_trace_class({"interpreter", "step"});
+        register_trace_class({"interpreter", "jit"});
     });
 }
 
 void finalize_ir_interpreter() {
+    delete ir::g_jit_cache;
+    delete ir::g_shared_interpreter_cache;
     delete ir::g_init_globals;
+    delete ir::g_interpreter_jit_threshold;
+    delete ir::g_interpreter_bytecode;
     delete ir::g_interpreter_prefer_native;
     delete ir::g_boxed_mangled_suffix;
     delete ir::g_boxed_suffix;
@@ -0,0 +1,172 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Compilation of IR declarations into native code at runtime, used by the interpreter for hot declarations (see
+`interpreter.jit_threshold` in `ir_interpreter.cpp`). The declarations are emitted into a bitcode file by
+`Lean.IR.emitLLVMDecls`, which is then loaded into a fresh ORC `LLJIT` instance. Using one instance per compilation
+avoids conflicts between different versions of a declaration, e.g. when a file is re-elaborated by the server.
+*/
+#include <string>
+#include <cstdio>
+#ifdef LEAN_LLVM_JIT
+#include <unistd.h>
+#include "llvm-c/BitReader.h"
+#include "llvm-c/Core.h"
+#include "llvm-c/Error.h"
+#include "llvm-c/LLJIT.h"
+#include "llvm-c/Orc.h"
+#include "llvm-c/Target.h"
+#endif
+#include "runtime/sstream.h"
+#include "runtime/thread.h"
+#include "runtime/array_ref.h"
+#include "util/io.h"
+#include "library/compiler/ir_jit.h"
+
+#ifdef LEAN_LLVM_JIT
+extern "C" void * initialize_Lean_Compiler_IR_EmitLLVM(uint8_t builtin, lean_object *);
+extern "C" lean_object * lean_ir_emit_llvm_decls(lean_object * env, lean_object * mod_name, lean_object * decls,
+                                                 lean_object * consts, lean_object * filepath, lean_object * w);
+#endif
+
+namespace lean {
+namespace ir {
+#ifdef LEAN_LLVM_JIT
+class jit_dylib {
+public:
+    LLVMOrcLLJITRef m_jit;
+    explicit jit_dylib(LLVMOrcLLJITRef jit):m_jit(jit) {}
+};
+
+static mutex * g_jit_mutex = nullptr;
+
+static void check_llvm_error(LLVMErrorRef err, char const * what) {
+    if (err) {
+        char * msg = LLVMGetErrorMessage(err);
+        std::string s(msg);
+        LLVMDisposeErrorMessage(msg);
+        throw exception(sstream() << "JIT compilation failed, " << what << ": " << s);
+    }
+}
+
+/** \brief Remove the given file when going out of scope. */
+struct scoped_temp_file {
+    std::string m_path;
+    scoped_temp_file() {
+        char const * dir = getenv("TMPDIR");
+        std::string tmpl = std::string(dir ? dir : "/tmp") + "/lean_jit_XXXXXX";
+        int fd = mkstemp(&tmpl[0]);
+        if (fd < 0)
+            throw exception("JIT compilation failed, could not create temporary file");
+        close(fd);
+        m_path = tmpl;
+    }
+    ~scoped_temp_file() { std::remove(m_path.c_str()); }
+};
+
+bool jit_supported() { return true; }
+
+/** \brief Load the bitcode file `path` into a new `LLJIT` instance.
+    \pre `g_jit_mutex` is locked */
+static jit_dylib * load_bitcode(std::string const & path) {
+    LLVMOrcThreadSafeContextRef tsctx = LLVMOrcCreateNewThreadSafeContext();
+    LLVMContextRef ctx = LLVMOrcThreadSafeContextGetContext(tsctx);
+    LLVMMemoryBufferRef buf;
+    char * msg;
+    if (LLVMCreateMemoryBufferWithContentsOfFile(path.c_str(), &buf, &msg)) {
+        std::string s(msg);
+        LLVMDisposeMessage(msg);
+        LLVMOrcDisposeThreadSafeContext(tsctx);
+        throw exception(sstream() << "JIT compilation failed, could not read bitcode: " << s);
+    }
+    LLVMModuleRef mod;
+    bool failed = LLVMParseBitcodeInContext2(ctx, buf, &mod);
+    LLVMDisposeMemoryBuffer(buf);
+    if (failed) {
+        LLVMOrcDisposeThreadSafeContext(tsctx);
+        throw exception("JIT compilation failed, invalid bitcode");
+    }
+    LLVMOrcThreadSafeModuleRef tsm = LLVMOrcCreateNewThreadSafeModule(mod, tsctx);
+    // the module keeps the context alive
+    LLVMOrcDisposeThreadSafeContext(tsctx);
+
+    LLVMOrcLLJITRef jit;
+    LLVMErrorRef err = LLVMOrcCreateLLJIT(&jit, LLVMOrcCreateLLJITBuilder());
+    if (err) {
+        LLVMOrcDisposeThreadSafeModule(tsm);
+        check_llvm_error(err, "could not create LLJIT instance");
+    }
+    // resolve all other symbols, e.g. of imported declarations and the runtime, in the current process
+    LLVMOrcDefinitionGeneratorRef gen;
+    err = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&gen, LLVMOrcLLJITGetGlobalPrefix(jit), nullptr, nullptr);
+    if (err) {
+        LLVMOrcDisposeThreadSafeModule(tsm);
+        LLVMOrcDisposeLLJIT(jit);
+        check_llvm_error(err, "could not create process symbol generator");
+    }
+    LLVMOrcJITDylibAddGenerator(LLVMOrcLLJITGetMainJITDylib(jit), gen);
+    err = LLVMOrcLLJITAddLLVMIRModule(jit, LLVMOrcLLJITGetMainJITDylib(jit), tsm);
+    if (err) {
+        LLVMOrcDisposeLLJIT(jit);
+        check_llvm_error(err, "could not add module");
+    }
+    return new jit_dylib(jit);
+}
+
+static void initialize_llvm_jit() {
+    static bool initialized = false;
+    if (!initialized) {
+        LLVMInitializeNativeTarget();
+        LLVMInitializeNativeAsmPrinter();
+        initialize_Lean_Compiler_IR_EmitLLVM(/* builtin */ false, lean_io_mk_world());
+        initialized = true;
+    }
+}
+
+jit_dylib * jit_compile(environment const & env, buffer<name> const & fns, buffer<name> const & consts) {
+    lock_guard<mutex> _(*g_jit_mutex);
+    initialize_llvm_jit();
+    scoped_temp_file bc;
+    consume_io_result(lean_ir_emit_llvm_decls(env.to_obj_arg(), env.get_main_module().to_obj_arg(),
+                                              array_ref<name>(fns).steal(), array_ref<name>(consts).steal(),
+                                              string_ref(bc.m_path).steal(), lean_io_mk_world()));
+    return load_bitcode(bc.m_path);
+}
+
+void * jit_lookup(jit_dylib * d, char const * sym) {
+    lock_guard<mutex> _(*g_jit_mutex);
+    LLVMOrcExecutorAddress addr;
+    if (LLVMErrorRef err = LLVMOrcLLJITLookup(d->m_jit, &addr, sym)) {
+        LLVMConsumeError(err);
+        return nullptr;
+    }
+    return reinterpret_cast<void *>(addr);
+}
+#else
+class jit_dylib {};
+
+bool jit_supported() { return false; }
+
+jit_dylib * jit_compile(environment const &, buffer<name> const &, buffer<name> const &) {
+    throw exception("JIT compilation is not supported, Lean was built without LLVM_JIT");
+}
+
+void * jit_lookup(jit_dylib *, char const *) {
+    return nullptr;
+}
+#endif
+}
+
+void initialize_ir_jit() {
+#ifdef LEAN_LLVM_JIT
+    ir::g_jit_mutex = new mutex();
+#endif
+}
+
+void finalize_ir_jit() {
+#ifdef LEAN_LLVM_JIT
+    delete ir::g_jit_mutex;
+#endif
+}
+}
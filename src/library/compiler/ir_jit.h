@@ -0,0 +1,26 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include "kernel/environment.h"
+#include "runtime/buffer.h"
+
+namespace lean {
+namespace ir {
+/** \brief Native code compiled at runtime. It is never freed, as closures and caches may still refer to it. */
+class jit_dylib;
+
+/** \brief Return true iff Lean was built with `LLVM_JIT`. */
+bool jit_supported();
+/** \brief Compile the function declarations `fns` of the current module of `env` with the LLVM backend and load the
+    code into the process. The compiled code contains a global variable for each nullary declaration in `consts`,
+    which must be set with `jit_lookup` before the code is run. Other declarations are resolved against the symbols of
+    the current process. Throws an exception on failure. */
+jit_dylib * jit_compile(environment const & env, buffer<name> const & fns, buffer<name> const & consts);
+/** \brief Return the address of the (unmangled) symbol `sym` in `d`, or `nullptr` if it does not exist. */
+void * jit_lookup(jit_dylib * d, char const * sym);
+}
+void initialize_ir_jit();
+void finalize_ir_jit();
+}
@@ -25,6 +25,7 @@ Lean's IR.
 #include "llvm-c/Target.h"
 #include "llvm-c/TargetMachine.h"
 #include "llvm-c/Types.h"
+#include "llvm-c/Transforms/IPO.h"
 #include "llvm-c/Transforms/PassBuilder.h"
 #include "llvm-c/Transforms/PassManagerBuilder.h"
 #endif
@@ -1268,6 +1269,30 @@ extern "C" LEAN_EXPORT lean_object *lean_llvm_pass_manager_builder_populate_modu
 #endif  // LEAN_LLVM
 }
 
+extern "C" LEAN_EXPORT lean_object *lean_llvm_add_function_inlining_pass(size_t ctx, size_t pm,
+    lean_object * /* w */) {
+#ifndef LEAN_LLVM
+    lean_always_assert(
+        false && ("Please build a version of Lean4 with -DLLVM=ON to invoke "
+                  "the LLVM backend function."));
+#else
+    LLVMAddFunctionInliningPass(lean_to_PassManager(pm));
+    return lean_io_result_mk_ok(lean_box(0));
+#endif  // LEAN_LLVM
+}
+
+extern "C" LEAN_EXPORT lean_object *lean_llvm_add_global_dce_pass(size_t ctx, size_t pm,
+    lean_object * /* w */) {
+#ifndef LEAN_LLVM
+    lean_always_assert(
+        false && ("Please build a version of Lean4 with -DLLVM=ON to invoke "
+                  "the LLVM backend function."));
+#else
+    LLVMAddGlobalDCEPass(lean_to_PassManager(pm));
+    return lean_io_result_mk_ok(lean_box(0));
+#endif  // LEAN_LLVM
+}
+
 extern "C" LEAN_EXPORT lean_object *lean_llvm_dispose_target_machine(size_t ctx, size_t tm,
     lean_object * /* w */) {
 #ifndef LEAN_LLVM
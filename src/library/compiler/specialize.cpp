@@ -13,6 +13,7 @@ Author: Leonardo de Moura
 #include "library/class.h"
 #include "library/trace.h"
 #include "library/compiler/util.h"
+#include "library/compiler/compiler_cache.h"
 #include "library/compiler/csimp.h"
 
 namespace lean {
@@ -104,6 +105,7 @@ extern "C" object* lean_add_specialization_info(object* env, object* fn, object*
 extern "C" object* lean_get_specialization_info(object* env, object* fn);
 
 static environment save_specialization_info(environment const & env, name const & fn, spec_info const & si) {
+    compiler_cache_record_spec_info(fn, si);
     return environment(lean_add_specialization_info(env.to_obj_arg(), fn.to_obj_arg(), si.to_obj_arg()));
 }
 
@@ -256,6 +258,7 @@ extern "C" object* lean_cache_specialization(object* env, object* e, object* fn)
 extern "C" object* lean_get_cached_specialization(object* env, object* e);
 
 static environment cache_specialization(environment const & env, expr const & k, name const & fn) {
+    compiler_cache_record_specialization(k, fn);
     return environment(lean_cache_specialization(env.to_obj_arg(), k.to_obj_arg(), fn.to_obj_arg()));
 }
 
@@ -969,6 +972,7 @@ class specialize_fn {
         try {
             expr type = cheap_beta_reduce(type_checker(m_st).infer(code));
             declaration aux_ax = mk_axiom(n, names(), type, true /* meta */);
+            compiler_cache_record_decl(n, aux_ax);
             m_st.env() = env().add(aux_ax, false);
         } catch (exception &) {
             /* We may fail to infer the type of code, since it may be recursive
@@ -9,6 +9,8 @@ Author: Leonardo de Moura
 #include "library/compiler/util.h"
 #include "library/compiler/csimp.h"
 namespace lean {
+bool has_specialize_attribute(environment const & env, name const & n);
+bool has_nospecialize_attribute(environment const & env, name const & n);
 pair<environment, comp_decls> specialize(environment env, comp_decls const & ds, csimp_cfg const & cfg);
 void initialize_specialize();
 void finalize_specialize();
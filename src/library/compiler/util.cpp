@@ -27,6 +27,7 @@ Author: Leonardo de Moura
 #include "library/compiler/lambda_lifting.h"
 #include "library/compiler/eager_lambda_lifting.h"
 #include "library/compiler/util.h"
+#include "library/compiler/compiler_cache.h"
 
 namespace lean {
 optional<unsigned> is_enum_type(environment const & env, name const & I) {
@@ -556,6 +557,7 @@ expr mk_runtime_type(type_checker::state & st, local_ctx const & lctx, expr e) {
 
 environment register_stage1_decl(environment const & env, name const & n, names const & ls, expr const & t, expr const & v) {
     declaration aux_decl = mk_definition(mk_cstage1_name(n), ls, t, v, reducibility_hints::mk_opaque(), definition_safety::unsafe);
+    compiler_cache_record_decl(mk_cstage1_name(n), aux_decl);
     return env.add(aux_decl, false);
 }
 
@@ -566,6 +568,7 @@ bool is_stage2_decl(environment const & env, name const & n) {
 environment register_stage2_decl(environment const & env, name const & n, expr const & t, expr const & v) {
     declaration aux_decl = mk_definition(mk_cstage2_name(n), names(), t,
                                          v, reducibility_hints::mk_opaque(), definition_safety::unsafe);
+    compiler_cache_record_decl(mk_cstage2_name(n), aux_decl);
     return env.add(aux_decl, false);
 }
 
@@ -38,6 +38,7 @@ expr elim_trivial_let_decls(expr const & e);
 bool has_inline_attribute(environment const & env, name const & n);
 bool has_noinline_attribute(environment const & env, name const & n);
 bool has_inline_if_reduce_attribute(environment const & env, name const & n);
+bool has_macro_inline_attribute(environment const & env, name const & n);
 bool has_never_extract_attribute(environment const & env, name const & n);
 
 expr unfold_macro_defs(environment const & env, expr const & e);
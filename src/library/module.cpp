@@ -33,6 +33,16 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include <unistd.h>
 #include <fcntl.h>
 #endif
+#if defined(LEAN_MMAP) && defined(__linux__)
+#include <dirent.h>
+#include <limits.h>
+#include <map>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#endif
 
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
@@ -41,8 +51,309 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #endif
 
 namespace lean {
-// manually padded to multiple of word size, see `initialize_module`
-static char const * g_olean_header   = "oleanfile!!!!!!!";
+/* An .olean file consists of
+   - this header, manually padded to multiple of word size, see `initialize_module`
+   - the base address the compacted region was created for
+   - the size of the compacted region
+   - the compacted region
+   - the positions of the pointers in the compacted region (`object_compactor::relocs`), in increasing order
+   - the section index: for each section of `g_olean_section_size` bytes of the file up to the end of the compacted
+     region, the index of its first pointer in the previous list, followed by the number of pointers */
+static char const * g_olean_header   = "oleanfile-sectns";
+static constexpr size_t g_olean_section_size = 4096;
+
+static size_t get_olean_num_sections(size_t header_size, size_t data_size) {
+    return (header_size + data_size + g_olean_section_size - 1) / g_olean_section_size;
+}
+
+static std::vector<uint32> mk_olean_section_index(size_t header_size, size_t data_size, std::vector<object_reloc> const & relocs) {
+    size_t num_sections = get_olean_num_sections(header_size, data_size);
+    std::vector<uint32> sections(num_sections + 1);
+    size_t j = 0;
+    for (size_t i = 0; i <= num_sections; i++) {
+        while (j < relocs.size() && header_size + relocs[j] * sizeof(void *) < i * g_olean_section_size)
+            j++;
+        sections[i] = j;
+    }
+    return sections;
+}
+
+#if defined(LEAN_MMAP) && defined(__linux__)
+#define LEAN_OLEAN_SHM_CACHE
+#endif
+
+#ifdef LEAN_OLEAN_SHM_CACHE
+/* When set, an .olean file that cannot be mapped at its base address is relocated once and the result is published
+   in `/dev/shm`. The relocated image is itself a valid .olean file whose base address is the one it was relocated
+   to, so other processes (e.g., server workers importing the same modules) can map it without copying or relocating,
+   and share its pages. */
+static bool g_olean_shm_cache = false;
+
+static char const * g_olean_shm_cache_dir = "/dev/shm";
+
+/* Prefix of the names of the relocated images of the .olean file `olean_fn` created by the current user. */
+static std::string get_olean_shm_cache_prefix(std::string const & olean_fn) {
+    char real_fn[PATH_MAX];
+    std::string fn = realpath(olean_fn.c_str(), real_fn) ? std::string(real_fn) : olean_fn;
+    uint64 h = hash_str(fn.size(), reinterpret_cast<unsigned char const *>(fn.c_str()), 11);
+    return (sstream() << "lean-olean-" << getuid() << "-" << std::hex << h << "-").str();
+}
+
+/* Path of the relocated image of the .olean file `olean_fn` opened as `fd`. Device, inode, size, and modification
+   time identify the file contents, so an image is never used for a different version of the file. */
+static std::string get_olean_shm_cache_path(std::string const & olean_fn, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return std::string();
+    return (sstream() << g_olean_shm_cache_dir << "/" << get_olean_shm_cache_prefix(olean_fn) << st.st_dev << "-"
+            << st.st_ino << "-" << st.st_size << "-" << st.st_mtim.tv_sec << "-" << st.st_mtim.tv_nsec).str();
+}
+
+/* Return the sorted names of the relocated images of the current user in `g_olean_shm_cache_dir`. The directory is
+   scanned only once per process, as it may contain the images of many modules; images published later on are for the
+   versions of the .olean files seen by other processes, which we do not evict anyway. */
+static std::vector<std::string> const & get_olean_shm_cache_entries() {
+    static std::vector<std::string> entries = []() {
+        std::vector<std::string> r;
+        std::string prefix = (sstream() << "lean-olean-" << getuid() << "-").str();
+        if (DIR * dir = opendir(g_olean_shm_cache_dir)) {
+            while (struct dirent * e = readdir(dir)) {
+                if (strncmp(e->d_name, prefix.c_str(), prefix.size()) == 0 && !strstr(e->d_name, ".tmp"))
+                    r.push_back(e->d_name);
+            }
+            closedir(dir);
+        }
+        std::sort(r.begin(), r.end());
+        return r;
+    }();
+    return entries;
+}
+
+/* Remove the images of previous versions of the .olean file `olean_fn`, i.e., all images with the same prefix
+   except `path`. Processes still mapping them are not affected. */
+static void evict_olean_shm_cache(std::string const & olean_fn, std::string const & path) {
+    std::string prefix = get_olean_shm_cache_prefix(olean_fn);
+    std::vector<std::string> const & entries = get_olean_shm_cache_entries();
+    for (auto it = std::lower_bound(entries.begin(), entries.end(), prefix);
+         it != entries.end() && it->compare(0, prefix.size(), prefix) == 0; ++it) {
+        std::string entry_path = (sstream() << g_olean_shm_cache_dir << "/" << *it).str();
+        if (entry_path != path)
+            unlink(entry_path.c_str());
+    }
+}
+
+/* Return true if `size` bytes can be added to the cache while keeping a quarter of the file system free, since
+   `/dev/shm` is backed by memory. */
+static bool has_olean_shm_cache_space(size_t size) {
+    struct statvfs st;
+    if (statvfs(g_olean_shm_cache_dir, &st) != 0)
+        return false;
+    uint64 avail = static_cast<uint64>(st.f_bavail) * st.f_frsize;
+    uint64 total = static_cast<uint64>(st.f_blocks) * st.f_frsize;
+    return avail >= size && avail - size >= total / 4;
+}
+
+/* Map the relocated image at `path` at its base address. Return `nullptr` if it does not exist, was not created
+   by the current user, or the address is not available. */
+static char * map_olean_shm_cache(std::string const & path, size_t size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    char * r = nullptr;
+    struct stat st;
+    size_t header_size = strlen(g_olean_header);
+    std::string header(header_size, '\0');
+    char * base_addr;
+    if (fstat(fd, &st) == 0 && st.st_uid == getuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0 &&
+        static_cast<size_t>(st.st_size) == size &&
+        pread(fd, &header[0], header_size, 0) == static_cast<ssize_t>(header_size) &&
+        header == g_olean_header &&
+        pread(fd, &base_addr, sizeof(base_addr), header_size) == sizeof(base_addr)) {
+        void * m = mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == base_addr)
+            r = base_addr;
+        else if (m != MAP_FAILED)
+            munmap(m, size);
+    }
+    close(fd);
+    return r;
+}
+
+/* Publish the relocated image `[image, image + size)` of `olean_fn` at `path` unless some other process already did,
+   and remove the images of its previous versions. */
+static void write_olean_shm_cache(std::string const & olean_fn, std::string const & path, char const * image, size_t size) {
+    if (access(path.c_str(), F_OK) == 0)
+        return;
+    evict_olean_shm_cache(olean_fn, path);
+    if (!has_olean_shm_cache_space(size))
+        return;
+    std::string tmp_path = (sstream() << path << ".tmp" << getpid()).str();
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        return;
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, image + written, size - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    close(fd);
+    if (written != size || rename(tmp_path.c_str(), path.c_str()) != 0)
+        unlink(tmp_path.c_str());
+}
+#endif
+
+void set_olean_shm_cache(bool flag) {
+#ifdef LEAN_OLEAN_SHM_CACHE
+    g_olean_shm_cache = flag;
+#else
+    (void)flag;
+#endif
+}
+
+#if defined(LEAN_MMAP) && defined(__linux__) && defined(LEAN_MULTI_THREAD) && defined(SYS_userfaultfd)
+#define LEAN_OLEAN_LAZY_RELOC
+#endif
+
+#ifdef LEAN_OLEAN_LAZY_RELOC
+/* Relocation of .olean files on demand. When an .olean file cannot be mapped at its base address (and no relocated
+   image is available, see `LEAN_OLEAN_SHM_CACHE`), its header and compacted region are mapped as anonymous memory
+   registered with `userfaultfd`. The first access to a page of this image, e.g., to a declaration returned by
+   `lean_environment_find`, is served by a handler thread that copies the page from the mapped file and relocates
+   the pointers of its sections, found with the section index. Thus, only the parts of the imported modules actually
+   used are relocated and kept in memory. Unlike a `SIGSEGV` handler, `userfaultfd` also serves accesses made by
+   system calls. If `userfaultfd` is not available (e.g., `vm.unprivileged_userfaultfd` is not set), or
+   `LEAN_OLEAN_LAZY_RELOC=0`, .olean files are relocated eagerly. */
+class olean_fault_handler {
+    struct lazy_image {
+        size_t               m_size;        // size of the header and the compacted region
+        char const *         m_file;        // read-only mapping of the .olean file
+        size_t               m_header_size;
+        object_reloc const * m_relocs;
+        size_t               m_num_relocs;
+        uint32 const *       m_sections;
+        size_t               m_num_sections;
+        size_t               m_delta;
+    };
+    int                          m_fd = -1;
+    size_t                       m_page_size;
+    mutex                        m_mutex;
+    std::map<char *, lazy_image> m_images;
+
+    static unsigned long ptr_arg(void const * p) { return reinterpret_cast<unsigned long>(p); }
+
+    /* Copy the page at offset `begin` of `img` into `buf`, and relocate its pointers. */
+    void relocate_page(lazy_image const & img, size_t begin, char * buf) {
+        size_t end = std::min(begin + m_page_size, img.m_size);
+        memcpy(buf, img.m_file + begin, end - begin);
+        memset(buf + (end - begin), 0, m_page_size - (end - begin));
+        size_t s_begin = begin / g_olean_section_size;
+        size_t s_end   = std::min((end + g_olean_section_size - 1) / g_olean_section_size, img.m_num_sections);
+        size_t r_end   = std::min<size_t>(img.m_sections[s_end], img.m_num_relocs);
+        for (size_t r = img.m_sections[s_begin]; r < r_end; r++) {
+            size_t pos = img.m_header_size + static_cast<size_t>(img.m_relocs[r]) * sizeof(void *);
+            // positions outside of the page only occur in corrupted files
+            if (pos >= begin && pos + sizeof(size_t) <= end)
+                *reinterpret_cast<size_t *>(buf + (pos - begin)) += img.m_delta;
+        }
+    }
+
+    void run() {
+        std::vector<char> buf(m_page_size);
+        while (true) {
+            pollfd pfd{m_fd, POLLIN, 0};
+            if (poll(&pfd, 1, -1) <= 0)
+                continue;
+            uffd_msg msg;
+            if (read(m_fd, &msg, sizeof(msg)) != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT)
+                continue;
+            char * page = reinterpret_cast<char *>(msg.arg.pagefault.address & ~static_cast<__u64>(m_page_size - 1));
+            {
+                lock_guard<mutex> _(m_mutex);
+                auto it = m_images.upper_bound(page);
+                if (it == m_images.begin() || page >= std::prev(it)->first + std::prev(it)->second.m_size) {
+                    // not an .olean image, should be unreachable
+                    uffdio_zeropage zero{{ptr_arg(page), m_page_size}, 0, 0};
+                    ioctl(m_fd, UFFDIO_ZEROPAGE, &zero);
+                    continue;
+                }
+                --it;
+                relocate_page(it->second, page - it->first, buf.data());
+            }
+            uffdio_copy copy{ptr_arg(page), ptr_arg(buf.data()), m_page_size, 0, 0};
+            if (ioctl(m_fd, UFFDIO_COPY, &copy) != 0 && errno == EEXIST) {
+                // another thread faulted on the same page, which has been filled in the meantime
+                uffdio_range range{ptr_arg(page), m_page_size};
+                ioctl(m_fd, UFFDIO_WAKE, &range);
+            }
+        }
+    }
+
+public:
+    olean_fault_handler() {
+        m_page_size = sysconf(_SC_PAGESIZE);
+        char const * flag = std::getenv("LEAN_OLEAN_LAZY_RELOC");
+        if ((flag && strcmp(flag, "0") == 0) || m_page_size % g_olean_section_size != 0)
+            return;
+        int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+        if (fd == -1)
+            return;
+        uffdio_api api{UFFD_API, 0, 0};
+        if (ioctl(fd, UFFDIO_API, &api) != 0) {
+            close(fd);
+            return;
+        }
+        m_fd = fd;
+        lthread([this]() { run(); });
+    }
+
+    /* Map the image of the .olean file mapped at `file` with the given layout at a fresh address, and return it.
+       Return `nullptr` if lazy relocation is not available. */
+    char * map(char const * file, char const * base_addr, size_t header_size, size_t data_size, size_t num_relocs) {
+        if (m_fd == -1)
+            return nullptr;
+        size_t size = header_size + data_size;
+        size_t mapped_size = (size + m_page_size - 1) / m_page_size * m_page_size;
+        char * image = static_cast<char *>(mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+        if (image == MAP_FAILED)
+            return nullptr;
+        lazy_image img;
+        img.m_size         = size;
+        img.m_file         = file;
+        img.m_header_size  = header_size;
+        img.m_relocs       = reinterpret_cast<object_reloc const *>(file + size);
+        img.m_num_relocs   = num_relocs;
+        img.m_sections     = reinterpret_cast<uint32 const *>(img.m_relocs + num_relocs);
+        img.m_num_sections = get_olean_num_sections(header_size, data_size);
+        img.m_delta        = static_cast<size_t>(image - base_addr);
+        lock_guard<mutex> _(m_mutex);
+        uffdio_register reg{{ptr_arg(image), mapped_size}, UFFDIO_REGISTER_MODE_MISSING, 0};
+        if (ioctl(m_fd, UFFDIO_REGISTER, &reg) != 0) {
+            munmap(image, mapped_size);
+            return nullptr;
+        }
+        m_images.insert(mk_pair(image, img));
+        return image;
+    }
+
+    void unmap(char * image) {
+        lock_guard<mutex> _(m_mutex);
+        auto it = m_images.find(image);
+        lean_assert(it != m_images.end());
+        size_t mapped_size = (it->second.m_size + m_page_size - 1) / m_page_size * m_page_size;
+        m_images.erase(it);
+        // also unregisters the range
+        lean_always_assert(munmap(image, mapped_size) == 0);
+    }
+};
+
+static olean_fault_handler * get_olean_fault_handler() {
+    // never deleted, as its thread keeps running
+    static olean_fault_handler * h = new olean_fault_handler();
+    return h;
+}
+#endif
 
 extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
     std::string olean_fn(string_cstr(fname));
@@ -73,11 +384,20 @@ extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg
         // `MapViewOfFileEx` addresses must be aligned to the "memory allocation granularity", which is 64KB.
         base_addr = base_addr & ~((1LL<<16) - 1);
 
-        object_compactor compactor(reinterpret_cast<void *>(base_addr + strlen(g_olean_header) + sizeof(base_addr)));
+        size_t header_size = strlen(g_olean_header) + sizeof(base_addr) + sizeof(size_t);
+        object_compactor compactor(reinterpret_cast<void *>(base_addr + header_size));
         compactor(mdata);
+        size_t data_size = compactor.size();
+        std::vector<object_reloc> relocs = compactor.relocs();
+        // the order in which pointers are relocated is irrelevant, but the section index requires it to be increasing
+        std::sort(relocs.begin(), relocs.end());
+        std::vector<uint32> sections = mk_olean_section_index(header_size, data_size, relocs);
         out.write(g_olean_header, strlen(g_olean_header));
         out.write(reinterpret_cast<char *>(&base_addr), sizeof(base_addr));
-        out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        out.write(reinterpret_cast<char *>(&data_size), sizeof(data_size));
+        out.write(static_cast<char const *>(compactor.data()), data_size);
+        out.write(reinterpret_cast<char const *>(relocs.data()), relocs.size() * sizeof(object_reloc));
+        out.write(reinterpret_cast<char const *>(sections.data()), sections.size() * sizeof(uint32));
         out.close();
         while (std::rename(olean_tmp_fn.c_str(), olean_fn.c_str()) != 0) {
 #ifdef LEAN_WINDOWS
@@ -128,9 +448,25 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         delete[] header;
         char * base_addr;
         in.read(reinterpret_cast<char *>(&base_addr), sizeof(base_addr));
-        header_size += sizeof(base_addr);
+        size_t data_size;
+        in.read(reinterpret_cast<char *>(&data_size), sizeof(data_size));
+        header_size += sizeof(base_addr) + sizeof(data_size);
+        if (!in || size < header_size || data_size > size - header_size) {
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        }
+        size_t index_size = (get_olean_num_sections(header_size, data_size) + 1) * sizeof(uint32);
+        if (size - header_size - data_size < index_size ||
+            (size - header_size - data_size - index_size) % sizeof(object_reloc) != 0) {
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        }
+        size_t num_relocs = (size - header_size - data_size - index_size) / sizeof(object_reloc);
         char * buffer = nullptr;
         bool is_mmap = false;
+        bool is_writable_mmap = false;
+        char * lazy_image = nullptr;
+#ifdef LEAN_OLEAN_SHM_CACHE
+        std::string shm_cache_path;
+#endif
         std::function<void()> free_data;
 #ifdef LEAN_WINDOWS
         // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
@@ -157,6 +493,27 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         }
 #ifdef LEAN_MMAP
         buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+#ifdef LEAN_OLEAN_SHM_CACHE
+        if (g_olean_shm_cache && buffer != base_addr) {
+            shm_cache_path = get_olean_shm_cache_path(olean_fn, fd);
+            if (char * cached = map_olean_shm_cache(shm_cache_path, size)) {
+                if (buffer != MAP_FAILED)
+                    munmap(buffer, size);
+                buffer = base_addr = cached;
+            }
+        }
+#endif
+        if (buffer != MAP_FAILED && buffer != base_addr) {
+#ifdef LEAN_OLEAN_LAZY_RELOC
+            // an image to be published in the cache must be relocated completely
+            if (shm_cache_path.empty())
+                lazy_image = get_olean_fault_handler()->map(buffer, base_addr, header_size, data_size, num_relocs);
+#endif
+            // The stored base address is not available. The mapping is private, so we can still relocate it
+            // in place; only the pages containing pointers are copied.
+            if (!lazy_image)
+                is_writable_mmap = mprotect(buffer, size, PROT_READ | PROT_WRITE) == 0;
+        }
 #endif
         close(fd);
         free_data = [=]() {
@@ -165,25 +522,57 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             }
         };
 #endif
+        // Pointers in the file assume the compacted region starts at `base_addr + header_size`
+        char * data_addr = base_addr + header_size;
         if (buffer && buffer == base_addr) {
             buffer += header_size;
             is_mmap = true;
+        } else if (lazy_image) {
+#ifdef LEAN_OLEAN_LAZY_RELOC
+            // the image refers to the mapping of the file, see `olean_fault_handler`
+            std::function<void()> free_file = free_data;
+            free_data = [=]() {
+                get_olean_fault_handler()->unmap(lazy_image);
+                free_file();
+            };
+            buffer = data_addr = lazy_image + header_size;
+            is_mmap = true;
+#endif
+        } else if (is_writable_mmap) {
+#if !defined(LEAN_WINDOWS) && defined(LEAN_MMAP)
+            relocate_compacted_data(buffer + header_size, reinterpret_cast<object_reloc *>(buffer + header_size + data_size),
+                                    num_relocs, static_cast<size_t>(buffer - base_addr));
+#ifdef LEAN_OLEAN_SHM_CACHE
+            if (!shm_cache_path.empty()) {
+                memcpy(buffer + strlen(g_olean_header), &buffer, sizeof(buffer));
+                write_olean_shm_cache(olean_fn, shm_cache_path, buffer, size);
+            }
+#endif
+            lean_always_assert(mprotect(buffer, size, PROT_READ) == 0);
+            buffer += header_size;
+            data_addr = buffer;
+            is_mmap = true;
+#endif
         } else {
 #ifdef LEAN_MMAP
             free_data();
 #endif
-            buffer = static_cast<char *>(malloc(size - header_size));
+            buffer = static_cast<char *>(malloc(data_size));
             free_data = [=]() {
                 free(buffer);
             };
-            in.read(buffer, size - header_size);
+            std::vector<object_reloc> relocs(num_relocs);
+            in.read(buffer, data_size);
+            in.read(reinterpret_cast<char *>(relocs.data()), num_relocs * sizeof(object_reloc));
             if (!in) {
                 return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
             }
+            relocate_compacted_data(buffer, relocs.data(), num_relocs, static_cast<size_t>(buffer - data_addr));
+            data_addr = buffer;
         }
         in.close();
 
-        compacted_region * region = new compacted_region(size - header_size, buffer, base_addr + header_size, is_mmap, free_data);
+        compacted_region * region = new compacted_region(data_size, buffer, data_addr, is_mmap, free_data);
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
         // do not report as leak
@@ -200,6 +589,55 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
     }
 }
 
+static obj_res read_module_data_fn(obj_arg fname, obj_arg w) {
+    object * r = lean_read_module_data(fname, w);
+    dec(fname);
+    return r;
+}
+
+/*
+@[extern "lean_read_module_data_par"]
+opaque readModuleDataPar (fnames : @& Array System.FilePath) : IO (Array (ModuleData × CompactedRegion))
+
+Read `.olean` files using one task per file, so that reading and (if the stored base address is not available)
+relocating the compacted regions happens in parallel. */
+extern "C" LEAN_EXPORT object * lean_read_module_data_par(b_obj_arg fnames, object *) {
+    size_t n = array_size(fnames);
+    buffer<object *> tasks;
+    for (size_t i = 0; i < n; i++) {
+        object * fname = array_get(fnames, i);
+        inc(fname);
+        object * c = alloc_closure(reinterpret_cast<void *>(read_module_data_fn), 2, 1);
+        closure_set(c, 0, fname);
+        tasks.push_back(task_spawn(c));
+    }
+    object * mod_regions = alloc_array(0, n);
+    object * error = nullptr;
+    for (object * t : tasks) {
+        object * r = task_get(t);
+        if (io_result_is_ok(r)) {
+            object * mod_region = io_result_get_value(r);
+            inc(mod_region);
+            mod_regions = array_push(mod_regions, mod_region);
+        } else if (!error) {
+            inc(r);
+            error = r;
+        }
+        dec(t);
+    }
+    if (error) {
+        /* The regions of the successfully read files are not reachable anymore. */
+        buffer<compacted_region *> regions;
+        for (size_t i = 0; i < array_size(mod_regions); i++)
+            regions.push_back(reinterpret_cast<compacted_region *>(unbox_size_t(cnstr_get(array_get(mod_regions, i), 1))));
+        dec(mod_regions);
+        for (compacted_region * region : regions)
+            delete region;
+        return error;
+    }
+    return io_result_mk_ok(mod_regions);
+}
+
 /*
 @[export lean.write_module_core]
 def writeModule (env : Environment) (fname : String) : IO Unit := */
@@ -15,4 +15,6 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 namespace lean {
 /** \brief Store module using \c env. */
 void write_module(environment const & env, std::string const & olean_fn);
+/** \brief Share relocated .olean files with other processes through `/dev/shm`. Only supported on Linux. */
+void set_olean_shm_cache(bool flag);
 }
@@ -5,11 +5,23 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
 #include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/debug.h"
+#include "runtime/int64.h"
 #include "runtime/alloc.h"
 
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 #ifdef LEAN_RUNTIME_STATS
 #define LEAN_RUNTIME_STAT_CODE(c) c
 #else
@@ -26,6 +38,8 @@ Author: Leonardo de Moura
 #define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
 #define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
 #define LEAN_MAX_TO_EXPORT_OBJS    1024
+#define LEAN_MAX_CACHED_SEGMENTS   2
+#define LEAN_HUGE_PAGE_SIZE        2*1024*1024 // 2 Mb
 
 LEAN_CASSERT(LEAN_PAGE_SIZE > LEAN_MAX_SMALL_OBJECT_SIZE);
 LEAN_CASSERT(LEAN_SEGMENT_SIZE > LEAN_PAGE_SIZE);
@@ -44,6 +58,15 @@ static atomic<uint64> g_num_segments(0);
 static atomic<uint64> g_num_pages(0);
 static atomic<uint64> g_num_exports(0);
 static atomic<uint64> g_num_recycled_pages(0);
+static atomic<uint64> g_num_remote_frees(0);
+static atomic<uint64> g_num_remote_free_batches(0);
+static atomic<uint64> g_num_remote_free_pages(0);
+static atomic<uint64> g_num_empty_segments(0);
+static atomic<uint64> g_num_reused_segments(0);
+static atomic<uint64> g_num_freed_segments(0);
+static atomic<uint64> g_num_decommitted_bytes(0);
+static atomic<uint64> g_num_huge_segments(0);
+static atomic<uint64> g_num_numa_segments(0);
 struct alloc_stats {
     ~alloc_stats() {
         std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
@@ -54,6 +77,15 @@ struct alloc_stats {
         std::cerr << "num. pages:          " << g_num_pages << "\n";
         std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
         std::cerr << "num. exports:        " << g_num_exports << "\n";
+        std::cerr << "num. remote frees:   " << g_num_remote_frees << "\n";
+        std::cerr << "num. remote batches: " << g_num_remote_free_batches << "\n";
+        std::cerr << "num. remote pages:   " << g_num_remote_free_pages << "\n";
+        std::cerr << "num. empty segments: " << g_num_empty_segments << "\n";
+        std::cerr << "num. reused segm.:   " << g_num_reused_segments << "\n";
+        std::cerr << "num. freed segments: " << g_num_freed_segments << "\n";
+        std::cerr << "decommitted bytes:   " << g_num_decommitted_bytes << "\n";
+        std::cerr << "num. huge segments:  " << g_num_huge_segments << "\n";
+        std::cerr << "num. NUMA segments:  " << g_num_numa_segments << "\n";
     }
 };
 static alloc_stats g_alloc_stats;
@@ -61,16 +93,22 @@ static alloc_stats g_alloc_stats;
 
 struct heap;
 struct page;
+struct segment;
 struct page_header {
-    atomic<heap *>   m_heap;
-    page *           m_next;
-    page *           m_prev;
-    void *           m_free_list;
-    unsigned         m_obj_size;
-    unsigned         m_max_free;
-    unsigned         m_num_free;
-    unsigned         m_slot_idx;
-    bool             m_in_page_free_list;
+    atomic<heap *>       m_heap;
+    page *               m_next;
+    page *               m_prev;
+    void *               m_free_list;
+    /* Objects of this page deallocated by other heaps, see `push_remote_frees`. */
+    std::atomic<void *>  m_remote_free;
+    /* Next page in `heap::m_remote_free_pages`. */
+    page *               m_next_remote;
+    segment *            m_segment;
+    unsigned             m_obj_size;
+    unsigned             m_max_free;
+    unsigned             m_num_free;
+    unsigned             m_slot_idx;
+    bool                 m_in_page_free_list;
 };
 
 struct page {
@@ -83,6 +121,7 @@ struct page {
     void set_heap(heap * h) { m_header.m_heap = h; }
     heap * get_heap() { return m_header.m_heap; }
     bool has_many_free() const { return m_header.m_num_free > m_header.m_max_free / 4; }
+    bool is_empty() const { return m_header.m_num_free == m_header.m_max_free; }
     bool in_page_free_list() const { return m_header.m_in_page_free_list; }
     unsigned get_slot_idx() const { return m_header.m_slot_idx; }
     void push_free_obj(void * o);
@@ -95,6 +134,12 @@ inline char * align_ptr(char * p, size_t a) {
 struct segment {
     segment *    m_next{nullptr};
     char *       m_next_page_mem;
+    /* Number of pages allocated in this segment. */
+    unsigned     m_num_pages{0};
+    /* Number of pages in a `heap::m_page_free_list` that do not contain any live object. */
+    unsigned     m_num_empty_pages{0};
+    /* True if the segment was allocated by `alloc_huge_segment`. */
+    bool         m_huge{false};
     char         m_data[LEAN_SEGMENT_SIZE];
 
     char * get_first_page_mem() {
@@ -107,9 +152,20 @@ struct segment {
         m_next_page_mem = get_first_page_mem();
     }
 
+    void reset() {
+        m_next            = nullptr;
+        m_next_page_mem   = get_first_page_mem();
+        m_num_pages       = 0;
+        m_num_empty_pages = 0;
+    }
+
     bool is_full() const {
         return m_next_page_mem + LEAN_PAGE_SIZE > m_data + LEAN_SEGMENT_SIZE;
     }
+
+    bool is_empty() const {
+        return m_num_empty_pages == m_num_pages;
+    }
 };
 
 struct heap {
@@ -120,14 +176,21 @@ struct heap {
     /* Objects that must be sent to other heaps. */
     void *    m_to_export_list{nullptr};
     unsigned  m_to_export_list_size{0};
-    mutex     m_mutex; /* for the following fields */
-    /* The following list contains object by this heap that were deallocated
-       by other heaps. */
-    void *    m_to_import_list{nullptr};
+    /* Pages owned by this heap with a nonempty `m_remote_free` list. Other heaps push pages here,
+       only the owner removes them (all at once). */
+    std::atomic<page *> m_remote_free_pages{nullptr};
+    /* Empty segments whose memory has been returned to the OS, reused by `alloc_segment`. */
+    segment * m_segment_cache{nullptr};
+    unsigned  m_segment_cache_size{0};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
+    /* NUMA node new segments should be placed on when `g_huge_page_segments` is set, or -1 if not resolved yet.
+       It is resolved by `alloc_segment` on the owning thread, as `g_huge_page_segments` may be set after the heap
+       of the main thread has been created. */
+    int       m_numa_node{-1};
     void import_objs();
     void export_objs();
     void alloc_segment();
+    void free_segment(segment * s);
 };
 
 struct heap_manager {
@@ -175,29 +238,30 @@ static inline void page_list_insert(page * & head, page * new_head) {
     if (head)
         head->set_prev(new_head);
     new_head->set_next(head);
+    new_head->set_prev(nullptr);
     head = new_head;
 }
 
 static inline void page_list_remove(page * & head, page * to_remove) {
-    if (head == to_remove) {
-        /* First element */
-        head = to_remove->get_next();
-    }
     page * prev = to_remove->get_prev();
-    lean_assert(prev);
-    if (page * next = to_remove->get_next()) {
+    page * next = to_remove->get_next();
+    if (prev) {
         prev->set_next(next);
-        next->set_prev(prev);
     } else {
-        /* Last element */
-        prev->set_next(nullptr);
+        /* First element */
+        lean_assert(head == to_remove);
+        head = next;
     }
+    if (next)
+        next->set_prev(prev);
 }
 
 static inline page * page_list_pop(page * & head) {
     lean_assert(head);
     page * r = head;
     head = head->get_next();
+    if (head)
+        head->set_prev(nullptr);
     return r;
 }
 
@@ -216,72 +280,230 @@ void page::push_free_obj(void * o) {
             page_list_insert(h->m_page_free_list[slot_idx], this);
         }
     }
+    if (in_page_free_list() && is_empty()) {
+        /* Remark: `this` may be freed by `free_segment`. */
+        segment * s = m_header.m_segment;
+        s->m_num_empty_pages++;
+        heap * h = get_heap();
+        if (s->is_empty() && s != h->m_curr_segment)
+            h->free_segment(s);
+    }
 }
 
+/* Move the objects other heaps deallocated in our pages to the local free lists. */
 void heap::import_objs() {
-    void * to_import = nullptr;
-    {   // TODO(Leo): avoid mutex using compare and swap
-        lock_guard<mutex> lock(m_mutex);
-        to_import = m_to_import_list;
-        m_to_import_list = nullptr;
+    page * p = m_remote_free_pages.exchange(nullptr, std::memory_order_acquire);
+    while (p) {
+        /* `p` may be pushed again as soon as we take its `m_remote_free` list */
+        page * next_p = p->m_header.m_next_remote;
+        void * o      = p->m_header.m_remote_free.exchange(nullptr, std::memory_order_acquire);
+        while (o) {
+            void * n = get_next_obj(o);
+            p->push_free_obj(o);
+            o = n;
+        }
+        p = next_p;
     }
-    while (to_import) {
-        page * p = get_page_of(to_import);
-        void * n = get_next_obj(to_import);
-        p->push_free_obj(to_import);
-        to_import = n;
+}
+
+/* Add the list of objects `head ... tail` of page `p` to its `m_remote_free` list.
+   The thread that makes this list nonempty is responsible for registering `p` at its owner heap. */
+static void push_remote_frees(page * p, void * head, void * tail) {
+    LEAN_RUNTIME_STAT_CODE(g_num_remote_free_batches++);
+    void * old_head = p->m_header.m_remote_free.load(std::memory_order_relaxed);
+    do {
+        set_next_obj(tail, old_head);
+    } while (!p->m_header.m_remote_free.compare_exchange_weak(old_head, head, std::memory_order_release, std::memory_order_relaxed));
+    if (old_head == nullptr) {
+        LEAN_RUNTIME_STAT_CODE(g_num_remote_free_pages++);
+        heap * h = p->get_heap();
+        page * old_p = h->m_remote_free_pages.load(std::memory_order_relaxed);
+        do {
+            p->m_header.m_next_remote = old_p;
+        } while (!h->m_remote_free_pages.compare_exchange_weak(old_p, p, std::memory_order_release, std::memory_order_relaxed));
     }
 }
 
 struct export_entry {
-    heap * m_heap;
+    page * m_page;
     void * m_head;
     void * m_tail;
 };
 
 void heap::export_objs() {
+    /* Batch objects by page so that each page takes a single compare-and-swap.
+       Objects freed together tend to come from a few pages, so a linear search suffices. */
     std::vector<export_entry> to_export;
     void * o = m_to_export_list;
     while (o != nullptr) {
-        void * n   = get_next_obj(o);
-        heap * h   = get_page_of(o)->get_heap();
-        bool found = false;
-        for (export_entry & e : to_export) {
-            if (e.m_heap == h) {
-                set_next_obj(o, e.m_head);
-                e.m_head = o;
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
+        void * n = get_next_obj(o);
+        page * p = get_page_of(o);
+        auto it  = std::find_if(to_export.begin(), to_export.end(), [&](export_entry const & e) { return e.m_page == p; });
+        if (it == to_export.end()) {
             set_next_obj(o, nullptr);
-            to_export.push_back(export_entry{h, o, o});
+            to_export.push_back(export_entry{p, o, o});
+        } else {
+            set_next_obj(o, it->m_head);
+            it->m_head = o;
         }
         o = n;
     }
     m_to_export_list      = nullptr;
     m_to_export_list_size = 0;
-    for (export_entry const & e : to_export) {
-        unique_lock<mutex> lock(e.m_heap->m_mutex);
-        set_next_obj(e.m_tail, e.m_heap->m_to_import_list);
-        e.m_heap->m_to_import_list = e.m_head;
+    for (export_entry const & e : to_export)
+        push_remote_frees(e.m_page, e.m_head, e.m_tail);
+}
+
+/* When set, new segments are aligned to `LEAN_HUGE_PAGE_SIZE` so that the kernel can back them with transparent
+   huge pages, and placed on the NUMA node of the thread owning the heap. See `set_huge_page_segments`. */
+static bool g_huge_page_segments = false;
+
+#if defined(__linux__)
+/* From <linux/mempolicy.h> */
+#define LEAN_MPOL_PREFERRED 1
+#define LEAN_MAX_NUMA_NODES 1024
+
+static size_t huge_segment_size() {
+    return lean_align(sizeof(segment), LEAN_HUGE_PAGE_SIZE);
+}
+
+/* Return the NUMA node of the CPU the current thread is running on, or -1 if it cannot be determined. */
+static int get_current_numa_node() {
+#if defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < LEAN_MAX_NUMA_NODES)
+        return node;
+#endif
+    return -1;
+}
+
+/* Ask the kernel to place the pages of `[begin, begin + sz)` on `numa_node`. We use a preferred policy instead of
+   a strict binding so that we fall back to other nodes instead of failing when the node runs out of memory. */
+static bool bind_to_numa_node(char * begin, size_t sz, int numa_node) {
+#if defined(SYS_mbind)
+    unsigned long mask[LEAN_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+    mask[numa_node / (8 * sizeof(unsigned long))] |= 1ul << (numa_node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, begin, sz, LEAN_MPOL_PREFERRED, mask, LEAN_MAX_NUMA_NODES, 0) == 0;
+#else
+    (void)begin; (void)sz; (void)numa_node;
+    return false;
+#endif
+}
+
+static segment * alloc_huge_segment(int numa_node) {
+    size_t sz       = huge_segment_size();
+    size_t alloc_sz = sz + LEAN_HUGE_PAGE_SIZE;
+    void * mem = mmap(nullptr, alloc_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return nullptr;
+    /* Trim the unaligned prefix and the excess suffix. */
+    char * begin = align_ptr(static_cast<char*>(mem), LEAN_HUGE_PAGE_SIZE);
+    char * end   = begin + sz;
+    if (begin > static_cast<char*>(mem))
+        munmap(mem, begin - static_cast<char*>(mem));
+    if (static_cast<char*>(mem) + alloc_sz > end)
+        munmap(end, static_cast<char*>(mem) + alloc_sz - end);
+#if defined(MADV_HUGEPAGE)
+    madvise(begin, sz, MADV_HUGEPAGE);
+#endif
+    if (numa_node >= 0 && bind_to_numa_node(begin, sz, numa_node)) {
+        LEAN_RUNTIME_STAT_CODE(g_num_numa_segments++);
     }
+    LEAN_RUNTIME_STAT_CODE(g_num_huge_segments++);
+    segment * s = new (begin) segment();
+    s->m_huge   = true;
+    return s;
+}
+#endif
+
+static void delete_segment(segment * s) {
+#if defined(__linux__)
+    if (s->m_huge) {
+        s->~segment();
+        munmap(s, huge_segment_size());
+        return;
+    }
+#endif
+    delete s;
 }
 
 void heap::alloc_segment() {
-    LEAN_RUNTIME_STAT_CODE(g_num_segments++);
-    segment * s = new segment();
+    segment * s = nullptr;
+    if (m_segment_cache) {
+        LEAN_RUNTIME_STAT_CODE(g_num_reused_segments++);
+        s = m_segment_cache;
+        m_segment_cache = s->m_next;
+        m_segment_cache_size--;
+        s->reset();
+    } else {
+        LEAN_RUNTIME_STAT_CODE(g_num_segments++);
+#if defined(__linux__)
+        if (g_huge_page_segments) {
+            if (m_numa_node < 0)
+                m_numa_node = get_current_numa_node();
+            s = alloc_huge_segment(m_numa_node);
+        }
+#endif
+        if (!s)
+            s = new segment();
+    }
     s->m_next   = m_curr_segment;
     m_curr_segment = s;
 }
 
+/* Return the physical memory of the pages in `[begin, end)` to the OS, and return the number of bytes released. */
+static size_t decommit_memory(char * begin, char * end) {
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+    static size_t os_page_size = sysconf(_SC_PAGESIZE);
+    begin = align_ptr(begin, os_page_size);
+    end   = reinterpret_cast<char*>((reinterpret_cast<size_t>(end) / os_page_size) * os_page_size);
+    if (begin < end && madvise(begin, end - begin, MADV_DONTNEED) == 0)
+        return end - begin;
+#else
+    (void)begin; (void)end;
+#endif
+    return 0;
+}
+
+/* Release a segment without live objects. Its memory is returned to the OS, and the segment itself is
+   kept in a small per-heap cache for `alloc_segment`. */
+void heap::free_segment(segment * s) {
+    LEAN_RUNTIME_STAT_CODE(g_num_empty_segments++);
+    lean_assert(s->is_empty());
+    lean_assert(s != m_curr_segment);
+    for (char * m = s->get_first_page_mem(); m < s->m_next_page_mem; m += LEAN_PAGE_SIZE) {
+        page * p = reinterpret_cast<page*>(m);
+        lean_assert(p->in_page_free_list() && p->is_empty());
+        lean_assert(p->m_header.m_remote_free.load() == nullptr);
+        page_list_remove(m_page_free_list[p->get_slot_idx()], p);
+    }
+    segment ** it = &m_curr_segment;
+    while (*it != s)
+        it = &(*it)->m_next;
+    *it = s->m_next;
+    if (m_segment_cache_size < LEAN_MAX_CACHED_SEGMENTS) {
+        size_t sz = decommit_memory(s->get_first_page_mem(), s->m_next_page_mem);
+        LEAN_RUNTIME_STAT_CODE(g_num_decommitted_bytes += sz);
+        (void)sz;
+        s->m_next       = m_segment_cache;
+        m_segment_cache = s;
+        m_segment_cache_size++;
+    } else {
+        LEAN_RUNTIME_STAT_CODE(g_num_freed_segments++);
+        delete_segment(s);
+    }
+}
+
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
     segment * s = h->m_curr_segment;
     LEAN_RUNTIME_STAT_CODE(g_num_pages++);
     page * p    = new (s->m_next_page_mem) page();
     s->m_next_page_mem += LEAN_PAGE_SIZE;
+    s->m_num_pages++;
+    p->m_header.m_segment     = s;
+    p->m_header.m_remote_free = nullptr;
+    p->m_header.m_next_remote = nullptr;
     if (s->is_full()) {
         /* s is full, we need to allocate a new one. */
         h->alloc_segment();
@@ -334,6 +556,8 @@ static void init_heap(bool main) {
     if (heap * h = g_heap_manager->pop_orphan()) {
         /* reuse orphan heap */
         g_heap = h;
+        /* the new owner may run on a different NUMA node */
+        g_heap->m_numa_node = -1;
     } else {
         g_heap = new heap();
         g_curr_pages = g_heap->m_curr_page;
@@ -363,13 +587,19 @@ void init_thread_heap() {
 LEAN_NOINLINE
 void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
     if (g_heap->m_page_free_list[slot_idx] == nullptr) {
+        /* g_heap->import_objs() may add objects to p->m_header.m_free_list or
+           move other pages to g_heap->m_page_free_list[slot_idx] */
         g_heap->import_objs();
         lean_assert(g_heap->m_curr_page[slot_idx] == p);
-        /* g_heap->import_objs() may add objects to p->m_header.m_free_list */
-        if (p->m_header.m_free_list == nullptr)
-            p = alloc_page(g_heap, sz);
+    }
+    if (p->m_header.m_free_list != nullptr) {
+        /* reuse p */
+    } else if (g_heap->m_page_free_list[slot_idx] == nullptr) {
+        p = alloc_page(g_heap, sz);
     } else {
         p = page_list_pop(g_heap->m_page_free_list[slot_idx]);
+        if (p->is_empty())
+            p->m_header.m_segment->m_num_empty_pages--;
         p->m_header.m_in_page_free_list = false;
         page_list_insert(g_heap->m_curr_page[slot_idx], p);
     }
@@ -410,6 +640,7 @@ void * alloc(size_t sz) {
 
 LEAN_NOINLINE
 static void dealloc_small_core_cold(void * o) {
+    LEAN_RUNTIME_STAT_CODE(g_num_remote_frees++);
     set_next_obj(o, g_heap->m_to_export_list);
     g_heap->m_to_export_list = o;
     g_heap->m_to_export_list_size++;
@@ -453,8 +684,20 @@ extern "C" LEAN_EXPORT unsigned lean_small_mem_size(void * o) {
 
 #endif
 
+void set_huge_page_segments(bool flag) {
+#if defined(LEAN_SMALL_ALLOCATOR) && defined(__linux__)
+    g_huge_page_segments = flag;
+#else
+    (void)flag;
+#endif
+}
+
 void initialize_alloc() {
 #ifdef LEAN_SMALL_ALLOCATOR
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * huge_pages = std::getenv("LEAN_HUGE_PAGES"))
+        set_huge_page_segments(atoi(huge_pages) != 0);
+#endif
     g_heap_manager = new heap_manager();
     init_heap(true);
 #endif
@@ -13,6 +13,9 @@ void init_thread_heap();
 void * alloc(size_t sz);
 void dealloc(void * o, size_t sz);
 uint64_t get_num_heartbeats();
+/* When `flag` is true, segments allocated afterwards are aligned for transparent huge pages and placed on the
+   NUMA node of the allocating thread. Only supported on Linux. Also enabled by setting `LEAN_HUGE_PAGES=1`. */
+void set_huge_page_segments(bool flag);
 void initialize_alloc();
 void finalize_alloc();
 }
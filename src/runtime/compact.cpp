@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <string>
 #include <vector>
+#include <limits>
 #include <cstring>
 #include <lean/lean.h>
 #include "runtime/hash.h"
@@ -95,6 +96,20 @@ void * object_compactor::alloc(size_t sz) {
     return r;
 }
 
+void object_compactor::add_reloc(void * ptr) {
+    size_t word = (static_cast<char*>(ptr) - static_cast<char*>(m_begin)) / sizeof(void*);
+    if (word > std::numeric_limits<object_reloc>::max())
+        lean_internal_panic("compacted region is too big");
+    m_relocs.push_back(static_cast<object_reloc>(word));
+}
+
+/* Store `o` at `ptr`, which must be in the region, recording it in `m_relocs` if it is a pointer. */
+inline void object_compactor::set_ptr(object ** ptr, object_offset o) {
+    *ptr = o;
+    if (!lean_is_scalar(o))
+        add_reloc(ptr);
+}
+
 void object_compactor::save(object * o, object * new_o) {
     lean_assert(m_begin <= new_o && new_o < m_end);
     m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin) + reinterpret_cast<size_t>(m_base_addr))));
@@ -105,6 +120,10 @@ void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o
     auto it = m_max_sharing_table->m_table.find(k);
     if (it != m_max_sharing_table->m_table.end()) {
         m_end = new_o;
+        /* drop the pointers of the discarded copy */
+        size_t new_o_word = (reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin)) / sizeof(void*);
+        while (!m_relocs.empty() && m_relocs.back() >= new_o_word)
+            m_relocs.pop_back();
         new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + it->m_offset);
     } else {
         m_max_sharing_table->m_table.insert(k);
@@ -192,7 +211,7 @@ bool object_compactor::insert_constructor(object * o) {
 #endif
     object * new_o = copy_object(o);
     for (unsigned i = 0; i < lean_ctor_num_objs(o); i++)
-        lean_ctor_set(new_o, i, offsets[i]);
+        set_ptr(lean_ctor_obj_cptr(new_o) + i, offsets[i]);
     save_max_sharing(o, new_o, lean_object_byte_size(o));
     return true;
 }
@@ -219,7 +238,7 @@ bool object_compactor::insert_array(object * o) {
     new_o->m_size     = sz;
     new_o->m_capacity = sz;
     for (size_t i = 0; i < sz; i++) {
-        lean_array_set_core((lean_object*)new_o, i, offsets[i]);
+        set_ptr(new_o->m_data + i, offsets[i]);
     }
     save_max_sharing(o, (lean_object*)new_o, obj_sz);
     return true;
@@ -231,7 +250,7 @@ bool object_compactor::insert_thunk(object * o) {
     if (c == g_null_offset)
         return false;
     object * r = copy_object(o);
-    lean_to_thunk(r)->m_value = c;
+    set_ptr(reinterpret_cast<object **>(&lean_to_thunk(r)->m_value), c);
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
 }
@@ -242,7 +261,7 @@ bool object_compactor::insert_ref(object * o) {
     if (c == g_null_offset)
         return false;
     object * r = copy_object(o);
-    lean_to_ref(r)->m_value = c;
+    set_ptr(&lean_to_ref(r)->m_value, c);
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
 }
@@ -254,7 +273,7 @@ bool object_compactor::insert_task(object * o) {
         return false;
     object * r = copy_object(o);
     lean_assert(lean_to_task(r)->m_imp == nullptr);
-    lean_to_task(r)->m_value = c;
+    set_ptr(reinterpret_cast<object **>(&lean_to_task(r)->m_value), c);
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
 }
@@ -273,6 +292,7 @@ void object_compactor::insert_mpz(object * o) {
     memcpy(data, m._mp_d, data_sz);
     m._mp_d = reinterpret_cast<mp_limb_t *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
     m._mp_alloc = nlimbs;
+    add_reloc(&m._mp_d);
     save(o, (lean_object*)new_o);
 #else
     size_t data_sz = sizeof(mpn_digit) * to_mpz(o)->m_value.m_size;
@@ -283,6 +303,7 @@ void object_compactor::insert_mpz(object * o) {
     void * data = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
     memcpy(data, to_mpz(o)->m_value.m_digits, data_sz);
     new_o->m_value.m_digits = reinterpret_cast<mpn_digit *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
+    add_reloc(&new_o->m_value.m_digits);
     save(o, (lean_object*)new_o);
 #endif
 }
@@ -358,7 +379,13 @@ void object_compactor::operator()(object * o) {
         }
         m_tmp.clear();
     }
-    *static_cast<object_offset *>(m_begin) = to_offset(o);
+    set_ptr(static_cast<object_offset *>(m_begin), to_offset(o));
+}
+
+void relocate_compacted_data(void * data, object_reloc const * relocs, size_t num_relocs, size_t delta) {
+    size_t * words = static_cast<size_t *>(data);
+    for (size_t i = 0; i < num_relocs; i++)
+        words[relocs[i]] += delta;
 }
 
 compacted_region::compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data):
@@ -12,6 +12,12 @@ Author: Leonardo de Moura
 
 namespace lean {
 typedef lean_object * object_offset;
+/* Position of a pointer in a compacted region, in words from the beginning of the region. */
+typedef uint32 object_reloc;
+
+/* Add `delta` to each pointer of the compacted region starting at `data` listed in `relocs`.
+   See `object_compactor::relocs`. */
+void relocate_compacted_data(void * data, object_reloc const * relocs, size_t num_relocs, size_t delta);
 
 class object_compactor {
     struct max_sharing_table;
@@ -21,6 +27,7 @@ class object_compactor {
     std::unique_ptr<max_sharing_table> m_max_sharing_table;
     std::vector<object*> m_todo;
     std::vector<object_offset> m_tmp;
+    std::vector<object_reloc> m_relocs;
     // On-disk base address used for `mmap`ing compacted regions without relocations
     // References within the compacted region are rewritten by subtracting `m_begin` and adding `m_base_addr`
     // In the simplest case `base_addr == nullptr`, we get region-relative pointers
@@ -32,6 +39,8 @@ class object_compactor {
     void save(object * o, object * new_o);
     void save_max_sharing(object * o, object * new_o, size_t new_o_sz);
     void * alloc(size_t sz);
+    void add_reloc(void * ptr);
+    void set_ptr(object ** ptr, object_offset o);
     object_offset to_offset(object * o);
     void insert_terminator(object * o);
     object * copy_object(object * o);
@@ -53,6 +62,10 @@ public:
     void operator()(object * o);
     size_t size() const { return static_cast<char*>(m_end) - static_cast<char*>(m_begin); }
     void const * data() const { return m_begin; }
+    /* Positions of all pointers (that is, non-scalar references) in `data()`. Storing them with the region
+       allows mapping it at an address different from `base_addr` by just adding the difference to these words,
+       without walking the objects. */
+    std::vector<object_reloc> const & relocs() const { return m_relocs; }
 };
 
 class compacted_region {
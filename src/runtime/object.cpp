@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <vector>
 #include <deque>
+#include <memory>
 #include <cmath>
 #include <lean/lean.h>
 #include "runtime/object.h"
@@ -44,6 +45,14 @@ Author: Leonardo de Moura
 // see `Task.Priority.max`
 #define LEAN_MAX_PRIO 8
 
+namespace lean { struct task_wait_event; }
+
+/* Node of a `lean_task_object::m_waiters` list, see `task_manager::add_waiter`. */
+struct lean_task_waiter {
+    lean_task_waiter *      m_next;
+    lean::task_wait_event * m_event;
+};
+
 namespace lean {
 
 static void abort_on_panic() {
@@ -366,6 +375,50 @@ extern "C" LEAN_EXPORT lean_obj_res lean_array_set_panic(lean_obj_arg a, lean_ob
 // =======================================
 // Thunks
 
+/* A thread that finds another thread evaluating a thunk spins for `LEAN_THUNK_SPIN_ITERS` iterations and then parks
+   on one of the `LEAN_THUNK_PARKING_SLOTS` slots, selected by the address of the thunk. The thread evaluating the
+   thunk only takes the slot lock to wake up parked threads if `m_num_waiters` is not zero. */
+#define LEAN_THUNK_SPIN_ITERS    128
+#define LEAN_THUNK_PARKING_SLOTS 64
+
+struct thunk_parking_slot {
+    mutex                 m_mutex;
+    condition_variable    m_cv;
+    std::atomic<unsigned> m_num_waiters{0};
+};
+
+static thunk_parking_slot * g_thunk_parking_slots = nullptr;
+
+static thunk_parking_slot & get_thunk_parking_slot(b_obj_arg t) {
+    return g_thunk_parking_slots[(reinterpret_cast<size_t>(t) / sizeof(lean_thunk_object)) % LEAN_THUNK_PARKING_SLOTS];
+}
+
+static void thunk_unpark_waiters(b_obj_arg t) {
+    thunk_parking_slot & slot = get_thunk_parking_slot(t);
+    /* `m_value` was stored before this sequentially consistent load, and waiters increment `m_num_waiters`
+       before checking `m_value`, so either they see the value or we see them. */
+    if (slot.m_num_waiters.load() > 0) {
+        lock_guard<mutex> lock(slot.m_mutex);
+        slot.m_cv.notify_all();
+    }
+}
+
+static b_obj_res thunk_wait(b_obj_arg t) {
+    for (unsigned i = 0; i < LEAN_THUNK_SPIN_ITERS; i++) {
+        if (object * v = lean_to_thunk(t)->m_value)
+            return v;
+        this_thread::yield();
+    }
+    thunk_parking_slot & slot = get_thunk_parking_slot(t);
+    unique_lock<mutex> lock(slot.m_mutex);
+    slot.m_num_waiters++;
+    /* Other thunks may share the slot, so we must re-check after every wakeup. */
+    while (!lean_to_thunk(t)->m_value)
+        slot.m_cv.wait(lock);
+    slot.m_num_waiters--;
+    return lean_to_thunk(t)->m_value;
+}
+
 extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
     object * c = lean_to_thunk(t)->m_closure.exchange(nullptr);
     if (c != nullptr) {
@@ -381,15 +434,13 @@ extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
         lean_assert(lean_to_thunk(t)->m_value == nullptr);
         mark_mt(r);
         lean_to_thunk(t)->m_value = r;
+        thunk_unpark_waiters(t);
         return r;
     } else {
         lean_assert(c == nullptr);
-        /* There is another thread executing the closure. We keep waiting for the m_value to be
+        /* There is another thread executing the closure. We wait for the m_value to be
            set by another thread. */
-        while (!lean_to_thunk(t)->m_value) {
-            this_thread::yield();
-        }
-        return lean_to_thunk(t)->m_value;
+        return thunk_wait(t);
     }
 }
 
@@ -551,11 +602,16 @@ extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
 // Tasks
 
 LEAN_THREAD_PTR(lean_task_object, g_current_task_object);
+/* See `scoped_inherited_task_cancellation`. */
+LEAN_THREAD_PTR(lean_task_object, g_inherited_task_object);
+
+/* Value of `m_head_dep` and `m_waiters` after the task has finished. */
+static lean_task_object * const g_closed_deps    = reinterpret_cast<lean_task_object *>(1);
+static lean_task_waiter * const g_closed_waiters = reinterpret_cast<lean_task_waiter *>(1);
 
 static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive) {
     lean_task_imp * imp = (lean_task_imp*)lean_alloc_small_object(sizeof(lean_task_imp));
     imp->m_closure     = c;
-    imp->m_head_dep    = nullptr;
     imp->m_next_dep    = nullptr;
     imp->m_prio        = prio;
     imp->m_canceled    = false;
@@ -577,35 +633,196 @@ struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
+/* Event a thread blocked in `lean_task_get` or `lean_io_wait_any_core` is waiting for. It is shared by the
+   waiting thread and the `lean_task_waiter` nodes it registered, so that finishing a task only wakes up the
+   threads waiting for that specific task. */
+struct task_wait_event {
+    std::atomic<unsigned> m_rc{1};
+    /* Set by `wait_any` when it returns, the nodes referring to the event are then stale. */
+    std::atomic<bool>     m_abandoned{false};
+    mutex                 m_mutex;
+    condition_variable    m_cv;
+    bool                  m_signaled{false};
+
+    void inc_ref() { m_rc++; }
+    void dec_ref() { if (--m_rc == 0) delete this; }
+
+    void signal() {
+        lock_guard<mutex> lock(m_mutex);
+        m_signaled = true;
+        m_cv.notify_one();
+    }
+
+    void wait() {
+        unique_lock<mutex> lock(m_mutex);
+        m_cv.wait(lock, [&]() { return m_signaled; });
+    }
+};
+
+/* Chase-Lev work-stealing deque of tasks, see "Correct and Efficient Work-Stealing for Weak Memory Models"
+   (Le, Pop, Cohen, Zappa Nardelli; PPoPP 2013).
+   Only the owner worker may `push` and `pop` (at the bottom), any thread may `steal` (at the top).
+   Buffers replaced by `grow` are only released when the deque is destroyed since a concurrent
+   `steal` may still be reading from them. */
+class task_deque {
+    struct buffer {
+        int64_t                                             m_mask;
+        std::unique_ptr<std::atomic<lean_task_object *>[]> m_data;
+        explicit buffer(int64_t capacity):m_mask(capacity - 1), m_data(new std::atomic<lean_task_object *>[capacity]) {}
+        int64_t capacity() const { return m_mask + 1; }
+        lean_task_object * get(int64_t i) const { return m_data[i & m_mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, lean_task_object * t) { m_data[i & m_mask].store(t, std::memory_order_relaxed); }
+    };
+    std::atomic<int64_t>                 m_top{0};
+    std::atomic<int64_t>                 m_bottom{0};
+    std::atomic<buffer *>                m_buffer;
+    /* Current and retired buffers, only accessed by the owner. */
+    std::vector<std::unique_ptr<buffer>> m_buffers;
+
+    buffer * grow(buffer * a, int64_t top, int64_t bottom) {
+        buffer * new_a = new buffer(2 * a->capacity());
+        for (int64_t i = top; i < bottom; i++)
+            new_a->put(i, a->get(i));
+        m_buffers.emplace_back(new_a);
+        m_buffer.store(new_a, std::memory_order_release);
+        return new_a;
+    }
+public:
+    explicit task_deque(int64_t capacity = 32) {
+        lean_assert((capacity & (capacity - 1)) == 0);
+        m_buffers.emplace_back(new buffer(capacity));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    void push(lean_task_object * t) {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top    = m_top.load(std::memory_order_acquire);
+        buffer * a     = m_buffer.load(std::memory_order_relaxed);
+        if (bottom - top > a->capacity() - 1)
+            a = grow(a, top, bottom);
+        a->put(bottom, t);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    lean_task_object * pop() {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        buffer * a     = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top    = m_top.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        lean_task_object * t = a->get(bottom);
+        if (top == bottom) {
+            /* last element, race against thieves */
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                t = nullptr;
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    lean_task_object * steal() {
+        int64_t top    = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return nullptr;
+        buffer * a = m_buffer.load(std::memory_order_acquire);
+        lean_task_object * t = a->get(top);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr; /* lost the race against the owner or another thief */
+        return t;
+    }
+};
+
+/* Task queues owned by a standard worker thread, one deque per priority. */
+struct task_worker {
+    unsigned   m_idx;
+    bool       m_active{false}; // protected by `task_manager::m_queue_mutex`
+    task_deque m_deques[LEAN_MAX_PRIO+1];
+    explicit task_worker(unsigned idx):m_idx(idx) {}
+};
+
+/* The `task_worker` of the current thread if it is a standard worker. */
+LEAN_THREAD_PTR(task_worker, g_current_task_worker);
+
+/* Task scheduler.
+
+   Standard workers push the tasks they enqueue into their own per-priority `task_deque`, pop from it, and steal
+   from the other workers when they run out of work. Tasks enqueued by any other thread go to the shared
+   "injection" queues protected by `m_inject_mutex`. For each priority level, the number of tasks queued anywhere
+   is tracked in `m_num_queued` so that workers service higher priorities first and can skip empty levels.
+
+   Idle workers sleep on `m_queue_cv`. A worker only goes to sleep after it has registered itself in
+   `m_idle_std_workers` and then observed `m_queues_size == 0`, while enqueueing first increments `m_queues_size`
+   and then checks for idle workers; since both are sequentially consistent, at least one side observes the other.
+
+   Dependent tasks and blocked threads are registered on the lock-free `m_head_dep`/`m_waiters` lists of the task
+   they wait for (see `add_dep` and `add_waiter`), and only these are woken up when it finishes. State transitions
+   (running, resolving and deactivating a task) are protected by `m_mutex`. Lock order is `m_mutex` before
+   `m_queue_mutex`/`m_inject_mutex`. */
 class task_manager {
     mutex                                         m_mutex;
-    unsigned                                      m_num_std_workers{0};
-    unsigned                                      m_idle_std_workers{0};
+    mutex                                         m_queue_mutex;
+    mutex                                         m_inject_mutex;
+    std::atomic<unsigned>                         m_num_std_workers{0};
+    std::atomic<unsigned>                         m_idle_std_workers{0};
     unsigned                                      m_max_std_workers{0};
     unsigned                                      m_num_dedicated_workers{0};
-    std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
-    unsigned                                      m_max_prio{0};
+    /* `m_workers[i]` for `i < m_num_worker_slots` are valid; slots are reused after a worker exits. */
+    std::unique_ptr<std::atomic<task_worker *>[]> m_workers;
+    std::atomic<unsigned>                         m_num_worker_slots{0};
+    std::deque<lean_task_object *>                m_inject_queues[LEAN_MAX_PRIO+1];
+    std::atomic<unsigned>                         m_inject_queues_size[LEAN_MAX_PRIO+1];
+    std::atomic<unsigned>                         m_num_queued[LEAN_MAX_PRIO+1];
+    std::atomic<unsigned>                         m_queues_size{0};
     condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
     condition_variable                            m_worker_finished_cv;
-    bool                                          m_shutting_down{false};
-
-    lean_task_object * dequeue() {
-        lean_assert(m_queues_size != 0);
-        std::deque<lean_task_object *> & q = m_queues[m_max_prio];
-        lean_assert(!q.empty());
-        lean_task_object * result      = q.front();
+    std::atomic<bool>                             m_shutting_down{false};
+
+    lean_task_object * dequeue_injected(unsigned prio) {
+        if (m_inject_queues_size[prio].load(std::memory_order_relaxed) == 0)
+            return nullptr;
+        lock_guard<mutex> lock(m_inject_mutex);
+        std::deque<lean_task_object *> & q = m_inject_queues[prio];
+        if (q.empty())
+            return nullptr;
+        lean_task_object * result = q.front();
         q.pop_front();
-        m_queues_size--;
-        if (q.empty()) {
-            while (m_max_prio > 0) {
-                --m_max_prio;
-                if (!m_queues[m_max_prio].empty())
-                    break;
+        m_inject_queues_size[prio]--;
+        return result;
+    }
+
+    lean_task_object * steal(task_worker * w, unsigned prio) {
+        unsigned n = m_num_worker_slots.load(std::memory_order_acquire);
+        for (unsigned i = 1; i < n; i++) {
+            task_worker * victim = m_workers[(w->m_idx + i) % n].load(std::memory_order_acquire);
+            if (lean_task_object * t = victim->m_deques[prio].steal())
+                return t;
+        }
+        return nullptr;
+    }
+
+    /* Return the next task for worker `w`, or `nullptr` if none could be found. */
+    lean_task_object * dequeue(task_worker * w) {
+        unsigned prio = LEAN_MAX_PRIO + 1;
+        while (prio-- > 0) {
+            if (m_num_queued[prio].load() == 0)
+                continue;
+            lean_task_object * t = w->m_deques[prio].pop();
+            if (!t) t = dequeue_injected(prio);
+            if (!t) t = steal(w, prio);
+            if (t) {
+                m_num_queued[prio]--;
+                m_queues_size--;
+                return t;
             }
         }
-        return result;
+        return nullptr;
     }
 
     void enqueue_core(lean_task_object * t) {
@@ -615,21 +832,34 @@ class task_manager {
             spawn_dedicated_worker(t);
             return;
         }
-        if (prio > m_max_prio)
-            m_max_prio = prio;
-        m_queues[prio].push_back(t);
+        if (task_worker * w = g_current_task_worker) {
+            w->m_deques[prio].push(t);
+        } else {
+            lock_guard<mutex> lock(m_inject_mutex);
+            m_inject_queues[prio].push_back(t);
+            m_inject_queues_size[prio]++;
+        }
+        m_num_queued[prio]++;
         m_queues_size++;
-        if (!m_idle_std_workers && m_num_std_workers < m_max_std_workers)
-            spawn_worker();
-        else
+        if (m_idle_std_workers.load() > 0) {
+            unique_lock<mutex> lock(m_queue_mutex);
             m_queue_cv.notify_one();
+        } else if (m_num_std_workers.load() < m_max_std_workers) {
+            unique_lock<mutex> lock(m_queue_mutex);
+            if (m_idle_std_workers == 0 && m_num_std_workers < m_max_std_workers)
+                spawn_worker();
+            else
+                m_queue_cv.notify_one();
+        }
     }
 
     void deactivate_task_core(unique_lock<mutex> & lock, lean_task_object * t) {
         object * c              = t->m_imp->m_closure;
-        lean_task_object * it   = t->m_imp->m_head_dep;
+        /* No new dependencies can be added since the RC is 0. */
+        lean_task_object * it   = t->m_head_dep.exchange(nullptr);
+        /* Only stale nodes left behind by `wait_any` can still be here. */
+        lean_task_waiter * ws   = t->m_waiters.exchange(g_closed_waiters);
         t->m_imp->m_closure     = nullptr;
-        t->m_imp->m_head_dep    = nullptr;
         t->m_imp->m_canceled    = true;
         t->m_imp->m_deleted     = true;
         lock.unlock();
@@ -639,32 +869,57 @@ class task_manager {
             free_task(it);
             it = next_it;
         }
+        release_waiters(ws);
         if (c) dec_ref(c);
         lock.lock();
     }
 
+    /* Remark: must be invoked while holding `m_queue_mutex`. */
+    task_worker * acquire_worker_slot() {
+        unsigned n = m_num_worker_slots.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < n; i++) {
+            task_worker * w = m_workers[i].load(std::memory_order_relaxed);
+            if (!w->m_active) {
+                w->m_active = true;
+                return w;
+            }
+        }
+        lean_assert(n < m_max_std_workers);
+        task_worker * w = new task_worker(n);
+        w->m_active = true;
+        m_workers[n].store(w, std::memory_order_release);
+        m_num_worker_slots.store(n + 1, std::memory_order_release);
+        return w;
+    }
+
+    /* Remark: must be invoked while holding `m_queue_mutex`. */
     void spawn_worker() {
+        task_worker * w = acquire_worker_slot();
         m_num_std_workers++;
-        lthread([this]() {
+        lthread([this, w]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            m_idle_std_workers++;
+            g_current_task_worker = w;
+            unique_lock<mutex> lock(m_queue_mutex, std::defer_lock);
             while (true) {
+                if (lean_task_object * t = dequeue(w)) {
+                    run_task(t);
+                    reset_heartbeat();
+                    continue;
+                }
+                lock.lock();
+                m_idle_std_workers++;
                 if (m_queues_size == 0) {
                     if (m_shutting_down) {
+                        m_idle_std_workers--;
                         break;
                     }
                     m_queue_cv.wait(lock);
-                    continue;
                 }
-
-                lean_task_object * t = dequeue();
                 m_idle_std_workers--;
-                run_task(lock, t);
-                m_idle_std_workers++;
-                reset_heartbeat();
+                lock.unlock();
             }
-            m_idle_std_workers--;
+            g_current_task_worker = nullptr;
+            w->m_active = false;
             m_num_std_workers--;
             m_worker_finished_cv.notify_all();
         });
@@ -672,20 +927,25 @@ class task_manager {
     }
 
     void spawn_dedicated_worker(lean_task_object * t) {
-        m_num_dedicated_workers++;
+        {
+            unique_lock<mutex> lock(m_queue_mutex);
+            m_num_dedicated_workers++;
+        }
         lthread([this, t]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            run_task(lock, t);
+            run_task(t);
+            unique_lock<mutex> lock(m_queue_mutex);
             m_num_dedicated_workers--;
             m_worker_finished_cv.notify_all();
         });
         // see above
     }
 
-    void run_task(unique_lock<mutex> & lock, lean_task_object * t) {
+    void run_task(lean_task_object * t) {
+        unique_lock<mutex> lock(m_mutex);
         lean_assert(t->m_imp);
         if (t->m_imp->m_deleted) {
+            lock.unlock();
             free_task(t);
             return;
         }
@@ -708,7 +968,6 @@ class task_manager {
             lock.unlock();
             if (v) lean_dec(v);
             free_task(t);
-            lock.lock();
         } else if (v != nullptr) {
             lean_assert(t->m_imp->m_closure == nullptr);
             resolve_core(t, v);
@@ -716,24 +975,26 @@ class task_manager {
             // `bind` task has not finished yet, re-add as dependency of nested task
             lock.unlock();
             add_dep(lean_to_task(closure_arg_cptr(t->m_imp->m_closure)[0]), t);
-            lock.lock();
         }
     }
 
+    /* Remark: must be invoked while holding `m_mutex`, which keeps `t` from being freed by `deactivate_task`
+       after `m_value` has been published. */
     void resolve_core(lean_task_object * t, object * v) {
-        handle_finished(t);
         mark_mt(v);
+        /* `m_value` must be set before closing the lists: `add_dep` and `add_waiter` rely on it
+           when they find a closed list. */
         t->m_value = v;
+        handle_finished(t);
         /* After the task has been finished and we propagated
            dependencies, we can release `m_imp` and keep just the value */
         free_task_imp(t->m_imp);
         t->m_imp   = nullptr;
-        m_task_finished_cv.notify_all();
+        release_waiters(t->m_waiters.exchange(g_closed_waiters));
     }
 
     void handle_finished(lean_task_object * t) {
-        lean_task_object * it = t->m_imp->m_head_dep;
-        t->m_imp->m_head_dep = nullptr;
+        lean_task_object * it = t->m_head_dep.exchange(g_closed_deps);
         while (it) {
             if (t->m_imp->m_canceled)
                 it->m_imp->m_canceled = true;
@@ -748,6 +1009,71 @@ class task_manager {
         }
     }
 
+    /* Wake up the threads waiting on the given (detached) `m_waiters` list and free its nodes. */
+    static void release_waiters(lean_task_waiter * it) {
+        if (it == g_closed_waiters)
+            return;
+        while (it) {
+            lean_task_waiter * next_it = it->m_next;
+            it->m_event->signal();
+            it->m_event->dec_ref();
+            delete it;
+            it = next_it;
+        }
+    }
+
+    /* Register `ev` to be signaled when `t` finishes. Return `false` if `t` has already finished. */
+    static bool add_waiter(lean_task_object * t, task_wait_event * ev) {
+        lean_task_waiter * w    = new lean_task_waiter{nullptr, ev};
+        lean_task_waiter * head = t->m_waiters.load();
+        do {
+            if (head == g_closed_waiters) {
+                lean_assert(t->m_value);
+                delete w;
+                return false;
+            }
+            w->m_next = head;
+        } while (!t->m_waiters.compare_exchange_weak(head, w));
+        ev->inc_ref();
+        return true;
+    }
+
+    /* Remove the nodes of abandoned events from the `m_waiters` list of `t`. The list is detached while it is
+       filtered, so concurrent `add_waiter` calls only see a shorter list; if `t` finishes in the meantime, the
+       remaining nodes are released here instead. */
+    static void purge_waiters(lean_task_object * t) {
+        lean_task_waiter * it = t->m_waiters.load();
+        do {
+            if (it == nullptr || it == g_closed_waiters)
+                return;
+        } while (!t->m_waiters.compare_exchange_weak(it, nullptr));
+        lean_task_waiter * keep      = nullptr;
+        lean_task_waiter * keep_last = nullptr;
+        while (it) {
+            lean_task_waiter * next_it = it->m_next;
+            if (it->m_event->m_abandoned.load()) {
+                it->m_event->dec_ref();
+                delete it;
+            } else {
+                it->m_next = keep;
+                keep       = it;
+                if (!keep_last)
+                    keep_last = it;
+            }
+            it = next_it;
+        }
+        if (!keep)
+            return;
+        lean_task_waiter * head = t->m_waiters.load();
+        do {
+            if (head == g_closed_waiters) {
+                release_waiters(keep);
+                return;
+            }
+            keep_last->m_next = head;
+        } while (!t->m_waiters.compare_exchange_weak(head, keep));
+    }
+
     object * wait_any_check(object * task_list) {
         object * it = task_list;
         while (!is_scalar(it)) {
@@ -761,19 +1087,25 @@ class task_manager {
 
 public:
     task_manager(unsigned max_std_workers):
-        m_max_std_workers(max_std_workers) {
+        m_max_std_workers(max_std_workers),
+        m_workers(new std::atomic<task_worker *>[max_std_workers]) {
+        for (unsigned prio = 0; prio <= LEAN_MAX_PRIO; prio++) {
+            m_inject_queues_size[prio] = 0;
+            m_num_queued[prio]         = 0;
+        }
     }
 
     ~task_manager() {
-        unique_lock<mutex> lock(m_mutex);
+        unique_lock<mutex> lock(m_queue_mutex);
         m_shutting_down = true;
         m_queue_cv.notify_all();
         // wait for all workers to finish
         m_worker_finished_cv.wait(lock, [&]() { return m_num_std_workers + m_num_dedicated_workers == 0; });
+        for (unsigned i = 0; i < m_num_worker_slots; i++)
+            delete m_workers[i].load();
     }
 
     void enqueue(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
         enqueue_core(t);
     }
 
@@ -792,34 +1124,54 @@ public:
             enqueue(t2);
             return;
         }
-        unique_lock<mutex> lock(m_mutex);
-        lean_assert(t2->m_value == nullptr);
-        if (t1->m_value) {
-            enqueue_core(t2);
-            return;
-        }
-        t2->m_imp->m_next_dep = t1->m_imp->m_head_dep;
-        t1->m_imp->m_head_dep = t2;
+        /* The caller owns a reference to `t1`, so it cannot be deactivated concurrently;
+           it can only finish, which closes the list. */
+        lean_task_object * head = t1->m_head_dep.load();
+        do {
+            if (head == g_closed_deps) {
+                lean_assert(t1->m_value);
+                enqueue(t2);
+                return;
+            }
+            t2->m_imp->m_next_dep = head;
+        } while (!t1->m_head_dep.compare_exchange_weak(head, t2));
     }
 
     void wait_for(lean_task_object * t) {
         if (t->m_value)
             return;
-        unique_lock<mutex> lock(m_mutex);
-        if (t->m_value)
-            return;
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        task_wait_event * ev = new task_wait_event();
+        if (add_waiter(t, ev))
+            ev->wait();
+        ev->dec_ref();
+        lean_assert(t->m_value);
     }
 
     object * wait_any(object * task_list) {
         if (object * t = wait_any_check(task_list))
             return t;
-        unique_lock<mutex> lock(m_mutex);
-        while (true) {
-            if (object * t = wait_any_check(task_list))
-                return t;
-            m_task_finished_cv.wait(lock);
+        /* Register on every task in the list. The nodes left on tasks that have not finished when we return
+           are unlinked again, so that waiting repeatedly on long-running tasks does not accumulate them. */
+        task_wait_event * ev = new task_wait_event();
+        bool wait = true;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1)) {
+            if (!add_waiter(lean_to_task(lean_ctor_get(it, 0)), ev)) {
+                wait = false;
+                break;
+            }
         }
+        if (wait)
+            ev->wait();
+        ev->m_abandoned = true;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1)) {
+            lean_task_object * t = lean_to_task(lean_ctor_get(it, 0));
+            if (!t->m_value)
+                purge_waiters(t);
+        }
+        ev->dec_ref();
+        object * t = wait_any_check(task_list);
+        lean_assert(t);
+        return t;
     }
 
     void deactivate_task(lean_task_object * t) {
@@ -915,8 +1267,10 @@ static lean_task_object * alloc_task(obj_arg c, unsigned prio, bool keep_alive)
     lean_mark_mt(c);
     lean_task_object * o = (lean_task_object*)lean_alloc_small_object(sizeof(lean_task_object));
     lean_set_task_header((lean_object*)o);
-    o->m_value = nullptr;
-    o->m_imp   = alloc_task_imp(c, prio, keep_alive);
+    o->m_value    = nullptr;
+    o->m_imp      = alloc_task_imp(c, prio, keep_alive);
+    o->m_head_dep = nullptr;
+    o->m_waiters  = nullptr;
     if (keep_alive)
         lean_inc_ref((lean_object*)o);
     return o;
@@ -925,8 +1279,10 @@ static lean_task_object * alloc_task(obj_arg c, unsigned prio, bool keep_alive)
 static lean_task_object * alloc_task(obj_arg v) {
     lean_task_object * o = (lean_task_object*)lean_alloc_small_object(sizeof(lean_task_object));
     lean_set_st_header((lean_object*)o, LeanTask, 0);
-    o->m_value = v;
-    o->m_imp   = nullptr;
+    o->m_value    = v;
+    o->m_imp      = nullptr;
+    o->m_head_dep = g_closed_deps;
+    o->m_waiters  = g_closed_waiters;
     return o;
 }
 
@@ -1006,13 +1362,27 @@ extern "C" LEAN_EXPORT obj_res lean_task_bind_core(obj_arg x, obj_arg f, unsigne
 }
 
 extern "C" LEAN_EXPORT bool lean_io_check_canceled_core() {
-    if (lean_task_object * t = g_current_task_object) {
+    lean_task_object * t = g_current_task_object ? g_current_task_object : g_inherited_task_object;
+    if (t) {
         lean_assert(t->m_imp); // task is being executed
         return t->m_imp->m_canceled || g_task_manager->shutting_down();
     }
     return false;
 }
 
+lean_task_object * get_current_task_object() {
+    return g_current_task_object ? g_current_task_object : g_inherited_task_object;
+}
+
+scoped_inherited_task_cancellation::scoped_inherited_task_cancellation(lean_task_object * t):
+    m_prev(g_inherited_task_object) {
+    g_inherited_task_object = t;
+}
+
+scoped_inherited_task_cancellation::~scoped_inherited_task_cancellation() {
+    g_inherited_task_object = m_prev;
+}
+
 extern "C" LEAN_EXPORT void lean_io_cancel_core(b_obj_arg t) {
     if (lean_to_task(t)->m_value)
         return;
@@ -1034,8 +1404,10 @@ extern "C" LEAN_EXPORT obj_res lean_io_promise_new(obj_arg) {
     object * closure = nullptr;
     lean_task_object * o = (lean_task_object*)lean_alloc_small_object(sizeof(lean_task_object));
     lean_set_task_header((lean_object*)o);
-    o->m_value = nullptr;
-    o->m_imp   = alloc_task_imp(closure, prio, keep_alive);
+    o->m_value    = nullptr;
+    o->m_imp      = alloc_task_imp(closure, prio, keep_alive);
+    o->m_head_dep = nullptr;
+    o->m_waiters  = nullptr;
     return io_result_mk_ok((lean_object *) o);
 }
 
@@ -2263,6 +2635,7 @@ extern "C" LEAN_EXPORT lean_external_class * lean_register_external_class(lean_e
 void initialize_object() {
     g_ext_classes       = new std::vector<external_object_class*>();
     g_ext_classes_mutex = new mutex();
+    g_thunk_parking_slots = new thunk_parking_slot[LEAN_THUNK_PARKING_SLOTS];
     g_array_empty       = lean_alloc_array(0, 0);
     mark_persistent(g_array_empty);
 }
@@ -2271,5 +2644,6 @@ void finalize_object() {
     for (external_object_class * cls : *g_ext_classes) delete cls;
     delete g_ext_classes;
     delete g_ext_classes_mutex;
+    delete[] g_thunk_parking_slots;
 }
 }
@@ -292,6 +292,19 @@ inline void io_cancel_core(b_obj_arg t) { return lean_io_cancel_core(t); }
 inline bool io_has_finished_core(b_obj_arg t) { return lean_io_has_finished_core(t); }
 inline b_obj_res io_wait_any_core(b_obj_arg task_list) { return lean_io_wait_any_core(task_list); }
 
+/* Task executed by the current thread, `nullptr` if there is none. */
+lean_task_object * get_current_task_object();
+
+/* While an object of this class is alive, `io_check_canceled_core` in the current thread also reports the
+   cancellation of `t`, a task executed by another thread on whose behalf the current thread is working.
+   That thread must keep executing `t` (e.g., by waiting for the current thread) until the scope ends. */
+class scoped_inherited_task_cancellation {
+    lean_task_object * m_prev;
+public:
+    scoped_inherited_task_cancellation(lean_task_object * t);
+    ~scoped_inherited_task_cancellation();
+};
+
 // =======================================
 // External
 
@@ -338,6 +351,9 @@ inline uint8 nat_dec_lt(b_obj_arg a1, b_obj_arg a2) { return lean_nat_dec_lt(a1,
 inline obj_res nat_land(b_obj_arg a1, b_obj_arg a2) { return lean_nat_land(a1, a2); }
 inline obj_res nat_lor(b_obj_arg a1, b_obj_arg a2) { return lean_nat_lor(a1, a2); }
 inline obj_res nat_lxor(b_obj_arg a1, b_obj_arg a2) { return lean_nat_lxor(a1, a2); }
+inline obj_res nat_shiftl(b_obj_arg a1, b_obj_arg a2) { return lean_nat_shiftl(a1, a2); }
+inline obj_res nat_shiftr(b_obj_arg a1, b_obj_arg a2) { return lean_nat_shiftr(a1, a2); }
+inline obj_res nat_log2(b_obj_arg a) { return lean_nat_log2(a); }
 
 // =======================================
 // Integers
@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2023 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include "runtime/debug.h"
+
+namespace lean {
+/** \brief Hash map based on open addressing with linear probing.
+
+    Keys, their hash codes and values are stored inline in a single array, so a lookup does not chase
+    pointers and an insertion does not allocate (except when the table grows). The hash code is compared
+    before invoking `Eq`, which is relevant for structural equality on expressions.
+
+    It implements the subset of the `std::unordered_map` API used by the kernel caches. Entries cannot be
+    erased, and iterators are pointers to entries, invalidated by `insert`. */
+template<typename Key, typename T, typename Hash, typename Eq = std::equal_to<Key>>
+class flat_hash_map {
+public:
+    typedef std::pair<Key, T>   value_type;
+    typedef value_type *        iterator;
+    typedef value_type const *  const_iterator;
+private:
+    struct slot {
+        unsigned m_hash;
+        bool     m_used;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type m_value;
+        value_type & value() { return *reinterpret_cast<value_type *>(&m_value); }
+    };
+    slot *   m_slots    = nullptr;
+    size_t   m_capacity = 0; /* zero or a power of two */
+    size_t   m_size     = 0;
+    Hash     m_hash;
+    Eq       m_eq;
+
+    static slot * alloc_slots(size_t capacity) {
+        slot * r = static_cast<slot *>(std::malloc(sizeof(slot) * capacity));
+        if (r == nullptr)
+            throw std::bad_alloc();
+        for (size_t i = 0; i < capacity; i++)
+            r[i].m_used = false;
+        return r;
+    }
+
+    void destroy_values() {
+        for (size_t i = 0; i < m_capacity; i++) {
+            if (m_slots[i].m_used) {
+                m_slots[i].value().~value_type();
+                m_slots[i].m_used = false;
+            }
+        }
+    }
+
+    slot * find_slot(Key const & k, unsigned h) const {
+        size_t mask = m_capacity - 1;
+        size_t i    = h & mask;
+        while (true) {
+            slot * s = m_slots + i;
+            if (!s->m_used || (s->m_hash == h && m_eq(s->value().first, k)))
+                return s;
+            i = (i + 1) & mask;
+        }
+    }
+
+    void grow() {
+        slot * old_slots    = m_slots;
+        size_t old_capacity = m_capacity;
+        m_capacity = old_capacity == 0 ? 16 : 2 * old_capacity;
+        m_slots    = alloc_slots(m_capacity);
+        for (size_t i = 0; i < old_capacity; i++) {
+            slot & old = old_slots[i];
+            if (old.m_used) {
+                slot * s = find_slot(old.value().first, old.m_hash);
+                new (&s->m_value) value_type(std::move(old.value()));
+                s->m_hash = old.m_hash;
+                s->m_used = true;
+                old.value().~value_type();
+            }
+        }
+        std::free(old_slots);
+    }
+
+    template<typename V>
+    std::pair<iterator, bool> insert_core(V && v) {
+        /* Keep the load factor at most 1/2, probe sequences are short at that point. */
+        if (2 * (m_size + 1) > m_capacity)
+            grow();
+        unsigned h = m_hash(v.first);
+        slot * s = find_slot(v.first, h);
+        if (s->m_used)
+            return std::make_pair(&s->value(), false);
+        new (&s->m_value) value_type(std::forward<V>(v));
+        s->m_hash = h;
+        s->m_used = true;
+        m_size++;
+        return std::make_pair(&s->value(), true);
+    }
+public:
+    flat_hash_map() {}
+    flat_hash_map(flat_hash_map const &) = delete;
+    flat_hash_map & operator=(flat_hash_map const &) = delete;
+    ~flat_hash_map() {
+        if (m_slots) {
+            destroy_values();
+            std::free(m_slots);
+        }
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    iterator end() { return nullptr; }
+    const_iterator end() const { return nullptr; }
+
+    iterator find(Key const & k) {
+        if (m_size == 0)
+            return nullptr;
+        slot * s = find_slot(k, m_hash(k));
+        return s->m_used ? &s->value() : nullptr;
+    }
+    const_iterator find(Key const & k) const {
+        return const_cast<flat_hash_map *>(this)->find(k);
+    }
+    bool contains(Key const & k) const { return find(k) != nullptr; }
+
+    std::pair<iterator, bool> insert(value_type const & v) { return insert_core(v); }
+    std::pair<iterator, bool> insert(value_type && v) { return insert_core(std::move(v)); }
+
+    /** \brief Remove all entries, the capacity is preserved. */
+    void clear() {
+        if (m_size > 0) {
+            destroy_values();
+            m_size = 0;
+        }
+    }
+};
+
+/** \brief Hash set version of `flat_hash_map`. */
+template<typename Key, typename Hash, typename Eq = std::equal_to<Key>>
+class flat_hash_set {
+    struct unit {};
+    flat_hash_map<Key, unit, Hash, Eq> m_map;
+public:
+    typedef Key const * const_iterator;
+
+    size_t size() const { return m_map.size(); }
+    bool empty() const { return m_map.empty(); }
+    const_iterator end() const { return nullptr; }
+    const_iterator find(Key const & k) const {
+        auto it = m_map.find(k);
+        return it ? &it->first : nullptr;
+    }
+    bool contains(Key const & k) const { return m_map.contains(k); }
+    bool insert(Key const & k) { return m_map.insert(std::make_pair(k, unit())).second; }
+    void clear() { m_map.clear(); }
+};
+}
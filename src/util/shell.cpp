@@ -8,6 +8,8 @@ Author: Leonardo de Moura
 #include <fstream>
 #include <signal.h>
 #include <cctype>
+#include <cerrno>
+#include <limits>
 #include <cstdlib>
 #include <string>
 #include <utility>
@@ -16,6 +18,7 @@ Author: Leonardo de Moura
 #include "runtime/stackinfo.h"
 #include "runtime/interrupt.h"
 #include "runtime/memory.h"
+#include "runtime/alloc.h"
 #include "runtime/thread.h"
 #include "runtime/debug.h"
 #include "runtime/sstream.h"
@@ -29,6 +32,8 @@ Author: Leonardo de Moura
 #include "util/option_declarations.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
+#include "kernel/type_checker.h"
+#include "kernel/inductive.h"
 #include "library/formatter.h"
 #include "library/module.h"
 #include "library/time_task.h"
@@ -37,6 +42,7 @@ Author: Leonardo de Moura
 #include "library/print.h"
 #include "initialize/init.h"
 #include "library/compiler/ir_interpreter.h"
+#include "library/compiler/compiler_cache.h"
 #include "util/path.h"
 #include "stdlib_flags.h"
 #ifdef _MSC_VER
@@ -173,7 +179,7 @@ using namespace lean; // NOLINT
 extern "C" void *initialize_Lean_Compiler_IR_EmitLLVM(uint8_t builtin,
                                                       lean_object *);
 extern "C" object *lean_ir_emit_llvm(object *env, object *mod_name,
-                                     object *filepath, object *target_triple, object *w);
+                                     object *filepath, object *target_triple, uint32_t num_threads, object *w);
 
 static void display_header(std::ostream & out) {
     out << "Lean (version " << get_version_string() << ", " << LEAN_STR(LEAN_BUILD_TYPE) << ")\n";
@@ -183,6 +189,9 @@ static void display_features(std::ostream & out) {
     out << "[";
 #if defined(LEAN_LLVM)
     out << "LLVM";
+#endif
+#if defined(LEAN_LLVM_JIT)
+    out << ", LLVM_JIT";
 #endif
     out << "]\n";
 }
@@ -199,6 +208,8 @@ static void display_help(std::ostream & out) {
     std::cout << "  --i=iname -i       create ilean file\n";
     std::cout << "  --c=fname -c       name of the C output file\n";
     std::cout << "  --bc=fname -b      name of the LLVM bitcode file\n";
+    std::cout << "  --bc-jobs=num      number of threads used for generating the LLVM bitcode file (default: 1);\n";
+    std::cout << "                     the module is split into chunks that are optimized separately\n";
     std::cout << "  --target=target    target triple of object file produced by LLVM\n";
     std::cout << "  --stdin            take input from stdin\n";
     std::cout << "  --root=dir         set package root directory from which the module name of the input file is calculated\n"
@@ -208,6 +219,11 @@ static void display_help(std::ostream & out) {
     std::cout << "  --quiet -q         do not print verbose messages\n";
     std::cout << "  --memory=num -M    maximum amount of memory that should be used by Lean\n";
     std::cout << "                     (in megabytes)\n";
+    std::cout << "  --hugepages        align memory segments for transparent huge pages and place them on the\n"
+              << "                     NUMA node of the allocating thread (Linux only, also LEAN_HUGE_PAGES=1)\n";
+    std::cout << "  --kernel-cache=num keep up to num type inference and weak head normal form results of closed terms\n"
+              << "                     over imported constants for reuse across declarations (default: 0, disabled)\n";
+    std::cout << "  --kernel-hcons     hash-cons the terms built by the kernel while checking a declaration\n";
     std::cout << "  --timeout=num -T   maximum number of memory allocations per task\n";
     std::cout << "                     this is a deterministic way of interrupting long running tasks\n";
 #if defined(LEAN_MULTI_THREAD)
@@ -221,7 +237,8 @@ static void display_help(std::ostream & out) {
     std::cout << "  --deps             just print dependencies of a Lean input\n";
     std::cout << "  --print-prefix     print the installation prefix for Lean and exit\n";
     std::cout << "  --print-libdir     print the installation directory for Lean's built-in libraries and exit\n";
-    std::cout << "  --profile          display elaboration/type checking time for each definition/theorem\n";
+    std::cout << "  --profile          display elaboration/type checking time for each definition/theorem,\n"
+                 "                     and the kernel unfolding profile as JSON\n";
     std::cout << "  --stats            display environment statistics\n";
     DEBUG_CODE(
     std::cout << "  --debug=tag        enable assertions with the given tag\n";
@@ -242,6 +259,9 @@ static struct option g_long_options[] = {
     {"stdin",        no_argument,       0, 'I'},
     {"root",         required_argument, 0, 'R'},
     {"memory",       required_argument, 0, 'M'},
+    {"hugepages",    no_argument,       0, 'H'},
+    {"kernel-cache", required_argument, 0, 'K'},
+    {"kernel-hcons", no_argument,       0, 'X'},
     {"trust",        required_argument, 0, 't'},
     {"profile",      no_argument,       0, 'P'},
     {"stats",        no_argument,       0, 'a'},
@@ -251,6 +271,7 @@ static struct option g_long_options[] = {
     {"timeout",      optional_argument, 0, 'T'},
     {"c",            optional_argument, 0, 'c'},
     {"bc",           optional_argument, 0, 'b'},
+    {"bc-jobs",      required_argument, 0, '4'},
     {"target",       optional_argument, 0, '3'},
     {"features",     optional_argument, 0, 'f'},
     {"exitOnPanic",  no_argument,       0, 'e'},
@@ -432,6 +453,19 @@ void check_optarg(char const * option_name) {
     }
 }
 
+/* Return the positive number given as argument of the option `option_name`, or exit with an error if it is not one. */
+unsigned get_positive_optarg(char const * option_name) {
+    check_optarg(option_name);
+    char * end;
+    errno = 0;
+    unsigned long val = std::strtoul(optarg, &end, 10);
+    if (!std::isdigit(*optarg) || *end || errno || val == 0 || val > std::numeric_limits<unsigned>::max()) {
+        std::cerr << "error: option '-" << option_name << "' expects a positive number, got '" << optarg << "'" << std::endl;
+        std::exit(1);
+    }
+    return static_cast<unsigned>(val);
+}
+
 extern "C" object * lean_enable_initializer_execution(object * w);
 
 extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
@@ -489,6 +523,7 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
     std::string native_output;
     optional<std::string> c_output;
     optional<std::string> llvm_output;
+    unsigned llvm_num_threads = 1;
     optional<std::string> target_triple;
     optional<std::string> root_dir;
     buffer<string_ref> forwarded_args;
@@ -527,6 +562,9 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
                 check_optarg("b");
                 llvm_output = optarg;
                 break;
+            case '4':
+                llvm_num_threads = get_positive_optarg("bc-jobs");
+                break;
             case '3':
                 check_optarg("target");
                 target_triple = optarg;
@@ -557,6 +595,19 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
                 opts = opts.update(get_max_memory_opt_name(), static_cast<unsigned>(atoi(optarg)));
                 forwarded_args.push_back(string_ref("-M" + std::string(optarg)));
                 break;
+            case 'H':
+                lean::set_huge_page_segments(true);
+                forwarded_args.push_back(string_ref("--hugepages"));
+                break;
+            case 'K':
+                check_optarg("K");
+                lean::set_kernel_cache_capacity(static_cast<size_t>(atoll(optarg)));
+                forwarded_args.push_back(string_ref("--kernel-cache=" + std::string(optarg)));
+                break;
+            case 'X':
+                lean::set_kernel_hash_consing(true);
+                forwarded_args.push_back(string_ref("--kernel-hcons"));
+                break;
             case 'T':
                 check_optarg("T");
                 opts = opts.update(get_timeout_opt_name(), static_cast<unsigned>(atoi(optarg)));
@@ -649,10 +700,17 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
 
     if (get_profiler(opts)) {
         report_profiling_time("initialization", init_time);
+        set_kernel_profiler(true);
+    }
+
+    // Server workers of the same watchdog import mostly the same modules, let them share relocated .olean files
+    if (run_server == 2 || std::getenv("LEAN_OLEAN_SHM_CACHE")) {
+        set_olean_shm_cache(true);
     }
 
     environment env(trust_lvl);
     scoped_task_manager scope_task_man(num_threads);
+    set_inductive_num_threads(num_threads);
     optional<name> main_module_name;
 
     std::string mod_fn = "<unknown>";
@@ -729,6 +787,7 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
 
         if (stats) {
             env.display_stats();
+            display_kernel_cache_stats(std::cout);
         }
 
         if (run && ok) {
@@ -770,10 +829,13 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
                         env.to_obj_arg(), (*main_module_name).to_obj_arg(),
                         lean::string_ref(*llvm_output).to_obj_arg(),
                         target_triple_lean,
+                        llvm_num_threads,
                         lean_io_mk_world()));
         }
 
         display_cumulative_profiling_times(std::cerr);
+        display_kernel_profile(std::cerr);
+        display_compiler_cache_stats(std::cerr);
 
 #ifdef LEAN_SMALL_ALLOCATOR
         // If the small allocator is not enabled, then we assume we are not using the sanitizer.
@@ -0,0 +1,24 @@
+/-!
+  Proofs by `decide` about 64-bit bitwise arithmetic on `Nat`. Checking them requires the kernel to
+  evaluate `Nat.land`, `Nat.lor`, `Nat.xor`, `Nat.shiftLeft`, `Nat.shiftRight` and `Nat.log2` on large literals. -/
+
+def mask64 : Nat := 2^64 - 1
+
+def rotl64 (x k : Nat) : Nat :=
+  ((x <<< k) ||| (x >>> (64 - k))) &&& mask64
+
+def popcount64 (x : Nat) : Nat :=
+  (List.range 64).foldl (fun n i => n + ((x >>> i) &&& 1)) 0
+
+theorem land_mask : (0xDEADBEEFCAFEBABE &&& mask64) = 0xDEADBEEFCAFEBABE := by decide
+theorem lor_eq_xor : (0xF0F0F0F0F0F0F0F0 ||| 0x0F0F0F0F0F0F0F0F) = (0xF0F0F0F0F0F0F0F0 ^^^ 0x0F0F0F0F0F0F0F0F) := by decide
+theorem shift_roundtrip : (0x123456789ABCDEF0 <<< 7) >>> 7 = 0x123456789ABCDEF0 := by decide
+theorem log2_mask : Nat.log2 mask64 = 63 := by decide
+
+theorem rotl_roundtrip :
+    (List.range 64).all (fun k => rotl64 (rotl64 0x0123456789ABCDEF k) (64 - k) == 0x0123456789ABCDEF) = true := by
+  decide
+
+theorem popcount_xor :
+    (List.range 64).all (fun k => popcount64 (rotl64 0xFEDCBA9876543210 k ^^^ mask64) == 32) = true := by
+  decide
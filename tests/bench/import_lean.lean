@@ -0,0 +1,6 @@
+import Lean
+
+/-!
+  Measures the time to import `Lean`, i.e. to read and relocate the `.olean` files of its dependency closure.
+  Run with different `-j` values to see how reading them in parallel scales.
+-/
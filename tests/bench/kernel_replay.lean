@@ -0,0 +1,21 @@
+import Lean
+import Lean.Replay
+open Lean
+
+/-!
+  Replays the `addDecl` calls of library modules: their declarations are type checked by the kernel again,
+  on top of an environment containing only the modules' imports. This mostly measures the kernel
+  type checker and its caches. -/
+
+def replayModule (mod : Name) : IO Unit := do
+  let (data, _) ← readModuleData (← findOLean mod)
+  let env ← importModules data.imports {}
+  let mut newConstants : HashMap Name ConstantInfo := {}
+  for name in data.constNames, ci in data.constants do
+    newConstants := newConstants.insert name ci
+  let env' ← env.replay newConstants
+  IO.println s!"{mod}: {env'.constants.size - env.constants.size} declarations"
+
+set_option profiler true
+#eval replayModule `Init.Data.Nat.Linear
+#eval replayModule `Lean.Meta.ExprDefEq
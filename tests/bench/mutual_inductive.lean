@@ -0,0 +1,30 @@
+import Lean
+open Lean
+
+/-!
+  Adds mutual inductive datatypes with hundreds of constructors directly to the kernel, this mostly measures
+  the constructor checks and the construction of the recursors. -/
+
+def tName (i : Nat) : Name := .mkSimple s!"T{i}"
+
+/-- `T{i}.c{j} : (α : Type) → α → T{j % n} α → (Nat → T{(j+1) % n} α) → T{i} α` -/
+def mkCtor (n i j : Nat) : Constructor := {
+  name := tName i ++ .mkSimple s!"c{j}"
+  type :=
+    .forallE `α (mkSort levelOne)
+      (.forallE `a (.bvar 0)
+        (.forallE `b (mkApp (mkConst (tName (j % n))) (.bvar 1))
+          (.forallE `f (.forallE `x (mkConst ``Nat) (mkApp (mkConst (tName ((j+1) % n))) (.bvar 3)) .default)
+            (mkApp (mkConst (tName i)) (.bvar 3)) .default) .default) .default) .default
+}
+
+/-- `n` mutual inductive datatypes `T{i} : Type → Type` with `k` constructors each. -/
+def mkMutual (n k : Nat) : Declaration :=
+  .inductDecl [] 1 (List.range n |>.map fun i => {
+    name := tName i
+    type := .forallE `α (mkSort levelOne) (mkSort levelOne) .default
+    ctors := List.range k |>.map (mkCtor n i)
+  }) false
+
+set_option profiler true
+#eval addDecl (mkMutual 4 200)
@@ -0,0 +1,27 @@
+/-!
+Stress test for the task manager: lots of tiny tasks created via `Task.spawn`, `Task.map` and `Task.bind`,
+both from the main thread and from within worker threads.
+Run with different values of `LEAN_NUM_THREADS` to see how throughput scales with the number of workers.
+-/
+
+/-- Spawns `n` tasks from the main thread and maps over each of them. -/
+def spawnFlat (n : Nat) : Nat := Id.run do
+  let mut ts : Array (Task Nat) := #[]
+  for i in [0:n] do
+    ts := ts.push ((Task.spawn fun _ => i).map (· % 7))
+  return ts.foldl (fun s t => s + t.get) 0
+
+/-- Builds a binary tree of tasks of depth `d` where inner nodes spawn their children from a worker thread. -/
+partial def spawnTree (d i : Nat) : Task Nat :=
+  if d = 0 then Task.spawn fun _ => i % 3
+  else (Task.spawn fun _ => d).bind fun _ =>
+    let l := spawnTree (d - 1) (2 * i)
+    let r := spawnTree (d - 1) (2 * i + 1)
+    l.bind fun a => r.map (a + ·)
+
+def main : List String → IO UInt32
+  | [n, d] => do
+    IO.println s!"flat: {spawnFlat n.toNat!}"
+    IO.println s!"tree: {(spawnTree d.toNat! 0).get}"
+    return 0
+  | _ => return 1
@@ -0,0 +1,18 @@
+/-!
+Many threads force the same expensive thunk at once. All but one of them have to wait for the result
+while it is being evaluated; the `task-clock` of this benchmark shows how much CPU time these waiters burn.
+-/
+
+def work (n : Nat) : Nat := Id.run do
+  let mut acc := 0
+  for i in [0:n] do
+    acc := (acc + i * i) % 1000000007
+  return acc
+
+def main : List String → IO UInt32
+  | [n, k] => do
+    let t : Thunk Nat := Thunk.mk fun _ => work n.toNat!
+    let ts := (List.range k.toNat!).map fun i => Task.spawn (prio := .dedicated) fun _ => t.get + i
+    IO.println s!"{ts.foldl (fun s t => s + t.get) 0}"
+    return 0
+  | _ => return 1
@@ -0,0 +1,23 @@
+/-!
+  Run declarations of the current module through the JIT of the interpreter (see `test_single.sh`), including
+  declarations using constants of the current module, and check their results. -/
+
+def fib : Nat → Nat
+  | 0 => 0
+  | 1 => 1
+  | n+2 => fib n + fib (n+1)
+
+def primes : Array Nat := #[2, 3, 5, 7, 11, 13]
+
+def sumPrimesBelow (n : Nat) : Nat :=
+  primes.foldl (init := 0) fun acc p => if p < n then acc + p else acc
+
+def check (desc : String) (actual expected : Nat) : IO Unit :=
+  unless actual == expected do
+    throw <| IO.userError s!"{desc}: expected {expected}, got {actual}"
+
+#eval show IO Unit from do
+  for _ in [0:3] do
+    check "fib 25" (fib 25) 75025
+    check "sumPrimesBelow 10" (sumPrimesBelow 10) 17
+    check "sumPrimesBelow 100" (sumPrimesBelow 100) 41
@@ -0,0 +1,5 @@
+#!/usr/bin/env bash
+source ../../common.sh
+
+# compile every declaration of the current module with the JIT after its first call
+exec_check lean -Dinterpreter.jit_threshold=1 -Dlinter.all=false "$f"
@@ -0,0 +1,27 @@
+import Lean
+open Lean
+
+/-
+`A` and `B` share the same type object, but declare their universe parameters in a different order.
+The kernel memoizes the instantiation of constant types, and must not confuse `A.{1, 0}` with `B.{1, 0}`.
+-/
+#eval show CoreM Unit from do
+  let u := mkLevelParam `u
+  let v := mkLevelParam `v
+  let type := mkForall `x .default (mkSort u) (mkSort v)
+  addDecl <| .axiomDecl { name := `A, levelParams := [`u, `v], type, isUnsafe := false }
+  addDecl <| .axiomDecl { name := `B, levelParams := [`v, `u], type, isUnsafe := false }
+  let one := mkLevelSucc levelZero
+  -- `A.{1, 0} : Type → Prop`
+  addDecl <| .defnDecl {
+    name := `dA, levelParams := [], hints := .abbrev, safety := .safe
+    type := mkForall `x .default (mkSort one) (mkSort levelZero)
+    value := mkConst `A [one, levelZero] }
+  -- `B.{1, 0} : Prop → Type`
+  addDecl <| .defnDecl {
+    name := `dB, levelParams := [], hints := .abbrev, safety := .safe
+    type := mkForall `x .default (mkSort levelZero) (mkSort one)
+    value := mkConst `B [one, levelZero] }
+
+#check @dA
+#check @dB
@@ -0,0 +1,25 @@
+/-!
+  Declarations exercising the compiler stages whose results are stored by `compiler.cache_dir`:
+  matchers, specializations, closed terms, and auxiliary declarations. -/
+
+inductive Tree where
+  | leaf
+  | node (l : Tree) (v : Nat) (r : Tree)
+
+def Tree.insert : Tree → Nat → Tree
+  | leaf, x => node leaf x leaf
+  | node l v r, x => if x < v then node (l.insert x) v r else node l v (r.insert x)
+
+def Tree.toList : Tree → List Nat
+  | leaf => []
+  | node l v r => l.toList ++ [v] ++ r.toList
+
+@[specialize] def mapTwice (f : Nat → Nat) (xs : List Nat) : List Nat :=
+  xs.map f |>.map f
+
+def table : List String := (List.range 10).map toString
+
+def main : IO Unit := do
+  let t := [5, 3, 8, 1].foldl Tree.insert .leaf
+  IO.println (mapTwice (· + 1) t.toList)
+  IO.println table
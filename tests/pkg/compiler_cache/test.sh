@@ -0,0 +1,12 @@
+#!/usr/bin/env bash
+set -e
+
+# Compile the same module twice with the compiler cache enabled: the second run must only hit the cache,
+# and produce the same code.
+rm -rf build
+mkdir -p build
+lean -Dcompiler.cache_dir=build/cache -c build/first.c CompilerCache.lean 2> build/first.err
+lean -Dcompiler.cache_dir=build/cache -c build/second.c CompilerCache.lean 2> build/second.err
+grep -q "compiler cache: 0 hits, [1-9][0-9]* misses" build/first.err
+grep -q "compiler cache: [1-9][0-9]* hits, 0 misses" build/second.err
+diff build/first.c build/second.c